@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2012 Yang Zhang <yang.zhang@stanzax.org>
+ * Copyright (C) 2012 Jinglei Ren <jinglei.ren@stanzax.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "arena.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+
+#define HUGE_PAGE_SIZE  (2UL * 1024 * 1024)
+
+// Size classes: four per power of two, from 64 bytes to ARENA_MAX_BLOCK,
+// i.e. 64, 80, 96, 112, 128, 160, ... so that at most 25% is wasted.
+#define MIN_SHIFT       6
+#define MAX_SHIFT       20
+#define SUB_CLASSES     4
+#define N_CLASS         ((MAX_SHIFT - MIN_SHIFT) * SUB_CLASSES + 1)
+
+// from linux/mempolicy.h, which not every libc ships
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED  1
+#endif
+
+
+struct free_block {
+    struct free_block *next;
+};
+
+struct size_class {
+    pthread_mutex_t lock;
+    struct free_block *free_list;
+};
+
+struct arena {
+    char *base;
+    size_t size;
+    size_t brk;     // bytes carved so far
+    int backing;
+    struct size_class classes[N_CLASS];
+};
+
+
+static int class_of(size_t len) {
+    if (len <= (1UL << MIN_SHIFT)) {
+        return 0;
+    }
+    int shift = 63 - __builtin_clzl(len - 1); // len - 1 in [2^shift, 2^(shift + 1))
+    int sub = (int) (((len - 1) >> (shift - 2)) & (SUB_CLASSES - 1));
+    return (shift - MIN_SHIFT) * SUB_CLASSES + sub + 1;
+}
+
+
+static size_t class_size(int c) {
+    if (c == 0) {
+        return 1UL << MIN_SHIFT;
+    }
+    int shift = (c - 1) / SUB_CLASSES + MIN_SHIFT;
+    int sub = (c - 1) % SUB_CLASSES;
+    return (1UL << shift) + (size_t) (sub + 1) * (1UL << (shift - 2));
+}
+
+
+// Prefers node for the pages of [p, p + len); only preferred, so a full
+// node spills over instead of failing allocations.
+static void bind_node(void *p, size_t len, int node) {
+#ifdef SYS_mbind
+    unsigned long mask = 1UL << node;
+    syscall(SYS_mbind, p, len, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0);
+#endif
+}
+
+
+struct arena *arena_create(size_t bytes) {
+    return arena_create_on(bytes, -1);
+}
+
+
+struct arena *arena_create_on(size_t bytes, int node) {
+    struct arena *a = (struct arena *) calloc(1, sizeof(struct arena));
+    if (a == NULL) {
+        return NULL;
+    }
+    a->size = (bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+
+    void *p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    p = mmap(NULL, a->size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    a->backing = ARENA_HUGETLB;
+#endif
+    if (p == MAP_FAILED) {
+        // no huge pages reserved, fall back to normal pages
+        p = mmap(NULL, a->size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED) {
+            free(a);
+            return NULL;
+        }
+        a->backing = ARENA_NORMAL;
+#ifdef MADV_HUGEPAGE
+        if (madvise(p, a->size, MADV_HUGEPAGE) == 0) {
+            a->backing = ARENA_THP;
+        }
+#endif
+    }
+    a->base = (char *) p;
+    if (node >= 0 && node < (int) sizeof(unsigned long) * 8) {
+        bind_node(p, a->size, node);
+    }
+
+    int i;
+    for (i = 0; i < N_CLASS; i++) {
+        pthread_mutex_init(&a->classes[i].lock, NULL);
+    }
+    return a;
+}
+
+
+void arena_destroy(struct arena *a) {
+    int i;
+    for (i = 0; i < N_CLASS; i++) {
+        pthread_mutex_destroy(&a->classes[i].lock);
+    }
+    munmap(a->base, a->size);
+    free(a);
+}
+
+
+void *arena_alloc(struct arena *a, size_t len) {
+    if (len > ARENA_MAX_BLOCK) {
+        return NULL;
+    }
+    int c = class_of(len);
+    struct size_class *sc = &a->classes[c];
+
+    pthread_mutex_lock(&sc->lock);
+    struct free_block *b = sc->free_list;
+    if (b) {
+        sc->free_list = b->next;
+    }
+    pthread_mutex_unlock(&sc->lock);
+    if (b) {
+        return b;
+    }
+
+    // carve a new block
+    size_t size = class_size(c);
+    size_t at = __atomic_fetch_add(&a->brk, size, __ATOMIC_RELAXED);
+    if (at + size > a->size) {
+        // used up; 'brk' stays beyond the end so later carving fails fast
+        return NULL;
+    }
+    return a->base + at;
+}
+
+
+void arena_free(struct arena *a, void *ptr, size_t len) {
+    struct size_class *sc = &a->classes[class_of(len)];
+    struct free_block *b = (struct free_block *) ptr;
+
+    pthread_mutex_lock(&sc->lock);
+    b->next = sc->free_list;
+    sc->free_list = b;
+    pthread_mutex_unlock(&sc->lock);
+}
+
+
+int arena_contains(struct arena *a, void *ptr) {
+    return (char *) ptr >= a->base && (char *) ptr < a->base + a->size;
+}
+
+
+int arena_backing(struct arena *a) {
+    return a->backing;
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2012 Yang Zhang <yang.zhang@stanzax.org>
+ * Copyright (C) 2012 Jinglei Ren <jinglei.ren@stanzax.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+//
+//  arena.h
+//  Cinquain Cache
+//
+//  Size-class allocator over one large mapping for cached extent data.
+//
+//  The mapping is backed by explicit huge pages (MAP_HUGETLB) if the system
+//  has them reserved, otherwise by normal pages advised for transparent
+//  huge pages. Blocks are carved from the mapping by a bump pointer and
+//  recycled through per-class free lists; they never go back to the system
+//  before the arena is destroyed. An arena may prefer the memory of one
+//  NUMA node, set by mbind() before any page is touched.
+//
+
+#ifndef CINQUAIN_ARENA_H_
+#define CINQUAIN_ARENA_H_
+
+#include <stddef.h>
+
+// larger requests are not served by the arena
+#define ARENA_MAX_BLOCK     (1024 * 1024)
+
+// backing of an arena
+enum arena_backing {
+    ARENA_HUGETLB,      // explicit huge pages
+    ARENA_THP,          // normal pages, advised for transparent huge pages
+    ARENA_NORMAL,       // normal pages
+};
+
+struct arena;
+
+#ifdef __KERNEL__
+
+static inline struct arena *arena_create(size_t bytes) { return NULL; }
+static inline struct arena *arena_create_on(size_t bytes, int node) { return NULL; }
+static inline void arena_destroy(struct arena *a) { }
+static inline void *arena_alloc(struct arena *a, size_t len) { return NULL; }
+static inline void arena_free(struct arena *a, void *ptr, size_t len) { }
+static inline int arena_contains(struct arena *a, void *ptr) { return 0; }
+static inline int arena_backing(struct arena *a) { return ARENA_NORMAL; }
+
+#else // user space
+
+// Maps an arena of at least 'bytes'. Returns NULL on failure.
+struct arena *arena_create(size_t bytes);
+
+// Like arena_create(), with pages taken from NUMA node 'node' while it has
+// free memory. A negative node, or one the kernel refuses, leaves pages
+// wherever they are first touched.
+struct arena *arena_create_on(size_t bytes, int node);
+
+// Unmaps the arena. All blocks carved from it become invalid.
+void arena_destroy(struct arena *a);
+
+// Returns a block of at least len bytes, or NULL if len is larger than
+// ARENA_MAX_BLOCK or the arena is used up.
+void *arena_alloc(struct arena *a, size_t len);
+
+// Returns a block to its size class. len is the one passed to arena_alloc().
+void arena_free(struct arena *a, void *ptr, size_t len);
+
+// Returns non-zero if ptr was carved from the arena.
+int arena_contains(struct arena *a, void *ptr);
+
+// Returns enum arena_backing of the arena.
+int arena_backing(struct arena *a);
+
+#endif // __KERNEL__
+
+#endif // CINQUAIN_ARENA_H_
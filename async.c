@@ -0,0 +1,271 @@
+/*
+ * Copyright (C) 2012 Yang Zhang <yang.zhang@stanzax.org>
+ * Copyright (C) 2012 Jinglei Ren <jinglei.ren@stanzax.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+//
+//  async.c
+//  Cinquain Cache
+//
+//  Submission and completion rings run by worker threads.
+//
+//  Both rings are arrays of 'size' entries indexed by free-running
+//  counters. Entries stay accounted from cinq_get_sqe() until their
+//  completion is reaped, so neither ring can overrun. Workers take and
+//  post entries in batches, one lock round and one wakeup per batch.
+//
+
+#include "cinq_cache.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+
+// max entries a worker takes at once
+#define ASYNC_BATCH     16
+
+struct cinq_ring {
+    unsigned int size;          // power of two
+    struct cinq_sqe *sq;
+    struct cinq_cqe *cq;
+
+    // owned by the driving thread
+    unsigned int sq_fill;       // entries got, submitted or not
+
+    // guarded by lock
+    unsigned int sq_head;       // next to run
+    unsigned int sq_tail;       // submitted
+    unsigned int cq_head;       // reaped
+    unsigned int cq_tail;       // posted
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t sq_cond;     // workers wait for submissions
+    pthread_cond_t cq_cond;     // cinq_reap() waits for completions
+
+    int efd;
+    int n_workers;
+    pthread_t *workers;
+};
+
+
+static void async_run(struct cinq_sqe *sqe, struct cinq_cqe *cqe) {
+    struct cinq_handle *h = sqe->handle;
+    struct data_entry *de = &(sqe->de);
+
+    cqe->user_data = sqe->user_data;
+    cqe->res = 0;
+    cqe->ds = NULL;
+    switch (sqe->op) {
+    case CINQ_OP_RGET:
+        cqe->ds = h ? rcache_get_h(h, de->offset, de->len) : rcache_get(&(sqe->fp), de->offset, de->len);
+        break;
+    case CINQ_OP_RPUT:
+        if (h) {
+            rcache_put_h(h, de);
+        } else {
+            rcache_put(&(sqe->fp), de);
+        }
+        break;
+    case CINQ_OP_WREAD:
+        cqe->ds = h ? wcache_read_h(h, de->offset, de->len) : wcache_read(&(sqe->fp), de->offset, de->len);
+        break;
+    case CINQ_OP_WWRITE:
+        cqe->res = h ? wcache_write_h(h, de) : wcache_write(&(sqe->fp), de);
+        break;
+    case CINQ_OP_WCOLLECT:
+        cqe->ds = h ? wcache_collect_h(h) : wcache_collect(&(sqe->fp));
+        break;
+    default:
+        cqe->res = -1;
+        break;
+    }
+}
+
+
+static void *async_worker(void *arg) {
+    struct cinq_ring *r = (struct cinq_ring *) arg;
+    unsigned int mask = r->size - 1;
+    struct cinq_sqe batch[ASYNC_BATCH];
+    struct cinq_cqe done[ASYNC_BATCH];
+
+    pthread_mutex_lock(&r->lock);
+    for (;;) {
+        while (!r->stop && r->sq_head == r->sq_tail) {
+            pthread_cond_wait(&r->sq_cond, &r->lock);
+        }
+        if (r->sq_head == r->sq_tail) {
+            break; // stopped and drained
+        }
+        unsigned int n = r->sq_tail - r->sq_head, i;
+        if (n > ASYNC_BATCH) {
+            n = ASYNC_BATCH;
+        }
+        for (i = 0; i < n; i++) {
+            batch[i] = r->sq[(r->sq_head + i) & mask];
+        }
+        r->sq_head += n;
+        pthread_mutex_unlock(&r->lock);
+
+        for (i = 0; i < n; i++) {
+            async_run(&batch[i], &done[i]);
+        }
+
+        pthread_mutex_lock(&r->lock);
+        for (i = 0; i < n; i++) {
+            r->cq[(r->cq_tail + i) & mask] = done[i];
+        }
+        r->cq_tail += n;
+        pthread_cond_broadcast(&r->cq_cond);
+        if (r->efd >= 0) {
+            unsigned long long one = 1;
+            ssize_t ret = write(r->efd, &one, sizeof(one));
+            (void) ret; // a full counter is readable anyway
+        }
+    }
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
+}
+
+
+struct cinq_ring *cinq_ring_create(unsigned int entries, int workers) {
+    struct cinq_ring *r;
+    unsigned int size = 1;
+    int i;
+
+    if (entries == 0 || workers <= 0) {
+        return NULL;
+    }
+    while (size < entries) {
+        size <<= 1;
+    }
+    r = (struct cinq_ring *) calloc(1, sizeof(struct cinq_ring));
+    if (r == NULL) {
+        return NULL;
+    }
+    r->size = size;
+    r->sq = (struct cinq_sqe *) calloc(size, sizeof(struct cinq_sqe));
+    r->cq = (struct cinq_cqe *) calloc(size, sizeof(struct cinq_cqe));
+    r->workers = (pthread_t *) calloc(workers, sizeof(pthread_t));
+    if (r->sq == NULL || r->cq == NULL || r->workers == NULL) {
+        goto fail;
+    }
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->sq_cond, NULL);
+    pthread_cond_init(&r->cq_cond, NULL);
+    r->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    for (i = 0; i < workers; i++) {
+        if (pthread_create(&r->workers[i], NULL, async_worker, r) != 0) {
+            break;
+        }
+    }
+    r->n_workers = i;
+    if (i == 0) {
+        cinq_ring_destroy(r);
+        return NULL;
+    }
+    return r;
+
+fail:
+    free(r->sq);
+    free(r->cq);
+    free(r->workers);
+    free(r);
+    return NULL;
+}
+
+
+void cinq_ring_destroy(struct cinq_ring *r) {
+    int i;
+
+    pthread_mutex_lock(&r->lock);
+    r->stop = 1;
+    pthread_cond_broadcast(&r->sq_cond);
+    pthread_mutex_unlock(&r->lock);
+    for (i = 0; i < r->n_workers; i++) {
+        pthread_join(r->workers[i], NULL);
+    }
+
+    for (; r->cq_head != r->cq_tail; r->cq_head++) {
+        free_data_set(r->cq[r->cq_head & (r->size - 1)].ds, 1);
+    }
+    if (r->efd >= 0) {
+        close(r->efd);
+    }
+    pthread_cond_destroy(&r->cq_cond);
+    pthread_cond_destroy(&r->sq_cond);
+    pthread_mutex_destroy(&r->lock);
+    free(r->sq);
+    free(r->cq);
+    free(r->workers);
+    free(r);
+}
+
+
+struct cinq_sqe *cinq_get_sqe(struct cinq_ring *r) {
+    pthread_mutex_lock(&r->lock);
+    unsigned int used = r->sq_fill - r->cq_head;
+    pthread_mutex_unlock(&r->lock);
+    if (used >= r->size) {
+        return NULL;
+    }
+    struct cinq_sqe *sqe = &(r->sq[r->sq_fill & (r->size - 1)]);
+    r->sq_fill++;
+    sqe->handle = NULL;
+    return sqe;
+}
+
+
+unsigned int cinq_submit(struct cinq_ring *r) {
+    pthread_mutex_lock(&r->lock);
+    unsigned int n = r->sq_fill - r->sq_tail;
+    if (n) {
+        r->sq_tail = r->sq_fill;
+        pthread_cond_broadcast(&r->sq_cond);
+    }
+    pthread_mutex_unlock(&r->lock);
+    return n;
+}
+
+
+unsigned int cinq_reap(struct cinq_ring *r, struct cinq_cqe *cqes, unsigned int max, unsigned int min) {
+    unsigned int n = 0;
+
+    pthread_mutex_lock(&r->lock);
+    // never wait for more than was submitted
+    if (min > r->sq_tail - r->cq_head) {
+        min = r->sq_tail - r->cq_head;
+    }
+    if (min > max) {
+        min = max;
+    }
+    while (r->cq_tail - r->cq_head < min) {
+        pthread_cond_wait(&r->cq_cond, &r->lock);
+    }
+    while (n < max && r->cq_head != r->cq_tail) {
+        cqes[n++] = r->cq[r->cq_head & (r->size - 1)];
+        r->cq_head++;
+    }
+    pthread_mutex_unlock(&r->lock);
+    return n;
+}
+
+
+int cinq_ring_fd(struct cinq_ring *r) {
+    return r->efd;
+}
@@ -0,0 +1,555 @@
+/*
+ * Copyright (C) 2012 Yang Zhang <yang.zhang@stanzax.org>
+ * Copyright (C) 2012 Jinglei Ren <jinglei.ren@stanzax.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+//
+//  bench.c
+//  Cinquain Cache
+//
+//  Multi-threaded load generator.
+//
+//  The key space is 'keys' extents spread over files of 'blocks' extents
+//  each. Reads go through R-cache as a read-through cache: a get that does
+//  not cover the extent is followed by a put of it, as if fetched from the
+//  backend. Writes go to W-cache, and every so often a file is collected.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include "cinq_cache.h"
+
+
+enum dist {
+    DIST_UNIFORM,
+    DIST_ZIPF,
+    DIST_SEQ,
+};
+
+static struct {
+    int threads;
+    unsigned long keys;
+    unsigned long blocks;       // extents per file
+    unsigned long ops;          // per thread
+    int dist;
+    double theta;               // Zipf skew
+    offset_t min_len;
+    offset_t max_len;
+    double read_ratio;
+    double wread_ratio;         // fraction of the rest reading W-cache back
+    unsigned long collect_every;
+    int prefill;                // put every extent before measuring
+    double scan_ratio;          // fraction of reads from a sequential scan
+    unsigned long tinylfu;      // admission sketch width, 0 for none
+    int policy;                 // enum cinq_evict_policy
+    size_t limit;               // R-cache limit in bytes, 0 for the default
+    unsigned int mrc;           // miss ratio curve sampling 1 in mrc, 0 for none
+    unsigned int reclaim_low;   // reclaimer watermarks in percent, 0 for none
+    unsigned int reclaim_high;
+    int numa;                   // a shard per NUMA node
+    size_t numa_arena;          // arena bytes of each shard, 0 for none
+    size_t wlog;                // W-cache log segment bytes, 0 for in place
+    unsigned int l0_slots;      // thread-local R-cache slots, 0 for none
+    size_t l0_max;              // longest extent copied there, 0 for -l max
+} opt = {
+    .threads = 4,
+    .keys = 100000,
+    .blocks = 256,
+    .ops = 1000000,
+    .dist = DIST_ZIPF,
+    .theta = 0.99,
+    .min_len = 4096,
+    .max_len = 4096,
+    .read_ratio = 0.9,
+    .collect_every = 64,
+};
+
+
+// set in NUMA mode, where calls go to its shards instead of the default cache
+static struct cinq_numa *numa;
+
+static struct data_set *do_rget(struct fingerprint *fp, offset_t offset, offset_t len) {
+    return numa ? cinq_numa_rcache_get(numa, fp, offset, len) : rcache_get(fp, offset, len);
+}
+
+static void do_rput(struct fingerprint *fp, struct data_entry *de) {
+    if (numa) {
+        cinq_numa_rcache_put(numa, fp, de);
+    } else {
+        rcache_put(fp, de);
+    }
+}
+
+static void do_wwrite(struct fingerprint *fp, struct data_entry *de) {
+    if (numa) {
+        cinq_numa_wcache_write(numa, fp, de);
+    } else {
+        wcache_write(fp, de);
+    }
+}
+
+static struct data_set *do_wread(struct fingerprint *fp, offset_t offset, offset_t len) {
+    return numa ? cinq_numa_wcache_read(numa, fp, offset, len) : wcache_read(fp, offset, len);
+}
+
+static struct data_set *do_wcollect(struct fingerprint *fp) {
+    return numa ? cinq_numa_wcache_collect(numa, fp) : wcache_collect(fp);
+}
+
+
+// xorshift64*
+static inline unsigned long rand_next(unsigned long *s) {
+    *s ^= *s >> 12;
+    *s ^= *s << 25;
+    *s ^= *s >> 27;
+    return *s * 2685821657736338717UL;
+}
+
+static inline double rand_unit(unsigned long *s) {
+    return (rand_next(s) >> 11) * (1.0 / (1UL << 53));
+}
+
+
+// Zipf generator of Gray et al., "Quickly Generating Billion-Record
+// Synthetic Databases", SIGMOD 1994
+static double zipf_zetan, zipf_alpha, zipf_eta;
+
+static void zipf_init(unsigned long n, double theta) {
+    double zeta2 = 1.0 + pow(0.5, theta);
+    unsigned long i;
+    zipf_zetan = 0;
+    for (i = 1; i <= n; i++) {
+        zipf_zetan += 1.0 / pow((double) i, theta);
+    }
+    zipf_alpha = 1.0 / (1.0 - theta);
+    zipf_eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zipf_zetan);
+}
+
+static unsigned long zipf_next(unsigned long *s, unsigned long n, double theta) {
+    double u = rand_unit(s);
+    double uz = u * zipf_zetan;
+    if (uz < 1.0) {
+        return 0;
+    }
+    if (uz < 1.0 + pow(0.5, theta)) {
+        return 1;
+    }
+    unsigned long k = (unsigned long) (n * pow(zipf_eta * u - zipf_eta + 1.0, zipf_alpha));
+    return k < n ? k : n - 1;
+}
+
+
+// stable length of an extent within [min_len, max_len]
+static offset_t key_len(unsigned long key) {
+    if (opt.max_len == opt.min_len) {
+        return opt.min_len;
+    }
+    unsigned long h = key * 0x9e3779b97f4a7c15UL;
+    return opt.min_len + (h >> 32) % (opt.max_len - opt.min_len + 1);
+}
+
+static void key_place(unsigned long key, struct fingerprint *fp, offset_t *offset) {
+    unsigned long file = key / opt.blocks;
+    memset(fp, 0, sizeof(struct fingerprint));
+    // spread files over hash slots, see fp_slot()
+    unsigned int mixed = (unsigned int) (file * 2654435761UL);
+    memcpy(fp->value, &mixed, sizeof(mixed));
+    memcpy(fp->value + sizeof(mixed), &file, sizeof(file));
+    *offset = (key % opt.blocks) * opt.max_len;
+}
+
+
+struct worker {
+    pthread_t tid;
+    int id;
+    unsigned long reads;
+    unsigned long writes;
+    unsigned long wreads;
+    unsigned long bytes;
+    unsigned long read_bytes;   // requested by reads
+    unsigned long hit_bytes;    // ... and served from the cache
+};
+
+static void *worker_run(void *arg) {
+    struct worker *w = (struct worker *) arg;
+    unsigned long seed = 0x2545f4914f6cdd1dUL * (w->id + 1);
+    unsigned long seq = opt.keys / opt.threads * w->id;
+    unsigned long scan = seq;
+    char *buf = (char *) malloc(opt.max_len);
+    unsigned long i;
+
+    memset(buf, w->id, opt.max_len);
+    for (i = 0; i < opt.ops; i++) {
+        unsigned long key;
+        switch (opt.dist) {
+        case DIST_ZIPF:
+            key = zipf_next(&seed, opt.keys, opt.theta);
+            break;
+        case DIST_SEQ:
+            key = seq++ % opt.keys;
+            break;
+        default:
+            key = rand_next(&seed) % opt.keys;
+            break;
+        }
+        int reading = rand_unit(&seed) < opt.read_ratio;
+        if (reading && opt.scan_ratio > 0 && rand_unit(&seed) < opt.scan_ratio) {
+            // one-off reads sweeping the whole key space
+            key = scan++ % opt.keys;
+        }
+
+        struct fingerprint fp;
+        struct data_entry de;
+        key_place(key, &fp, &de.offset);
+        de.len = key_len(key);
+        de.data = buf;
+
+        if (reading) {
+            struct data_set *ds = do_rget(&fp, de.offset, de.len);
+            offset_t got = 0;
+            if (ds) {
+                struct data_entry *e;
+                list_for_each_entry(e, &ds->entries, entry) {
+                    got += e->len;
+                }
+                free_data_set(ds, 1);
+            }
+            if (got < de.len) {
+                // fetched from the backend
+                do_rput(&fp, &de);
+            }
+            w->reads++;
+            w->read_bytes += de.len;
+            w->hit_bytes += got < de.len ? got : de.len;
+        } else if (opt.wread_ratio > 0 && rand_unit(&seed) < opt.wread_ratio) {
+            // dirty data read back before it is collected
+            if (cinq_epoch_enter() == 0) {
+                struct data_set *ds = do_wread(&fp, de.offset, de.len);
+                if (ds) {
+                    free_data_set(ds, 0);
+                }
+                cinq_epoch_exit();
+            }
+            w->wreads++;
+        } else {
+            do_wwrite(&fp, &de);
+            if (opt.collect_every && rand_next(&seed) % opt.collect_every == 0) {
+                free_data_set(do_wcollect(&fp), 1);
+            }
+            w->writes++;
+        }
+        w->bytes += de.len;
+    }
+
+    free(buf);
+    return NULL;
+}
+
+
+static void prefill(void) {
+    char *buf = (char *) calloc(1, opt.max_len);
+    unsigned long key;
+    for (key = 0; key < opt.keys; key++) {
+        struct fingerprint fp;
+        struct data_entry de;
+        key_place(key, &fp, &de.offset);
+        de.len = key_len(key);
+        de.data = buf;
+        do_rput(&fp, &de);
+    }
+    free(buf);
+}
+
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void print_latency(const char *name, const struct cinq_latency *lat) {
+    if (lat->count == 0) {
+        return;
+    }
+    printf("  %-9s %10lu ops  p50 %8lu ns  p99 %8lu ns  p999 %8lu ns  max %10lu ns\n",
+           name, lat->count, lat->p50, lat->p99, lat->p999, lat->max);
+}
+
+static size_t parse_bytes(const char *s) {
+    char *end;
+    size_t bytes = strtoul(s, &end, 0);
+    switch (*end) {
+    case 'g': case 'G': bytes <<= 10; // fall through
+    case 'm': case 'M': bytes <<= 10; // fall through
+    case 'k': case 'K': bytes <<= 10;
+    }
+    return bytes;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -t threads        worker threads (%d)\n"
+            "  -k keys           distinct extents (%lu)\n"
+            "  -b blocks         extents per file (%lu)\n"
+            "  -n ops            operations per thread (%lu)\n"
+            "  -d dist           zipf, uniform or seq (zipf)\n"
+            "  -z theta          Zipf skew (%.2f)\n"
+            "  -l min[:max]      extent length in bytes (%lu)\n"
+            "  -r ratio          fraction of reads (%.2f)\n"
+            "  -u ratio          fraction of the rest reading W-cache back (0)\n"
+            "  -c n              collect a file once per n writes, 0 never (%lu)\n"
+            "  -p                put every extent in R-cache before measuring\n"
+            "  -s ratio          fraction of reads from a sequential scan (0)\n"
+            "  -a width          TinyLFU admission with a sketch of width, 0 none (0)\n"
+            "  -e policy         eviction, lru or gdsf (lru)\n"
+            "  -m bytes          R-cache limit, with an optional k, m or g suffix (512m)\n"
+            "  -q n              estimate the miss ratio curve sampling 1 in n blocks (none)\n"
+            "  -w low:high       background reclaim between watermarks in percent (none)\n"
+            "  -W bytes          log-structured W-cache with segments of bytes (none)\n"
+            "  -f slots[:max]    thread-local copies of R-cache extents up to max bytes (none)\n"
+            "  -N bytes          a cache per NUMA node with an arena of bytes each, 0 none;\n"
+            "                    -a, -q and -w apply to each, statistics are per node\n",
+            prog, opt.threads, opt.keys, opt.blocks, opt.ops, opt.theta,
+            opt.min_len, opt.read_ratio, opt.collect_every);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    int c;
+    while ((c = getopt(argc, argv, "t:k:b:n:d:z:l:r:u:c:ps:a:e:w:m:q:W:N:f:h")) != -1) {
+        switch (c) {
+        case 't': opt.threads = atoi(optarg); break;
+        case 'k': opt.keys = strtoul(optarg, NULL, 0); break;
+        case 'b': opt.blocks = strtoul(optarg, NULL, 0); break;
+        case 'n': opt.ops = strtoul(optarg, NULL, 0); break;
+        case 'z': opt.theta = atof(optarg); break;
+        case 'r': opt.read_ratio = atof(optarg); break;
+        case 'u': opt.wread_ratio = atof(optarg); break;
+        case 'c': opt.collect_every = strtoul(optarg, NULL, 0); break;
+        case 'p': opt.prefill = 1; break;
+        case 's': opt.scan_ratio = atof(optarg); break;
+        case 'a': opt.tinylfu = strtoul(optarg, NULL, 0); break;
+        case 'e':
+            if (strcmp(optarg, "lru") == 0) {
+                opt.policy = CINQ_EVICT_LRU;
+            } else if (strcmp(optarg, "gdsf") == 0) {
+                opt.policy = CINQ_EVICT_GDSF;
+            } else {
+                usage(argv[0]);
+            }
+            break;
+        case 'd':
+            if (strcmp(optarg, "zipf") == 0) {
+                opt.dist = DIST_ZIPF;
+            } else if (strcmp(optarg, "uniform") == 0) {
+                opt.dist = DIST_UNIFORM;
+            } else if (strcmp(optarg, "seq") == 0) {
+                opt.dist = DIST_SEQ;
+            } else {
+                usage(argv[0]);
+            }
+            break;
+        case 'm': opt.limit = parse_bytes(optarg); break;
+        case 'W': opt.wlog = parse_bytes(optarg); break;
+        case 'N':
+            opt.numa = 1;
+            opt.numa_arena = parse_bytes(optarg);
+            break;
+        case 'q': opt.mrc = strtoul(optarg, NULL, 0); break;
+        case 'w': {
+            char *end;
+            opt.reclaim_low = strtoul(optarg, &end, 0);
+            if (*end != ':') {
+                usage(argv[0]);
+            }
+            opt.reclaim_high = strtoul(end + 1, NULL, 0);
+            break;
+        }
+        case 'f': {
+            char *end;
+            opt.l0_slots = strtoul(optarg, &end, 0);
+            if (*end == ':') {
+                opt.l0_max = parse_bytes(end + 1);
+            }
+            break;
+        }
+        case 'l': {
+            char *end;
+            opt.min_len = opt.max_len = strtoul(optarg, &end, 0);
+            if (*end == ':') {
+                opt.max_len = strtoul(end + 1, NULL, 0);
+            }
+            break;
+        }
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (opt.threads <= 0 || opt.keys == 0 || opt.blocks == 0 ||
+        opt.min_len == 0 || opt.max_len < opt.min_len) {
+        usage(argv[0]);
+    }
+    if (opt.l0_slots && opt.l0_max == 0) {
+        opt.l0_max = opt.max_len;
+    }
+    if (opt.dist == DIST_ZIPF) {
+        zipf_init(opt.keys, opt.theta);
+    }
+
+    rwcache_init();
+    rcache_set_policy(opt.policy);
+    if (opt.limit && rcache_set_limit(opt.limit) != 0) {
+        usage(argv[0]);
+    }
+    if (opt.tinylfu && rcache_tinylfu_enable(opt.tinylfu) != 0) {
+        fprintf(stderr, "cannot enable TinyLFU\n");
+        return 1;
+    }
+    if (opt.reclaim_high && rcache_reclaimer_start(opt.reclaim_low, opt.reclaim_high) != 0) {
+        fprintf(stderr, "cannot start the reclaimer\n");
+        return 1;
+    }
+    if (opt.mrc && rcache_mrc_enable(opt.mrc) != 0) {
+        fprintf(stderr, "cannot enable the miss ratio curve\n");
+        return 1;
+    }
+    if (opt.wlog && wcache_log_enable(opt.wlog) != 0) {
+        fprintf(stderr, "cannot enable the W-cache log\n");
+        return 1;
+    }
+    if (opt.l0_slots && rcache_l0_enable(opt.l0_slots, opt.l0_max) != 0) {
+        fprintf(stderr, "cannot enable thread-local copies\n");
+        return 1;
+    }
+    int i;
+    if (opt.numa) {
+        struct cinq_config cfg = { .limit = opt.limit, .policy = opt.policy };
+        numa = cinq_numa_create(&cfg, opt.numa_arena);
+        if (numa == NULL) {
+            fprintf(stderr, "cannot set up NUMA shards\n");
+            return 1;
+        }
+        for (i = 0; i < cinq_numa_shards(numa); i++) {
+            struct cinq_cache *c = cinq_numa_shard(numa, i);
+            if ((opt.tinylfu && cinq_rcache_tinylfu_enable(c, opt.tinylfu) != 0) ||
+                (opt.reclaim_high && cinq_rcache_reclaimer_start(c, opt.reclaim_low, opt.reclaim_high) != 0) ||
+                (opt.mrc && cinq_rcache_mrc_enable(c, opt.mrc) != 0) ||
+                (opt.wlog && cinq_wcache_log_enable(c, opt.wlog) != 0) ||
+                (opt.l0_slots && cinq_rcache_l0_enable(c, opt.l0_slots, opt.l0_max) != 0)) {
+                fprintf(stderr, "cannot set up shard %d\n", i);
+                return 1;
+            }
+        }
+    }
+    if (opt.prefill) {
+        prefill();
+    }
+    if (numa) {
+        cinq_numa_latency_enable(numa, 1);
+    } else {
+        cinq_latency_enable(1);
+    }
+
+    struct worker *workers = (struct worker *) calloc(opt.threads, sizeof(struct worker));
+    double start = now_sec();
+    for (i = 0; i < opt.threads; i++) {
+        workers[i].id = i;
+        pthread_create(&workers[i].tid, NULL, worker_run, &workers[i]);
+    }
+    unsigned long reads = 0, writes = 0, wreads = 0, bytes = 0, read_bytes = 0, hit_bytes = 0;
+    for (i = 0; i < opt.threads; i++) {
+        pthread_join(workers[i].tid, NULL);
+        reads += workers[i].reads;
+        writes += workers[i].writes;
+        wreads += workers[i].wreads;
+        bytes += workers[i].bytes;
+        read_bytes += workers[i].read_bytes;
+        hit_bytes += workers[i].hit_bytes;
+    }
+    double elapsed = now_sec() - start;
+
+    struct cinq_stats st;
+    cinq_cache_stats(&st);
+    if (numa) {
+        cinq_numa_latency(numa, st.latency);
+    }
+
+    printf("threads %d, keys %lu, dist %s, len %lu-%lu, reads %.0f%%\n",
+           opt.threads, opt.keys,
+           opt.dist == DIST_ZIPF ? "zipf" : opt.dist == DIST_SEQ ? "seq" : "uniform",
+           opt.min_len, opt.max_len, opt.read_ratio * 100);
+    printf("  %.0f ops/s, %.1f MB/s over %.2f s (%lu reads, %lu writes, %lu W-cache reads)\n",
+           (reads + writes + wreads) / elapsed, bytes / elapsed / (1024 * 1024), elapsed,
+           reads, writes, wreads);
+    if (numa) {
+        // the default cache saw nothing; report by node instead
+        for (i = 0; i < cinq_numa_shards(numa); i++) {
+            struct cinq_node_stats ns;
+            cinq_numa_node_stats(numa, i, &ns);
+            printf("  node %d: %lu gets, local hits %.2f%%, remote hits %.2f%%, partial %.2f%%, %.1f MB local, %.1f MB remote\n",
+                   ns.node, ns.rget,
+                   ns.rget ? 100.0 * ns.local_hits / ns.rget : 0.0,
+                   ns.rget ? 100.0 * ns.remote_hits / ns.rget : 0.0,
+                   ns.rget ? 100.0 * ns.partial / ns.rget : 0.0,
+                   ns.local_bytes / (1024.0 * 1024), ns.remote_bytes / (1024.0 * 1024));
+        }
+    } else {
+        printf("  hit rate %.2f%% (hits %lu, partial %lu, misses %lu), evictions %lu, rejected %lu\n",
+               st.rget ? 100.0 * st.rget_hits / st.rget : 0.0,
+               st.rget_hits, st.rget_partial, st.rget_misses, st.evictions, st.admit_rejects);
+        if (opt.l0_slots) {
+            printf("  %lu hits served from thread-local copies, %lu without the lock\n",
+                   st.rget_l0, st.rget_lockless);
+        }
+        if (opt.reclaim_high) {
+            printf("  reclaimed %lu in background, %lu direct\n", st.bg_reclaims, st.direct_reclaims);
+        }
+        if (opt.wlog) {
+            printf("  W-cache log of %lu segments, %lu compacted, %.1f MB moved\n",
+                   st.wlog_segments, st.wlog_compactions, st.wlog_moved_bytes / (1024.0 * 1024));
+        }
+    }
+    printf("  byte hit rate %.2f%% (%.1f of %.1f MB read)\n",
+           read_bytes ? 100.0 * hit_bytes / read_bytes : 0.0,
+           hit_bytes / (1024.0 * 1024), read_bytes / (1024.0 * 1024));
+    if (opt.mrc && !numa) {
+        printf("  predicted hit rate of %lu sampled blocks:", st.mrc_samples);
+        for (i = 0; i < CINQ_MRC_POINTS; i++) {
+            printf(" %luM %.1f%%", st.mrc_size[i] >> 20, st.mrc_hit_ppm[i] / 10000.0);
+        }
+        printf("\n");
+    }
+    print_latency("rget", &st.latency[CINQ_OP_RGET]);
+    print_latency("rput", &st.latency[CINQ_OP_RPUT]);
+    print_latency("wread", &st.latency[CINQ_OP_WREAD]);
+    print_latency("wwrite", &st.latency[CINQ_OP_WWRITE]);
+    print_latency("wcollect", &st.latency[CINQ_OP_WCOLLECT]);
+
+    free(workers);
+    if (numa) {
+        cinq_numa_destroy(numa);
+    }
+    rwcache_fini();
+    return 0;
+}
@@ -6,52 +6,107 @@
 #include <linux/spinlock.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
+#include <linux/sched.h>
+#include <linux/shrinker.h>
+#include <linux/rculist.h>
 
 // Either users or the internal should use the predefined malloc/free functions.
 #define ALLOC(nbytes)   ((nbytes) <= PAGE_SIZE ? kmalloc((nbytes), GFP_KERNEL) : vmalloc(nbytes))
 #define FREE(ptr, size)       ((size) <= PAGE_SIZE ? kfree(ptr) : vfree(ptr))
+// for structs with cache line aligned members; these are over a page and
+// come page aligned from vmalloc
+#define ALLOC_LINE(nbytes)  ALLOC(nbytes)
 
 
 typedef spinlock_t lock_t;
 
-#define LOCK_INIT   SPIN_LOCK_UNLOCKED
+#define lock_init(m)    spin_lock_init(&(m))
+#define lock_fini(m)
 #define lock(m)     spin_lock(&(m))
+#define trylock(m)  spin_trylock(&(m))
 #define unlock(m)   spin_unlock(&(m))
 
+// lets others run between batches done under a lock
+#define relax()     cond_resched()
+
 #else // userspace
 
-#ifdef __APPLE__
-#include <stdlib.h>
-#else
+#include <stdlib.h> // for posix_memalign
+#ifndef __APPLE__
 #include <malloc.h>
 #endif // __APPLE__
 
 #include <pthread.h>
+#include <sched.h>
 #include <string.h> // for memcpy
+#include <limits.h>
 #include "rbtree.h"
 
 
 #define ALLOC(nbytes)   malloc(nbytes)
 #define FREE(ptr, size)       free(ptr)
 
+// for structs with cache line aligned members, which malloc does not honor
+static inline void *alloc_line(size_t nbytes) {
+    void *p;
+    return posix_memalign(&p, 64, nbytes) == 0 ? p : NULL;
+}
+#define ALLOC_LINE(nbytes)  alloc_line(nbytes)
+
 
 typedef pthread_mutex_t lock_t;
 
-#define LOCK_INIT   PTHRED_MUTEX_INIT
+#define lock_init(m)    pthread_mutex_init(&(m), NULL)
+#define lock_fini(m)    pthread_mutex_destroy(&(m))
 #define lock(m)     pthread_mutex_lock(&(m))
+#define trylock(m)  (pthread_mutex_trylock(&(m)) == 0)
 #define unlock(m)   pthread_mutex_unlock(&(m))
 
+#define relax()     sched_yield()
+
 #endif // __KERNEL__
 
 #include "trace.h"
+#include "l2cache.h"
+#include "arena.h"
+#include "stats.h"
+#include "epoch.h"
+#include "hist.h"
+#include "record.h"
+#include "tenant.h"
+#include "sketch.h"
+#include "mrc.h"
+#include "wlog.h"
+#include "l0.h"
 
 
 struct hash_entry {
     struct fingerprint fpnt;
     struct list_head entry;
     struct rb_root root;
+    int doomed; // detached by rcache_invalidate_file(), nodes freed lazily
+    struct mynode *finger; // R-cache node last served or inserted, or NULL
+    int refs; // handles pinning the entry
+    struct cinq_snapshot *frozen; // W-cache: the snapshot not yet released
+    unsigned int seq; // R-cache: odd while the tree or its data change
+    unsigned int gen; // R-cache: bumped by puts and invalidations
+};
+
+// dirty extents of a file frozen by wcache_snapshot(); nothing changes the
+// tree until wcache_snapshot_release()
+struct cinq_snapshot {
+    struct cinq_cache *cache;
+    struct hash_entry *he;
+    struct rb_root root;
 };
 
+// an open file, pinning its entries in both caches
+struct cinq_handle {
+    struct cinq_cache *cache;
+    struct fingerprint fpnt;
+    struct hash_entry *rentry; // guarded by rcache_lock
+    struct hash_entry *wentry; // guarded by wcache_lock
+};
 
 
 
@@ -62,39 +117,299 @@ struct mynode {
     offset_t len;
     struct rb_node node;
     struct hash_entry* h_entry;
-    struct list_head lru_entry; // used by LRU on R-cache
+    struct list_head lru_entry; // used by LRU on R-cache, and by the log
+                                // segment of the data on W-cache
+    unsigned int hits; // times read from R-cache
+    struct tenant *tenant; // charged for the node on R-cache
+    struct list_head tenant_lru; // used by LRU of the tenant
+    struct rb_node prio_node; // used by GDSF on R-cache
+    unsigned long prio;
+    struct wlog_seg *seg; // W-cache: the log segment of data, or NULL
+    int unlinked; // R-cache: out of the tree, freed once no reader sees it
 };
 
+// R-cache hits served without rcache_lock, waiting to be applied to LRU
+#define ACCESS_BUF_LEN  32
+
+struct access_buf {
+    int busy; // being appended to or drained
+    unsigned int n;
+    struct {
+        struct mynode *node;
+        int first; // the first node of a get, counted for its tenant
+    } ent[ACCESS_BUF_LEN];
+} __attribute__((aligned(64)));
+
+// keys of gets sampled for the miss ratio curve, waiting to be fed to it
+#define MRC_BUF_LEN     32
 
-// number of hash slots
+struct mrc_buf {
+    int busy; // being appended to or drained
+    unsigned int n;
+    unsigned long key[MRC_BUF_LEN];
+} __attribute__((aligned(64)));
+
+
+// number of hash slots by default
 #define N_SLOT 1024
 
 
 // input: fingerprint, return: the slot possibly containing the hash entry
-#define fp_slot(fpnt)     (*((unsigned int *)(fpnt).value) % N_SLOT)
+#define fp_slot(c, fpnt)  (*((unsigned int *)(fpnt).value) % (c)->n_slot)
+
+
+#define RCACHE_DEFAULT_LIMIT    (1024L * 1024 * 512) // 512M cache
+
+// max bytes evicted per hold of rcache_lock when shrinking on request
+#define SHRINK_STEP     (4L * 1024 * 1024)
+
+// max doomed nodes freed per rcache_put()
+#define REAP_BATCH  64
+
+// block size of miss ratio curve keys
+#define MRC_BLOCK_SHIFT     12
+
+// keys tracked by the estimator at most
+#define MRC_MAX_KEYS        16384
+
+// max extents the reclaimer evicts per hold of rcache_lock
+#define RECLAIM_BATCH   32
+
+// W-cache log segments with less live data are compacted
+#define WLOG_COMPACT_PCT    50
+
+
+// An R-cache and a W-cache with their own limit, locks and statistics.
+//
+// rcache_lock guards rcache, rcache_doomed, lru_list, prio_tree,
+// rcache_size, rcache_meta, rcache_limit, limit_target, tenants and the
+// reclaimer watermarks; wcache_lock guards wcache, wcache_size and wlog.
+// admission and mrc are swapped under rcache_lock and used by gets in an
+// epoch without it; mrc_lock guards what mrc counts. Data returned by
+// wcache_read() are not guarded.
+struct cinq_cache {
+    unsigned int n_slot;
+
+    // write cache, using a linked hash
+    struct list_head *wcache;
+
+    // read cache, using a linked hash
+    struct list_head *rcache;
+
+    ssize_t rcache_size;
+
+    // bytes of R-cache nodes and hash entries
+    ssize_t rcache_meta;
+
+    ssize_t rcache_limit;
+
+    // the limit last asked of rcache_set_limit(), which rcache_limit is
+    // stepping down to
+    ssize_t limit_target;
+
+    // bytes written to W-cache and not yet collected
+    ssize_t wcache_size;
+
+    struct stat_counters counters;
 
+#ifndef CINQ_NO_LATENCY
+    int latency_on;
+    // allocated when first enabled
+    struct hist (*latency)[CINQ_N_OP];
+#endif // CINQ_NO_LATENCY
 
-// write cache, using a linked hash
-static struct list_head wcache[N_SLOT];
+    // newly accessed element at head, old element at tail
+    struct list_head lru_list;
 
-// read cache, using a linked hash
-static struct list_head rcache[N_SLOT];
+    // hash entries detached by rcache_invalidate_file(), still holding nodes
+    struct list_head rcache_doomed;
 
-static ssize_t rcache_size = 0;
+    // per-uid partitions of R-cache
+    struct tenant_table tenants;
 
-static ssize_t rcache_limit = 1024 * 1024 * 512; // 512M cache
+    // enum cinq_evict_policy of R-cache
+    int evict_policy;
 
-// newly accessed element at head, old element at tail
-LIST_HEAD(lru_list);
+    // GDSF: R-cache nodes by priority, lowest first, and the priority of
+    // the last node evicted, which all new priorities build on
+    struct rb_root prio_tree;
+    unsigned long gdsf_clock;
+
+    // access frequencies for TinyLFU admission, NULL if admitting all
+    struct sketch *admission;
+
+    // miss ratio curve of R-cache gets, NULL if not estimated
+    struct mrc *mrc;
+
+    // keys sampled by gets, one buffer per stat shard, fed to mrc in
+    // batches
+    struct mrc_buf mrc_buf[STAT_N_SHARD];
+
+    // watermarks of the background reclaimer in percent of rcache_limit,
+    // 0 if it is not running
+    int reclaim_low;
+    int reclaim_high;
+
+    lock_t rcache_lock;
+    lock_t wcache_lock;
+    lock_t mrc_lock;
+
+#ifndef __KERNEL__
+    pthread_t reclaimer;
+    pthread_cond_t reclaim_cond;
+    int reclaim_stop;
+    pthread_t compactor;
+    pthread_cond_t compact_cond;
+    int compact_stop;
+#else
+    struct shrinker shrinker;
+#endif // __KERNEL__
+
+    // second-tier cache for evicted R-cache data, NULL if not enabled
+    struct l2cache *l2;
+
+    // where R-cache data are carved from, NULL if not enabled
+    struct arena *data_arena;
+
+    // log segments W-cache data are appended to, NULL if written in place
+    struct wlog *wlog;
+
+    // W-cache data and segments dropped while readers may still see them,
+    // guarded by wcache_lock
+    struct epoch_limbo wlimbo;
+
+    // R-cache nodes and entries unlinked while gets without rcache_lock
+    // may still see them, guarded by rcache_lock
+    struct epoch_limbo rlimbo;
+
+    // generations of thread-local copies of R-cache extents, NULL until
+    // first enabled
+    struct l0 *l0;
+
+#ifndef __KERNEL__
+    // hits of gets without rcache_lock, one buffer per stat shard;
+    // access_dirty is set when a buffer gets its first
+    struct access_buf access[STAT_N_SHARD];
+    int access_dirty;
+#endif // __KERNEL__
+};
+
+#define reclaim_mark(c, pct)    ((c)->rcache_limit / 100 * (pct))
+
+#ifndef __KERNEL__
+#define reclaim_wake(c)     pthread_cond_signal(&(c)->reclaim_cond)
+#else
+#define reclaim_wake(c)
+#endif // __KERNEL__
+
+#ifndef CINQ_NO_LATENCY
+
+#define LAT_BEGIN(c, t)     unsigned long t = (c)->latency_on ? hist_now() : 0
+#define LAT_END(c, t, op)   do { \
+        if (t) { \
+            hist_record(&(c)->latency[stat_shard_id()][op], hist_now() - t); \
+        } \
+    } while (0)
+
+#else
+
+#define LAT_BEGIN(c, t)
+#define LAT_END(c, t, op)
+
+#endif // CINQ_NO_LATENCY
+
+// behind the functions without an instance argument
+static struct cinq_cache default_cache;
+static struct list_head default_wcache[N_SLOT];
+static struct list_head default_rcache[N_SLOT];
+
+
+// called with rcache_lock held
+static void __rcache_put(struct cinq_cache *c, struct fingerprint *fpnt, struct hash_entry *he, struct data_entry *de);
+static struct hash_entry *rcache_handle_entry(struct cinq_cache *c, struct cinq_handle *h);
+static struct hash_entry *rcache_pin(struct cinq_cache *c, struct fingerprint *fp);
+static void rcache_unpin(struct cinq_cache *c, struct hash_entry *he);
+static void rcache_fill(struct cinq_cache *c, struct fingerprint *fpnt, struct hash_entry *he, struct data_entry *de);
+static void release_data(void *arg, char *data, offset_t len);
+static void cache_fini(struct cinq_cache *c);
+
+#ifdef __KERNEL__
+static unsigned long rcache_shrink_count(struct shrinker *s, struct shrink_control *sc);
+static unsigned long rcache_shrink_scan(struct shrinker *s, struct shrink_control *sc);
+#endif
+
+
+// Sets up c on the given wcache and rcache slots, cfg->slots of each.
+static void cache_init(struct cinq_cache *c, const struct cinq_config *cfg,
+                       struct list_head *wcache, struct list_head *rcache) {
+    unsigned int i;
+    memset(c, 0, sizeof(struct cinq_cache));
+    c->n_slot = cfg && cfg->slots ? cfg->slots : N_SLOT;
+    c->wcache = wcache;
+    c->rcache = rcache;
+    for (i = 0; i < c->n_slot; i++) {
+        INIT_LIST_HEAD(&(c->wcache[i]));
+        INIT_LIST_HEAD(&(c->rcache[i]));
+    }
+    c->rcache_limit = c->limit_target = cfg && cfg->limit ? cfg->limit : RCACHE_DEFAULT_LIMIT;
+    c->evict_policy = cfg ? cfg->policy : CINQ_EVICT_LRU;
+    c->prio_tree = RB_ROOT;
+    INIT_LIST_HEAD(&(c->lru_list));
+    INIT_LIST_HEAD(&(c->rcache_doomed));
+    epoch_limbo_init(&(c->wlimbo), 0);
+    epoch_limbo_init(&(c->rlimbo), 1);
+    tenant_table_init(&(c->tenants));
+    lock_init(c->rcache_lock);
+    lock_init(c->wcache_lock);
+    lock_init(c->mrc_lock);
+#ifndef __KERNEL__
+    pthread_cond_init(&(c->reclaim_cond), NULL);
+    pthread_cond_init(&(c->compact_cond), NULL);
+#else
+    c->shrinker.count_objects = rcache_shrink_count;
+    c->shrinker.scan_objects = rcache_shrink_scan;
+    c->shrinker.seeks = DEFAULT_SEEKS;
+    register_shrinker(&(c->shrinker), "cinq-rcache");
+#endif // __KERNEL__
+}
 
 
 // init cache system
 void rwcache_init() {
-    int i;
-    for (i = 0; i < N_SLOT; i++) {
-        INIT_LIST_HEAD(&wcache[i]);
-        INIT_LIST_HEAD(&rcache[i]);
+    cache_init(&default_cache, NULL, default_wcache, default_rcache);
+}
+
+
+struct cinq_cache *cinq_cache_create(const struct cinq_config *cfg) {
+    unsigned int n_slot = cfg && cfg->slots ? cfg->slots : N_SLOT;
+    if (cfg && cfg->policy != CINQ_EVICT_LRU && cfg->policy != CINQ_EVICT_GDSF) {
+        return NULL;
+    }
+    struct cinq_cache *c = (struct cinq_cache *) ALLOC_LINE(sizeof(struct cinq_cache));
+    struct list_head *wcache = (struct list_head *) ALLOC(n_slot * sizeof(struct list_head));
+    struct list_head *rcache = (struct list_head *) ALLOC(n_slot * sizeof(struct list_head));
+    if (c == NULL || wcache == NULL || rcache == NULL) {
+        if (c) {
+            FREE(c, sizeof(struct cinq_cache));
+        }
+        if (wcache) {
+            FREE(wcache, n_slot * sizeof(struct list_head));
+        }
+        if (rcache) {
+            FREE(rcache, n_slot * sizeof(struct list_head));
+        }
+        return NULL;
     }
+    cache_init(c, cfg, wcache, rcache);
+    return c;
+}
+
+
+void cinq_cache_destroy(struct cinq_cache *c) {
+    cache_fini(c);
+    FREE(c->wcache, c->n_slot * sizeof(struct list_head));
+    FREE(c->rcache, c->n_slot * sizeof(struct list_head));
+    FREE(c, sizeof(struct cinq_cache));
 }
 
 
@@ -110,8 +425,8 @@ static int fpnt_eql(struct fingerprint* fpnt1, struct fingerprint* fpnt2) {
 }
 
 
-static struct hash_entry* hash_find(struct list_head* htab, struct fingerprint *fpnt) {
-    struct list_head* slot_list = &htab[fp_slot(*fpnt)];
+static struct hash_entry* hash_find(struct cinq_cache *c, struct list_head* htab, struct fingerprint *fpnt) {
+    struct list_head* slot_list = &htab[fp_slot(c, *fpnt)];
     struct list_head *cur, *tmp;
     list_for_each_safe(cur, tmp, slot_list) {
         struct hash_entry* he = list_entry(cur, struct hash_entry, entry);
@@ -123,6 +438,38 @@ static struct hash_entry* hash_find(struct list_head* htab, struct fingerprint *
 }
 
 
+// adds an empty entry for fpnt
+static struct hash_entry *hash_add(struct cinq_cache *c, struct list_head *htab, struct fingerprint *fpnt) {
+    struct hash_entry *he = (struct hash_entry *) ALLOC(sizeof(struct hash_entry));
+    he->fpnt = *fpnt;
+    he->root = RB_ROOT;
+    he->doomed = 0;
+    he->finger = NULL;
+    he->refs = 0;
+    he->frozen = NULL;
+    he->seq = 0;
+    he->gen = 0;
+    list_add_rcu(&(he->entry), &htab[fp_slot(c, *fpnt)]);
+    return he;
+}
+
+
+// Changes to an R-cache tree or to the data in it go between these, so
+// that gets without rcache_lock can tell they raced with one. The end
+// also outdates thread-local copies of the file.
+static inline void seq_begin(struct hash_entry *he) {
+    __atomic_store_n(&(he->seq), he->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void seq_end(struct cinq_cache *c, struct hash_entry *he) {
+    __atomic_store_n(&(he->seq), he->seq + 1, __ATOMIC_RELEASE);
+    if (c->l0) {
+        l0_bump(c->l0, &(he->fpnt));
+    }
+}
+
+
 void free_data_set(struct data_set* ds, int free_data) {
     if (ds == NULL) {
         return;
@@ -142,14 +489,54 @@ void free_data_set(struct data_set* ds, int free_data) {
     FREE(ds, sizeof(struct data_set));
 }
 
-// Returns data set sorted by offsets of its entries without overlaps.
-// Users take charge of deallocation of returned data.
-struct data_set *wcache_collect(struct fingerprint *fp) {
+static void free_retired(void *arg, void *p, size_t len) {
+    FREE(p, len);
+}
+
+static void recycle_seg(void *arg, void *p, size_t len) {
+    wlog_recycle((struct wlog *) arg, (struct wlog_seg *) p);
+}
+
+// frees W-cache memory once no reader in an epoch can see it
+static void wcache_retire(struct cinq_cache *c, void *p, size_t len, epoch_free_f fn, void *arg) {
+    if (epoch_retire(&(c->wlimbo), p, len, fn, arg)) {
+        stat_inc(&c->counters, STAT_WDEFERRED);
+    }
+}
+
+// marks len bytes of seg dead; an emptied segment is recycled when unseen
+static void wlog_dead(struct cinq_cache *c, struct wlog_seg *seg, offset_t len) {
+    if (wlog_kill(c->wlog, seg, len)) {
+        wcache_retire(c, seg, 0, recycle_seg, c->wlog);
+    }
+}
+
+// appends to the log; a head sealed empty is recycled when unseen
+static char *wlog_add(struct cinq_cache *c, const char *data, size_t len, struct wlog_seg **seg) {
+    struct wlog_seg *emptied;
+    char *p = wlog_append(c->wlog, data, len, seg, &emptied);
+    if (emptied) {
+        wcache_retire(c, emptied, 0, recycle_seg, c->wlog);
+    }
+    return p;
+}
+
+// frees the data of a W-cache node, in place or in the log
+static void wcache_drop_data(struct cinq_cache *c, struct mynode *node) {
+    if (node->seg) {
+        list_del(&(node->lru_entry));
+        wlog_dead(c, node->seg, node->len);
+    } else {
+        wcache_retire(c, node->data, node->len, free_retired, NULL);
+    }
+}
+
+static struct data_set *__wcache_collect(struct cinq_cache *c, struct hash_entry *he) {
     struct data_set* dset = NULL;
-    struct hash_entry* he = hash_find(wcache, fp);
+    offset_t n = 0, bytes = 0;
 
-    if (he == NULL) {
-        // nothing found, return NULL
+    if (he == NULL || RB_EMPTY_ROOT(&(he->root))) {
+        // nothing found, return NULL; entries pinned by handles may be empty
         return NULL;
     }
     
@@ -174,10 +561,57 @@ struct data_set *wcache_collect(struct fingerprint *fp) {
         de->offset = node->offset;
         de->len = node->len;
         list_add(&(de->entry), &(dset->entries));
+        if (node->seg || epoch_readers()) {
+            // the log keeps its segments, and readers may see the data;
+            // hand over a copy
+            de->data = (char *) ALLOC(node->len);
+            memcpy(de->data, node->data, node->len);
+            wcache_drop_data(c, node);
+        }
         
+        c->wcache_size -= node->len;
+        stat_add(&c->counters, STAT_WCOLLECT_BYTES, node->len);
+        n++;
+        bytes += node->len;
         FREE(node, sizeof(struct mynode));
     }
+    if (he->refs == 0) {
+        list_del(&(he->entry));
+        FREE(he, sizeof(struct hash_entry));
+    }
+    if (c->wlimbo.pending) {
+        epoch_reap(&(c->wlimbo), 0);
+    }
     
+    stat_inc(&c->counters, STAT_WCOLLECT);
+    trace_event(TRACE_INFO, EV_WCOLLECT, n, bytes, c->wcache_size);
+    return dset;
+}
+
+// Returns data set sorted by offsets of its entries without overlaps.
+// Users take charge of deallocation of returned data.
+struct data_set *cinq_wcache_collect(struct cinq_cache *c, struct fingerprint *fp) {
+    LAT_BEGIN(c, t);
+    RECORD(CINQ_OP_WCOLLECT, fp, 0, 0);
+    lock(c->wcache_lock);
+    struct data_set *dset = __wcache_collect(c, hash_find(c, c->wcache, fp));
+    unlock(c->wcache_lock);
+    LAT_END(c, t, CINQ_OP_WCOLLECT);
+    return dset;
+}
+
+struct data_set *wcache_collect(struct fingerprint *fp) {
+    return cinq_wcache_collect(&default_cache, fp);
+}
+
+struct data_set *wcache_collect_h(struct cinq_handle *h) {
+    struct cinq_cache *c = h->cache;
+    LAT_BEGIN(c, t);
+    RECORD(CINQ_OP_WCOLLECT, &(h->fpnt), 0, 0);
+    lock(c->wcache_lock);
+    struct data_set *dset = __wcache_collect(c, h->wentry);
+    unlock(c->wcache_lock);
+    LAT_END(c, t, CINQ_OP_WCOLLECT);
     return dset;
 }
 
@@ -208,28 +642,110 @@ static struct mynode* first_overlap(struct rb_root* root, offset_t offset, offse
 
 
 
-struct data_set *rcache_get(struct fingerprint *fp, offset_t offset, offset_t len) {
+// nodes walked from a finger before giving up for a descent from the root
+#define FINGER_STEPS    4
+
+// Like first_overlap(), but starts from the finger of he. Sequential
+// access finds the next extent a step or two away from the last one.
+static struct mynode *finger_overlap(struct hash_entry *he, offset_t offset, offset_t len) {
+    struct mynode *my = he->finger;
+    int steps = FINGER_STEPS;
+    
+    if (my == NULL) {
+        return first_overlap(&(he->root), offset, len);
+    }
+    if (my->offset + my->len <= offset) {
+        // ends are sorted as extents do not overlap: seek the first one
+        // ending after offset
+        while (my->offset + my->len <= offset) {
+            struct rb_node *next = rb_next(&(my->node));
+            if (next == NULL) {
+                return NULL;
+            }
+            if (steps-- == 0) {
+                return first_overlap(&(he->root), offset, len);
+            }
+            my = container_of(next, struct mynode, node);
+        }
+    } else {
+        for (;;) {
+            struct rb_node *prev = rb_prev(&(my->node));
+            if (prev == NULL) {
+                break;
+            }
+            struct mynode *p = container_of(prev, struct mynode, node);
+            if (p->offset + p->len <= offset) {
+                break;
+            }
+            if (steps-- == 0) {
+                return first_overlap(&(he->root), offset, len);
+            }
+            my = p;
+        }
+    }
+    return my->offset < offset + len ? my : NULL;
+}
+
+
+// GDSF priority: the clock plus frequency over size, in 1/2^32 units,
+// so small hot extents outlive big cold ones
+static void prio_insert(struct cinq_cache *c, struct mynode *my) {
+    struct rb_node **new = &(c->prio_tree.rb_node), *parent = NULL;
+    my->prio = c->gdsf_clock + ((unsigned long) (my->hits + 1) << 32) / (my->len ? my->len : 1);
+    while (*new) {
+        parent = *new;
+        if (my->prio < container_of(*new, struct mynode, prio_node)->prio) {
+            new = &((*new)->rb_left);
+        } else {
+            new = &((*new)->rb_right);
+        }
+    }
+    rb_link_node(&(my->prio_node), parent, new);
+    rb_insert_color(&(my->prio_node), &c->prio_tree);
+}
+
+
+// moves a node just read to the head of LRU
+static void touch_node(struct cinq_cache *c, struct mynode *my) {
+    list_move(&(my->lru_entry), &c->lru_list);
+    list_move(&(my->tenant_lru), &(my->tenant->lru));
+    my->hits++;
+    if (c->evict_policy == CINQ_EVICT_GDSF) {
+        rb_erase(&(my->prio_node), &c->prio_tree);
+        prio_insert(c, my);
+    }
+}
+
+
+// Looks up R-cache only. Sets *covered if [offset, offset + len) is
+// fully served by the returned data set, and *served to the bytes returned.
+static struct data_set *rcache_lookup(struct cinq_cache *c, struct hash_entry *he, offset_t offset, offset_t len, int *covered, offset_t *served) {
     struct data_set* dset = NULL;
-    struct hash_entry *he = hash_find(rcache, fp);
+    offset_t next_ofst = offset; // first byte not yet covered
     
+    *covered = 0;
+    *served = 0;
     if (he == NULL) {
         // nothing found, return NULL
         return NULL;
     }
-    struct rb_root* rbroot = &(he->root);
     
     dset = (struct data_set *) ALLOC(sizeof(struct data_set));
     INIT_LIST_HEAD(&(dset->entries));
     
-    struct mynode* my = first_overlap(rbroot, offset, len);
+    struct mynode* my = finger_overlap(he, offset, len);
     while (my) {
         
         if (offset + len <= my->offset) {
             break;
         }
+        he->finger = my;
+        
+        if (my->offset <= next_ofst) {
+            next_ofst = my->offset + my->len;
+        }
         
-        // move newly accessed element to head
-        list_move(&(my->lru_entry), &lru_list);
+        touch_node(c, my);
         
         struct data_entry *de = (struct data_entry *) ALLOC(sizeof(struct data_entry));
         de->data = (char *) ALLOC(my->len);
@@ -238,6 +754,7 @@ struct data_set *rcache_get(struct fingerprint *fp, offset_t offset, offset_t le
         de->offset = my->offset;
         de->len = my->len;
         list_add(&(de->entry), &(dset->entries));
+        *served += my->len;
         
         struct rb_node* next = rb_next(&(my->node));
         if (next == NULL) {
@@ -246,168 +763,465 @@ struct data_set *rcache_get(struct fingerprint *fp, offset_t offset, offset_t le
         my = container_of(next, struct mynode, node);
     }
     
+    *covered = (next_ofst >= offset + len);
     return dset;
 }
 
 
-static int rcache_insert_data(struct rb_root *root, offset_t offset, offset_t len, char* data, struct hash_entry* h_entry) {
-    struct rb_node **new = &(root->rb_node), *parent = NULL;
+static void count_rget(struct cinq_cache *c, offset_t offset, offset_t len, int covered, offset_t served) {
+    trace_event(TRACE_DEBUG, EV_RGET, offset, len, served);
+    stat_inc(&c->counters, STAT_RGET);
+    stat_add(&c->counters, STAT_RGET_BYTES, served);
+    if (covered) {
+        stat_inc(&c->counters, STAT_RGET_HIT);
+    } else if (served) {
+        stat_inc(&c->counters, STAT_RGET_PARTIAL);
+    } else {
+        stat_inc(&c->counters, STAT_RGET_MISS);
+    }
+}
 
-	/* Figure out where to put new node */
-	while (*new) {
-		struct mynode *this = container_of(*new, struct mynode, node);
 
-		parent = *new;
-		if (offset + len <= this->offset)
-			new = &((*new)->rb_left);
-		else if (this->offset + this->len <= offset)
-			new = &((*new)->rb_right);
-		else
-			return -1;
-	}
-	
-    struct mynode* my_new = (struct mynode *) ALLOC(sizeof(struct mynode));
-    my_new->offset = offset;
-    my_new->len = len;
-    my_new->data = (char *) ALLOC(len);
-    my_new->h_entry = h_entry;
-    memcpy(my_new->data, data, len);
-    // add LRU entry to head of list
-    list_add(&(my_new->lru_entry), &lru_list);
+// uids that hold no data and have no settings are not counted
+// called with rcache_lock held
+static void count_tenant_get(struct cinq_cache *c, struct fingerprint *fp, int covered, offset_t served) {
+    struct tenant *t = tenant_find(&c->tenants, fp->uid);
+    if (t == NULL) {
+        return;
+    }
+    t->gets++;
+    if (covered) {
+        t->hits++;
+    } else if (served) {
+        t->partial++;
+    } else {
+        t->misses++;
+    }
+}
 
-	/* Add new node and rebalance tree. */
-	rb_link_node(&my_new->node, parent, new);
-	rb_insert_color(&my_new->node, root);
-	
-    return 0;
+
+// hash of a file, which keys of its extents and blocks build on
+static unsigned long fp_key(struct fingerprint *fp) {
+    unsigned long h = 14695981039346656037UL;
+    int i;
+    for (i = 0; i < FINGERPRINT_BYTES; i++) {
+        h = (h ^ (unsigned char) fp->value[i]) * 1099511628211UL;
+    }
+    return h;
 }
 
-static void limit_rcache_size() {
-    if (rcache_size < rcache_limit) {
-        return;
+#define offset_key(fkey, offset)    (((fkey) ^ (offset)) * 0x9e3779b97f4a7c15UL)
+
+// key of an extent in the admission sketch
+static unsigned long extent_key(struct fingerprint *fp, offset_t offset) {
+    return offset_key(fp_key(fp), offset);
+}
+
+
+// Feeds the keys queued in b to the miss ratio curve.
+// called with mrc_lock held
+static void mrc_feed(struct cinq_cache *c, struct mrc_buf *b) {
+    unsigned long key[MRC_BUF_LEN];
+    unsigned int i, n;
+    // copied out, so that gets appending to b need not wait for the curve
+    while (__atomic_exchange_n(&b->busy, 1, __ATOMIC_ACQUIRE)) {
+        relax();
     }
-    
-    struct mynode *cur, *tmp;
-    list_for_each_entry_safe_reverse(cur, tmp, &lru_list, lru_entry) {
-        if (rcache_size < rcache_limit) {
-            return;
+    n = b->n;
+    memcpy(key, b->key, n * sizeof(unsigned long));
+    b->n = 0;
+    __atomic_store_n(&b->busy, 0, __ATOMIC_RELEASE);
+    for (i = 0; c->mrc && i < n; i++) {
+        mrc_access(c->mrc, key[i]);
+    }
+}
+
+// Feeds every queued key to the miss ratio curve.
+// called with mrc_lock held
+static void mrc_feed_all(struct cinq_cache *c) {
+    int i;
+    for (i = 0; i < STAT_N_SHARD; i++) {
+        if (__atomic_load_n(&c->mrc_buf[i].n, __ATOMIC_RELAXED)) {
+            mrc_feed(c, &c->mrc_buf[i]);
         }
-        
-        rcache_size -= cur->len;
-        // remove from lru_list
-        list_del(&(cur->lru_entry));
-        // remove from rbtree
-        rb_erase(&(cur->node), &(cur->h_entry->root));
+    }
+}
 
-        FREE(cur->data, cur->len);
-        FREE(cur, sizeof(struct mynode));
+// Queues a sampled key. Returns non-zero if the buffer is full. A key
+// finding the buffer busy or full is dropped.
+static int mrc_queue(struct cinq_cache *c, struct mrc_buf *b, unsigned long key) {
+    int full;
+    if (__atomic_exchange_n(&b->busy, 1, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    if (b->n < MRC_BUF_LEN) {
+        b->key[b->n++] = key;
     }
+    full = (b->n == MRC_BUF_LEN);
+    __atomic_store_n(&b->busy, 0, __ATOMIC_RELEASE);
+    return full;
 }
 
-void rcache_put(struct fingerprint *fpnt, struct data_entry *de) {
-    struct hash_entry* he = hash_find(rcache, fpnt);
-    
+// Counts a get in the admission sketch and, for blocks sampled, in the
+// miss ratio curve, before any tier serves it. Neither takes rcache_lock:
+// the sketch counts atomically, and sampled keys are queued per thread
+// and fed to the curve in batches under mrc_lock.
+static void rcache_note_get(struct cinq_cache *c, struct fingerprint *fp, offset_t offset, offset_t len) {
+    struct sketch *sk;
+    struct mrc *m;
+    int full = 0;
     
-    if (he == NULL) {
-        // new element in hash
-        struct list_head* slot_list = &rcache[fp_slot(*fpnt)];
-        he = (struct hash_entry *) ALLOC(sizeof(struct hash_entry));
-        he->fpnt = *fpnt;
-        he->root = RB_ROOT;
-        list_add(&(he->entry), slot_list);
+    if (__atomic_load_n(&(c->admission), __ATOMIC_RELAXED) == NULL &&
+        __atomic_load_n(&(c->mrc), __ATOMIC_RELAXED) == NULL) {
+        return;
     }
-    struct rb_root* rbroot = &(he->root);
-    
-    // find first overlap
-    struct mynode* my = first_overlap(rbroot, de->offset, de->len);
-    if (my == NULL) {
-        // no overlap, just insert and quit
-        rcache_insert_data(rbroot, de->offset, de->len, de->data, he);
-        limit_rcache_size();
+#ifdef __KERNEL__
+    lock(c->rcache_lock);
+#else
+    // keeps them from being freed by a switch meanwhile
+    if (epoch_pin() != 0) {
         return;
     }
-    
-    // split and insert
-    offset_t offset = de->offset, len = de->len;
-    while (len > 0) {
-        
-        my = first_overlap(rbroot, offset, len);
-        if (my == NULL) {
-            rcache_insert_data(rbroot, offset, len, de->data + (offset - de->offset), he);
-            break;
-        } else if (my->offset <= offset) {
-            // case 1
-            offset_t write_len = len; // the length of data written to overlapped segment
-            if (offset + write_len > my->offset + my->len) {
-                write_len = my->offset + my->len - offset;
+#endif // __KERNEL__
+    unsigned long fkey = fp_key(fp);
+    sk = __atomic_load_n(&(c->admission), __ATOMIC_ACQUIRE);
+    if (sk) {
+        sketch_add(sk, offset_key(fkey, offset));
+    }
+    m = __atomic_load_n(&(c->mrc), __ATOMIC_ACQUIRE);
+    if (m && len) {
+        struct mrc_buf *b = &c->mrc_buf[stat_shard_id()];
+        offset_t blk;
+        for (blk = offset >> MRC_BLOCK_SHIFT; blk <= (offset + len - 1) >> MRC_BLOCK_SHIFT; blk++) {
+            unsigned long key = offset_key(fkey, blk);
+            if (mrc_sampled(m, key)) {
+                full |= mrc_queue(c, b, key);
             }
-            
-            // write to overlapped segment
-            memcpy(my->data + (offset - my->offset), de->data + (offset - de->offset), write_len);
-            
-            // move newly accessed element to head
-            list_move(&(my->lru_entry), &lru_list);
-            
-            offset += write_len;
-            len -= write_len;
-            rcache_size += write_len;
-            // go on to next round
-        } else {
-            // offst < my->offset
-            // case 2
-            // insert non-overlapping part
-            offset_t seg_len = my->offset - offset;
-            rcache_insert_data(rbroot, offset, seg_len, de->data + (offset - de->offset), he);
-            offset += seg_len;
-            len -= seg_len;
-            rcache_size += seg_len;
-            // go on to next round, will be handled immediately by case 1
         }
     }
-    
-    limit_rcache_size();
+#ifdef __KERNEL__
+    unlock(c->rcache_lock);
+#else
+    epoch_unpin();
+#endif // __KERNEL__
+    if (full) {
+        lock(c->mrc_lock);
+        mrc_feed(c, &c->mrc_buf[stat_shard_id()]);
+        unlock(c->mrc_lock);
+    }
 }
 
 
-struct data_set *wcache_read(struct fingerprint *fp, offset_t offset, offset_t len) {
-    struct data_set* dset = NULL;
-    struct hash_entry* he = hash_find(wcache, fp);
+#ifndef __KERNEL__
+
+// chain entries and tree levels a get without rcache_lock walks at most,
+// so that racing with writers cannot send it in circles
+#define LOCKLESS_STEPS  128
+
+// extents a get without rcache_lock serves at most
+#define LOCKLESS_NODES  16
+
+// Applies the hits queued by gets without rcache_lock, as rcache_lookup()
+// does, if any are queued or if force. Nodes unlinked since are skipped.
+// Forced, it leaves no node in the buffers, so that what was queued
+// before can be freed.
+// called with rcache_lock held
+static void access_drain(struct cinq_cache *c, int force) {
+    int i;
+    unsigned int k;
+    if (!force && !__atomic_load_n(&c->access_dirty, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    __atomic_store_n(&c->access_dirty, 0, __ATOMIC_SEQ_CST);
+    for (i = 0; i < STAT_N_SHARD; i++) {
+        struct access_buf *b = &c->access[i];
+        while (__atomic_exchange_n(&b->busy, 1, __ATOMIC_ACQUIRE)) {
+            relax();
+        }
+        for (k = 0; k < b->n; k++) {
+            struct mynode *my = b->ent[k].node;
+            if (my->unlinked) {
+                continue; // its tenant may be gone
+            }
+            if (b->ent[k].first) {
+                my->tenant->gets++;
+                my->tenant->hits++;
+            }
+            touch_node(c, my);
+        }
+        b->n = 0;
+        __atomic_store_n(&b->busy, 0, __ATOMIC_RELEASE);
+    }
+}
+
+// Queues the hits of a get without rcache_lock for LRU. A full buffer is
+// drained if the lock is free; otherwise hits are dropped, LRU order
+// being a hint.
+static void access_record(struct cinq_cache *c, struct mynode **nodes, int n) {
+    struct access_buf *b = &c->access[stat_shard_id()];
+    int i, was_empty, full;
+    if (__atomic_exchange_n(&b->busy, 1, __ATOMIC_ACQUIRE)) {
+        return; // drained, or taken by a thread sharing the shard
+    }
+    was_empty = (b->n == 0);
+    for (i = 0; i < n && b->n < ACCESS_BUF_LEN; i++) {
+        b->ent[b->n].node = nodes[i];
+        b->ent[b->n].first = (i == 0);
+        b->n++;
+    }
+    full = (b->n == ACCESS_BUF_LEN);
+    __atomic_store_n(&b->busy, 0, __ATOMIC_RELEASE);
+    if (was_empty && !__atomic_load_n(&c->access_dirty, __ATOMIC_SEQ_CST)) {
+        __atomic_store_n(&c->access_dirty, 1, __ATOMIC_SEQ_CST);
+    }
+    if (full && trylock(c->rcache_lock)) {
+        access_drain(c, 0);
+        unlock(c->rcache_lock);
+    }
+}
+
+// Like hash_find() on R-cache, without rcache_lock. Returns NULL if not
+// found, or if the chain changed under it.
+static struct hash_entry *hash_find_lockless(struct cinq_cache *c, struct fingerprint *fpnt) {
+    struct list_head *slot_list = &c->rcache[fp_slot(c, *fpnt)];
+    struct list_head *cur = __atomic_load_n(&(slot_list->next), __ATOMIC_ACQUIRE);
+    int steps = LOCKLESS_STEPS;
+    while (cur != slot_list) {
+        // freed entries lead nowhere, and doomed ones off the chain
+        if (cur == NULL || cur == &c->rcache_doomed || steps-- == 0) {
+            return NULL;
+        }
+        struct hash_entry *he = list_entry(cur, struct hash_entry, entry);
+        if (fpnt_eql(&(he->fpnt), fpnt)) {
+            return he;
+        }
+        cur = __atomic_load_n(&(cur->next), __ATOMIC_ACQUIRE);
+    }
+    return NULL;
+}
+
+// Like first_overlap(), without rcache_lock. Returns NULL also if the
+// descent takes more than LOCKLESS_STEPS levels.
+static struct mynode *first_overlap_lockless(struct rb_root *root, offset_t offset, offset_t len) {
+    struct rb_node *n = __atomic_load_n(&(root->rb_node), __ATOMIC_ACQUIRE);
+    struct mynode *ret = NULL;
+    int steps = LOCKLESS_STEPS;
+    while (n) {
+        struct mynode *my = container_of(n, struct mynode, node);
+        if (steps-- == 0) {
+            return NULL;
+        }
+        if (offset + len <= my->offset) {
+            n = __atomic_load_n(&(n->rb_left), __ATOMIC_ACQUIRE);
+        } else if (my->offset + my->len <= offset) {
+            n = __atomic_load_n(&(n->rb_right), __ATOMIC_ACQUIRE);
+        } else {
+            ret = my;
+            n = __atomic_load_n(&(n->rb_left), __ATOMIC_ACQUIRE);
+        }
+    }
+    return ret;
+}
 
+// Serves a get wholly covered by R-cache without rcache_lock. The chain
+// and the tree are walked in an epoch, which keeps what they lead to from
+// being freed, and the copies are kept only if the entry did not change
+// meanwhile. Returns NULL if the get is to take the locked path, as misses
+// and partial hits do.
+static struct data_set *rcache_get_lockless(struct cinq_cache *c, struct fingerprint *fp, struct cinq_handle *h, offset_t offset, offset_t len) {
+    struct mynode *nodes[LOCKLESS_NODES];
+    struct data_set *dset;
+    struct hash_entry *he;
+    unsigned int seq;
+    offset_t covered = offset, served = 0;
+    int n = 0;
+    
+    if (len == 0 || epoch_pin() != 0) {
+        return NULL;
+    }
+    he = h ? __atomic_load_n(&(h->rentry), __ATOMIC_ACQUIRE) : hash_find_lockless(c, fp);
     if (he == NULL) {
-        // nothing found, return NULL
+        epoch_unpin();
+        return NULL;
+    }
+    seq = __atomic_load_n(&(he->seq), __ATOMIC_ACQUIRE);
+    if ((seq & 1) || he->doomed) {
+        epoch_unpin();
         return NULL;
     }
-    struct rb_root* rbroot = &(he->root);
     
     dset = (struct data_set *) ALLOC(sizeof(struct data_set));
     INIT_LIST_HEAD(&(dset->entries));
-    
-    struct mynode* my = first_overlap(rbroot, offset, len);
-    while (my) {
-        
-        if (offset + len <= my->offset) {
-            break;
+    while (covered < offset + len) {
+        struct mynode *my = first_overlap_lockless(&(he->root), covered, offset + len - covered);
+        if (my == NULL || my->offset > covered || n == LOCKLESS_NODES) {
+            goto fail;
         }
-        
         struct data_entry *de = (struct data_entry *) ALLOC(sizeof(struct data_entry));
-        de->data = my->data;
+        de->data = (char *) ALLOC(my->len);
+        memcpy(de->data, my->data, my->len);
         de->offset = my->offset;
         de->len = my->len;
         list_add(&(de->entry), &(dset->entries));
-        
-        struct rb_node* next = rb_next(&(my->node));
-        if (next == NULL) {
-            break;
+        nodes[n++] = my;
+        served += my->len;
+        covered = my->offset + my->len;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&(he->seq), __ATOMIC_RELAXED) != seq) {
+        goto fail;
+    }
+    access_record(c, nodes, n);
+    epoch_unpin();
+    
+    stat_inc(&c->counters, STAT_RGET_LOCKLESS);
+    count_rget(c, offset, len, 1, served);
+    return dset;
+    
+fail:
+    epoch_unpin();
+    free_data_set(dset, 1);
+    return NULL;
+}
+
+#else
+
+#define access_drain(c, force)
+#define rcache_get_lockless(c, fp, h, offset, len)  NULL
+
+#endif // __KERNEL__
+
+
+// the R-cache entry of fp, or of h if not NULL
+#define rcache_entry(c, h, fp)     ((h) ? rcache_handle_entry(c, h) : hash_find(c, c->rcache, (fp)))
+
+// looks in R-cache, then in L2
+static struct data_set *rcache_get_shared(struct cinq_cache *c, struct fingerprint *fp, struct cinq_handle *h, offset_t offset, offset_t len) {
+    int covered;
+    offset_t served;
+    struct data_set *dset = rcache_get_lockless(c, fp, h, offset, len);
+    if (dset) {
+        return dset;
+    }
+    
+    lock(c->rcache_lock);
+    access_drain(c, 0);
+    dset = rcache_lookup(c, rcache_entry(c, h, fp), offset, len, &covered, &served);
+    if (covered || c->l2 == NULL) {
+        count_tenant_get(c, fp, covered, served);
+        unlock(c->rcache_lock);
+        count_rget(c, offset, len, covered, served);
+        return dset;
+    }
+    // the entry outlives the unlock, and its generation tells whether a
+    // put or an invalidation came in meanwhile
+    struct hash_entry *he = rcache_pin(c, fp);
+    unsigned int gen = he->gen;
+    unlock(c->rcache_lock);
+    
+    // bring what L2 has for the missing part back to R-cache and retry;
+    // disk reads happen out of rcache_lock
+    struct data_set *l2set = l2_take(c->l2, fp, offset, len);
+    if (l2set == NULL) {
+        lock(c->rcache_lock);
+        rcache_unpin(c, he);
+        count_tenant_get(c, fp, covered, served);
+        unlock(c->rcache_lock);
+        count_rget(c, offset, len, covered, served);
+        return dset;
+    }
+    free_data_set(dset, 1);
+    
+    lock(c->rcache_lock);
+    struct data_entry *de;
+    offset_t n_taken = 0;
+    if (!he->doomed && he->gen == gen) {
+        list_for_each_entry(de, &(l2set->entries), entry) {
+            stat_inc(&c->counters, STAT_L2_HIT);
+            rcache_fill(c, fp, he, de);
+            n_taken++;
         }
-        my = container_of(next, struct mynode, node);
     }
+    // otherwise the extents are older than what R-cache has now, or
+    // were invalidated; they are dropped
+    rcache_unpin(c, he);
+    dset = rcache_lookup(c, rcache_entry(c, h, fp), offset, len, &covered, &served);
+    count_tenant_get(c, fp, covered, served);
+    unlock(c->rcache_lock);
+    free_data_set(l2set, 1);
+    trace_event(TRACE_DEBUG, EV_L2_TAKE, offset, len, n_taken);
+    
+    count_rget(c, offset, len, covered, served);
+    return dset;
+}
+
+// Serves the get from the copies of this thread if one is valid, and keeps
+// a copy of what the shared tiers return.
+static struct data_set *__rcache_get(struct cinq_cache *c, struct fingerprint *fp, struct cinq_handle *h, offset_t offset, offset_t len) {
+    struct l0 *l = __atomic_load_n(&(c->l0), __ATOMIC_ACQUIRE);
+    unsigned long gen = 0;
+    struct data_set *dset;
     
+    rcache_note_get(c, fp, offset, len);
+    if (l == NULL) {
+        return rcache_get_shared(c, fp, h, offset, len);
+    }
+    dset = l0_get(l, fp, offset, len, &gen);
+    if (dset) {
+        stat_inc(&c->counters, STAT_RGET_L0);
+        count_rget(c, offset, len, 1, list_first_entry(&(dset->entries), struct data_entry, entry)->len);
+        return dset;
+    }
+    dset = rcache_get_shared(c, fp, h, offset, len);
+    l0_fill(l, fp, offset, len, gen, dset);
+    return dset;
+}
+
+struct data_set *cinq_rcache_get(struct cinq_cache *c, struct fingerprint *fp, offset_t offset, offset_t len) {
+    LAT_BEGIN(c, t);
+    RECORD(CINQ_OP_RGET, fp, offset, len);
+    struct data_set *dset = __rcache_get(c, fp, NULL, offset, len);
+    LAT_END(c, t, CINQ_OP_RGET);
+    return dset;
+}
+
+struct data_set *rcache_get(struct fingerprint *fp, offset_t offset, offset_t len) {
+    return cinq_rcache_get(&default_cache, fp, offset, len);
+}
+
+struct data_set *rcache_get_h(struct cinq_handle *h, offset_t offset, offset_t len) {
+    struct cinq_cache *c = h->cache;
+    LAT_BEGIN(c, t);
+    RECORD(CINQ_OP_RGET, &(h->fpnt), offset, len);
+    struct data_set *dset = __rcache_get(c, &(h->fpnt), h, offset, len);
+    LAT_END(c, t, CINQ_OP_RGET);
     return dset;
 }
 
 
+// R-cache data come from the arena if possible
+static char *alloc_data(struct cinq_cache *c, offset_t len) {
+    if (c->data_arena) {
+        char *data = (char *) arena_alloc(c->data_arena, len);
+        if (data) {
+            return data;
+        }
+    }
+    return (char *) ALLOC(len);
+}
+
+// also the release function of L2, with c as arg
+static void release_data(void *arg, char *data, offset_t len) {
+    struct cinq_cache *c = (struct cinq_cache *) arg;
+    if (c->data_arena && arena_contains(c->data_arena, data)) {
+        arena_free(c->data_arena, data, len);
+    } else {
+        FREE(data, len);
+    }
+}
 
-static int wcache_insert_data(struct rb_root *root, offset_t offset, offset_t len, char* data) {
+
+static int rcache_insert_data(struct cinq_cache *c, struct rb_root *root, offset_t offset, offset_t len, char* data, struct hash_entry* h_entry, struct tenant *t) {
     struct rb_node **new = &(root->rb_node), *parent = NULL;
 
 	/* Figure out where to put new node */
@@ -426,38 +1240,283 @@ static int wcache_insert_data(struct rb_root *root, offset_t offset, offset_t le
     struct mynode* my_new = (struct mynode *) ALLOC(sizeof(struct mynode));
     my_new->offset = offset;
     my_new->len = len;
-    my_new->data = (char *) ALLOC(len);
+    my_new->data = alloc_data(c, len);
+    my_new->h_entry = h_entry;
+    my_new->hits = 0;
+    my_new->tenant = t;
+    my_new->unlinked = 0;
     memcpy(my_new->data, data, len);
-    // lru_entry not set for this
+    c->rcache_size += len;
+    c->rcache_meta += sizeof(struct mynode);
+    tenant_charge(&c->tenants, t, len);
+    // add LRU entry to head of list
+    list_add(&(my_new->lru_entry), &c->lru_list);
+    list_add(&(my_new->tenant_lru), &(t->lru));
+    h_entry->finger = my_new;
+    if (c->evict_policy == CINQ_EVICT_GDSF) {
+        prio_insert(c, my_new);
+    }
 
 	/* Add new node and rebalance tree. */
+	seq_begin(h_entry);
 	rb_link_node(&my_new->node, parent, new);
 	rb_insert_color(&my_new->node, root);
+	seq_end(c, h_entry);
 	
     return 0;
 }
 
+// takes a node out of R-cache, leaving its data to the caller
+static void unlink_node(struct cinq_cache *c, struct mynode *cur) {
+    c->rcache_size -= cur->len;
+    c->rcache_meta -= sizeof(struct mynode);
+    // remove from lru lists
+    list_del(&(cur->lru_entry));
+    list_del(&(cur->tenant_lru));
+    // may free the tenant
+    tenant_charge(&c->tenants, cur->tenant, -(long) cur->len);
+    if (c->evict_policy == CINQ_EVICT_GDSF) {
+        rb_erase(&(cur->prio_node), &c->prio_tree);
+    }
+    // remove from rbtree
+    seq_begin(cur->h_entry);
+    rb_erase(&(cur->node), &(cur->h_entry->root));
+    seq_end(c, cur->h_entry);
+    cur->unlinked = 1;
+    if (cur->h_entry->finger == cur) {
+        cur->h_entry->finger = NULL;
+    }
+}
 
-// Data input are SAFE to free by users after the function returns.
-int wcache_write(struct fingerprint *fpnt, struct data_entry *de) {
-    struct hash_entry* he = hash_find(wcache, fpnt);
+static void free_entry(struct cinq_cache *c, struct hash_entry *he) {
+    list_del(&(he->entry));
+    c->rcache_meta -= sizeof(struct hash_entry);
+    epoch_defer(&(c->rlimbo), he, sizeof(struct hash_entry), free_retired, NULL);
+}
+
+// frees the R-cache nodes and entries no get without rcache_lock sees
+static void rcache_reap(struct cinq_cache *c) {
+    access_drain(c, 1);
+    epoch_reap(&(c->rlimbo), 0);
+}
+
+static void free_node(void *arg, void *p, size_t len) {
+    struct mynode *cur = (struct mynode *) p;
+    release_data(arg, cur->data, cur->len);
+    FREE(cur, sizeof(struct mynode));
+}
+
+// frees an unlinked node and its data once no get sees them
+static void retire_node(struct cinq_cache *c, struct mynode *cur) {
+    epoch_defer(&(c->rlimbo), cur, sizeof(struct mynode), free_node, c);
+    if (c->rlimbo.pending >= EPOCH_REAP_BATCH) {
+        rcache_reap(c);
+    }
+}
+
+// frees a hash entry left with no nodes and no handles; doomed ones are
+// left to reap_doomed()
+static void reclaim_entry(struct cinq_cache *c, struct hash_entry *he) {
+    if (!he->doomed && he->refs == 0 && RB_EMPTY_ROOT(&(he->root))) {
+        free_entry(c, he);
+    }
+}
+
+// frees a node whose data are stale
+static void drop_node(struct cinq_cache *c, struct mynode *cur) {
+    struct hash_entry *he = cur->h_entry;
+    stat_add(&c->counters, STAT_INVALIDATE_BYTES, cur->len);
+    unlink_node(c, cur);
+    retire_node(c, cur);
+    reclaim_entry(c, he);
+}
+
+// Frees up to budget nodes of doomed hash entries, and the entries once
+// they are empty. Entries still pinned are left to their last handle.
+static void reap_doomed(struct cinq_cache *c, int budget) {
+    while (budget > 0 && !list_empty(&c->rcache_doomed)) {
+        struct hash_entry *he = list_first_entry(&c->rcache_doomed, struct hash_entry, entry);
+        // the root is as good a victim as any and needs no descent
+        struct rb_node *n = he->root.rb_node;
+        if (n == NULL) {
+            if (he->refs) {
+                list_del_init(&(he->entry));
+            } else {
+                free_entry(c, he);
+            }
+            continue;
+        }
+        drop_node(c, rb_entry(n, struct mynode, node));
+        budget--;
+    }
+}
+
+static void evict_node(struct cinq_cache *c, struct mynode *cur) {
+    struct hash_entry *he = cur->h_entry;
+    if (he->doomed) {
+        drop_node(c, cur);
+        return;
+    }
+    cur->tenant->evictions++;
+    if (c->evict_policy == CINQ_EVICT_GDSF) {
+        c->gdsf_clock = cur->prio;
+    }
+    stat_inc(&c->counters, STAT_EVICT);
+    stat_add(&c->counters, STAT_EVICT_BYTES, cur->len);
+    trace_event(TRACE_DEBUG, EV_EVICT, cur->offset, cur->len, cur->hits);
+    unlink_node(c, cur);
+
+    if (c->l2 && l2_admit(c->l2, cur->len, cur->hits)) {
+        // L2 takes over a copy, as gets without the lock may still be
+        // reading the data
+        char *data = (char *) ALLOC(cur->len);
+        memcpy(data, cur->data, cur->len);
+        int queued = (l2_put(c->l2, &(he->fpnt), cur->offset, cur->len, data) == 0);
+        if (queued) {
+            stat_inc(&c->counters, STAT_L2_SPILL);
+        }
+        trace_event(TRACE_DEBUG, EV_L2_SPILL, cur->offset, cur->len, queued);
+    }
+    retire_node(c, cur);
+    reclaim_entry(c, he);
+}
+
+// Evicts the least recently used extents of t until it is within quota,
+// then frees t if it is left with nothing; t is gone on return.
+static void limit_tenant_size(struct cinq_cache *c, struct tenant *t) {
+    // a tenant with a quota is never freed by eviction
+    while (t->quota && t->usage > t->quota) {
+        evict_node(c, list_entry(t->lru.prev, struct mynode, tenant_lru));
+    }
+    tenant_release(&c->tenants, t);
+}
+
+// bytes counted against rcache_limit: data, index and the static tables
+#define rcache_used(c)   ((c)->rcache_size + (c)->rcache_meta + \
+        (ssize_t) ((c)->n_slot * sizeof(struct list_head) + (c)->tenants.n_tenant * sizeof(struct tenant)))
+
+// The next live node to evict. The tenant most over its share loses its
+// least recently used extent; when no one is over, the policy picks: the
+// global LRU tail, or the lowest GDSF priority. Returns NULL if R-cache
+// is empty.
+static struct mynode *pick_victim(struct cinq_cache *c) {
+    if (list_empty(&c->lru_list)) {
+        return NULL;
+    }
+    struct tenant *t = tenant_most_over(&c->tenants, c->rcache_limit);
+    if (t) {
+        return list_entry(t->lru.prev, struct mynode, tenant_lru);
+    }
+    if (c->evict_policy == CINQ_EVICT_GDSF) {
+        return rb_entry(rb_first(&c->prio_tree), struct mynode, prio_node);
+    }
+    return list_entry(c->lru_list.prev, struct mynode, lru_entry);
+}
+
+// Evicts until R-cache uses less than target bytes or budget extents are
+// freed, doomed nodes first. Returns the number of extents freed.
+static int shrink_rcache(struct cinq_cache *c, ssize_t target, int budget) {
+    int n = 0;
+    while (n < budget && rcache_used(c) >= target && !list_empty(&c->lru_list)) {
+        if (!list_empty(&c->rcache_doomed)) {
+            reap_doomed(c, 1);
+        } else {
+            evict_node(c, pick_victim(c));
+        }
+        n++;
+    }
+    return n;
+}
+
+// Keeps R-cache within limit after a put. With the reclaimer running, it
+// is woken past the high watermark, and the put evicts by itself only once
+// the limit is reached.
+static void limit_rcache_size(struct cinq_cache *c) {
+    if (c->reclaim_high) {
+        if (rcache_used(c) < reclaim_mark(c, c->reclaim_high)) {
+            return;
+        }
+        reclaim_wake(c);
+        if (rcache_used(c) < c->rcache_limit) {
+            return;
+        }
+        stat_inc(&c->counters, STAT_DIRECT_RECLAIM);
+    }
+    shrink_rcache(c, c->rcache_limit, INT_MAX);
+}
 
+// TinyLFU: when a put needs room, the extent gets in only if it is
+// estimated to be accessed more often than the victim it would push out.
+static int rcache_admit(struct cinq_cache *c, struct fingerprint *fpnt, struct data_entry *de) {
+    ssize_t room = c->reclaim_high ? reclaim_mark(c, c->reclaim_high) : c->rcache_limit;
+    if (c->admission == NULL || rcache_used(c) + (ssize_t) de->len < room ||
+        !list_empty(&c->rcache_doomed)) {
+        return 1;
+    }
+    // updates of cached data go in, or the old bytes would stay
+    struct hash_entry *he = hash_find(c, c->rcache, fpnt);
+    if (he && first_overlap(&(he->root), de->offset, de->len)) {
+        return 1;
+    }
+    struct mynode *victim = pick_victim(c);
+    if (victim == NULL ||
+        sketch_estimate(c->admission, extent_key(fpnt, de->offset)) >
+        sketch_estimate(c->admission, extent_key(&(victim->h_entry->fpnt), victim->offset))) {
+        return 1;
+    }
+    // counted as a reject only, not as a put
+    stat_inc(&c->counters, STAT_ADMIT_REJECT);
+    // nor may an older copy come back from L2, or from a take-back
+    // under way
+    if (c->l2) {
+        l2_drop(c->l2, fpnt, de->offset, de->len);
+    }
+    if (he) {
+        he->gen++;
+    }
+    return 0;
+}
+
+// he is the entry of fpnt, or NULL to look it up
+static void __rcache_put(struct cinq_cache *c, struct fingerprint *fpnt, struct hash_entry *he, struct data_entry *de) {
+    struct tenant *t;
+    
+    stat_inc(&c->counters, STAT_RPUT);
+    stat_add(&c->counters, STAT_RPUT_BYTES, de->len);
+    trace_event(TRACE_DEBUG, EV_RPUT, de->offset, de->len, c->rcache_size);    
+    access_drain(c, 0); // evictions see the latest hits
+    reap_doomed(c, REAP_BATCH);
+    // after the reaping above, which may free tenants
+    t = tenant_get(&c->tenants, fpnt->uid);
+    if (t == NULL) {
+        return;
+    }
+    
+    if (he == NULL) {
+        he = hash_find(c, c->rcache, fpnt);
+    }
     if (he == NULL) {
         // new element in hash
-        struct list_head* slot_list = &wcache[fp_slot(*fpnt)];
-        he = (struct hash_entry *) ALLOC(sizeof(struct hash_entry));
-        he->fpnt = *fpnt;
-        he->root = RB_ROOT;
-        list_add(&(he->entry), slot_list);
+        he = hash_add(c, c->rcache, fpnt);
+        c->rcache_meta += sizeof(struct hash_entry);
     }
+    he->gen++;
     struct rb_root* rbroot = &(he->root);
     
+    if (c->l2) {
+        // keep L2 exclusive of R-cache
+        l2_drop(c->l2, fpnt, de->offset, de->len);
+    }
+    
     // find first overlap
-    struct mynode* my = first_overlap(rbroot, de->offset, de->len);
+    struct mynode* my = finger_overlap(he, de->offset, de->len);
     if (my == NULL) {
         // no overlap, just insert and quit
-        wcache_insert_data(rbroot, de->offset, de->len, de->data);
-        return 0;
+        rcache_insert_data(c, rbroot, de->offset, de->len, de->data, he, t);
+        reclaim_entry(c, he); // nothing inserted if len is 0
+        limit_tenant_size(c, t);
+        limit_rcache_size(c);
+        return;
     }
     
     // split and insert
@@ -466,7 +1525,7 @@ int wcache_write(struct fingerprint *fpnt, struct data_entry *de) {
         
         my = first_overlap(rbroot, offset, len);
         if (my == NULL) {
-            wcache_insert_data(rbroot, offset, len, de->data + (offset - de->offset));
+            rcache_insert_data(c, rbroot, offset, len, de->data + (offset - de->offset), he, t);
             break;
         } else if (my->offset <= offset) {
             // case 1
@@ -476,7 +1535,13 @@ int wcache_write(struct fingerprint *fpnt, struct data_entry *de) {
             }
             
             // write to overlapped segment
+            seq_begin(he);
             memcpy(my->data + (offset - my->offset), de->data + (offset - de->offset), write_len);
+            seq_end(c, he);
+            
+            // move newly accessed element to head
+            list_move(&(my->lru_entry), &c->lru_list);
+            list_move(&(my->tenant_lru), &(my->tenant->lru));
             
             offset += write_len;
             len -= write_len;
@@ -486,72 +1551,1355 @@ int wcache_write(struct fingerprint *fpnt, struct data_entry *de) {
             // case 2
             // insert non-overlapping part
             offset_t seg_len = my->offset - offset;
-            wcache_insert_data(rbroot, offset, seg_len, de->data + (offset - de->offset));
+            rcache_insert_data(c, rbroot, offset, seg_len, de->data + (offset - de->offset), he, t);
             offset += seg_len;
             len -= seg_len;
             // go on to next round, will be handled immediately by case 1
         }
     }
     
-    return 0;
+    limit_tenant_size(c, t);
+    limit_rcache_size(c);
 }
 
-
-
-// finalize cache system
-void rwcache_fini() {
-    int i;
+// Puts the parts of de that R-cache does not hold into he, leaving cached
+// bytes alone; for data taken back from L2, which are not a put.
+static void rcache_fill(struct cinq_cache *c, struct fingerprint *fpnt, struct hash_entry *he, struct data_entry *de) {
+    struct tenant *t = tenant_get(&c->tenants, fpnt->uid);
+    offset_t offset = de->offset, len = de->len;
     
-    // fini wcache
-    for (i = 0; i < N_SLOT; i++) {
-        struct list_head* slot_list = &wcache[i];
-        struct list_head *cur, *tmp;
-        list_for_each_safe(cur, tmp, slot_list) {
-            struct hash_entry* he = list_entry(cur, struct hash_entry, entry);
-            list_del(&(he->entry));
-            
-            // free all the rbtrees in the list
-            for (;;) {
-                struct rb_node* first = rb_first(&(he->root));
-                if (first == NULL) {
-                    break;
-                }
-                rb_erase(first, &(he->root));
-                
-                struct mynode *node = rb_entry(first, struct mynode, node);
-                FREE(node->data, node->len);
-                FREE(node, sizeof(struct mynode));
-            }
-            
-            FREE(he, sizeof(struct hash_entry));
+    if (t == NULL) {
+        return;
+    }
+    while (len > 0) {
+        struct mynode *my = first_overlap(&(he->root), offset, len);
+        offset_t seg_len;
+        if (my == NULL) {
+            rcache_insert_data(c, &(he->root), offset, len, de->data + (offset - de->offset), he, t);
+            break;
+        }
+        if (my->offset > offset) {
+            seg_len = my->offset - offset;
+            rcache_insert_data(c, &(he->root), offset, seg_len, de->data + (offset - de->offset), he, t);
+            offset += seg_len;
+            len -= seg_len;
+        }
+        // skip what is cached
+        seg_len = my->offset + my->len - offset;
+        if (seg_len >= len) {
+            break;
         }
+        offset += seg_len;
+        len -= seg_len;
+    }
+    limit_tenant_size(c, t);
+    limit_rcache_size(c);
+}
+
+void cinq_rcache_put(struct cinq_cache *c, struct fingerprint *fpnt, struct data_entry *de) {
+    LAT_BEGIN(c, t);
+    RECORD(CINQ_OP_RPUT, fpnt, de->offset, de->len);
+    lock(c->rcache_lock);
+    if (rcache_admit(c, fpnt, de)) {
+        __rcache_put(c, fpnt, NULL, de);
+    }
+    unlock(c->rcache_lock);
+    LAT_END(c, t, CINQ_OP_RPUT);
+}
+
+void rcache_put(struct fingerprint *fpnt, struct data_entry *de) {
+    cinq_rcache_put(&default_cache, fpnt, de);
+}
+
+void rcache_put_h(struct cinq_handle *h, struct data_entry *de) {
+    struct cinq_cache *c = h->cache;
+    LAT_BEGIN(c, t);
+    RECORD(CINQ_OP_RPUT, &(h->fpnt), de->offset, de->len);
+    lock(c->rcache_lock);
+    if (rcache_admit(c, &(h->fpnt), de)) {
+        __rcache_put(c, &(h->fpnt), rcache_handle_entry(c, h), de);
     }
+    unlock(c->rcache_lock);
+    LAT_END(c, t, CINQ_OP_RPUT);
+}
+
+
+static void __rcache_invalidate(struct cinq_cache *c, struct fingerprint *fp, offset_t offset, offset_t len) {
+    struct hash_entry *he = hash_find(c, c->rcache, fp);
+    offset_t n = 0;
     
-    // fini rcache
-    for (i = 0; i < N_SLOT; i++) {
-        struct list_head* slot_list = &rcache[i];
-        // TODO free all the rbtrees in the list
-        struct list_head *cur, *tmp;
-        list_for_each_safe(cur, tmp, slot_list) {
-            struct hash_entry* he = list_entry(cur, struct hash_entry, entry);
-            list_del(&(he->entry));
-            
-            // free all the rbtrees in the list
-            for (;;) {
-                struct rb_node* first = rb_first(&(he->root));
-                if (first == NULL) {
-                    break;
-                }
-                rb_erase(first, &(he->root));
-                
-                struct mynode *node = rb_entry(first, struct mynode, node);
-                FREE(node->data, node->len);
-                list_del(&(node->lru_entry)); // remove from lru
-                FREE(node, sizeof(struct mynode));
-            }
-            
-            FREE(he, sizeof(struct hash_entry));
+    stat_inc(&c->counters, STAT_INVALIDATE);
+    if (c->l2) {
+        l2_drop(c->l2, fp, offset, len);
+    }
+    if (he) {
+        he->gen++;
+    }
+    struct mynode *my = he ? first_overlap(&(he->root), offset, len) : NULL;
+    while (my && my->offset < offset + len) {
+        // 'he' is freed along with its last node, when 'next' is NULL
+        struct rb_node *next = rb_next(&(my->node));
+        drop_node(c, my);
+        n++;
+        if (next == NULL) {
+            break;
         }
+        my = rb_entry(next, struct mynode, node);
     }
+    trace_event(TRACE_DEBUG, EV_INVALIDATE, offset, len, n);
+}
+
+void cinq_rcache_invalidate(struct cinq_cache *c, struct fingerprint *fp, offset_t offset, offset_t len) {
+    lock(c->rcache_lock);
+    __rcache_invalidate(c, fp, offset, len);
+    unlock(c->rcache_lock);
+}
+
+void rcache_invalidate(struct fingerprint *fp, offset_t offset, offset_t len) {
+    cinq_rcache_invalidate(&default_cache, fp, offset, len);
+}
+
+
+// O(1): the entry leaves the hash and its nodes are reaped later
+static void __rcache_invalidate_file(struct cinq_cache *c, struct fingerprint *fp) {
+    struct hash_entry *he = hash_find(c, c->rcache, fp);
+    
+    stat_inc(&c->counters, STAT_INVALIDATE);
+    if (c->l2) {
+        l2_drop(c->l2, fp, 0, (offset_t) -1);
+    }
+    if (he) {
+        he->gen++;
+        seq_begin(he);
+        he->doomed = 1;
+        list_move_tail(&(he->entry), &c->rcache_doomed);
+        seq_end(c, he);
+    }
+    trace_event(TRACE_DEBUG, EV_INVALIDATE, 0, (offset_t) -1, he != NULL);
+}
+
+void cinq_rcache_invalidate_file(struct cinq_cache *c, struct fingerprint *fp) {
+    lock(c->rcache_lock);
+    __rcache_invalidate_file(c, fp);
+    unlock(c->rcache_lock);
+}
+
+void rcache_invalidate_file(struct fingerprint *fp) {
+    cinq_rcache_invalidate_file(&default_cache, fp);
+}
+
+
+static struct hash_entry *rcache_pin(struct cinq_cache *c, struct fingerprint *fp) {
+    struct hash_entry *he = hash_find(c, c->rcache, fp);
+    if (he == NULL) {
+        he = hash_add(c, c->rcache, fp);
+        c->rcache_meta += sizeof(struct hash_entry);
+    }
+    he->refs++;
+    return he;
+}
+
+static void rcache_unpin(struct cinq_cache *c, struct hash_entry *he) {
+    if (--he->refs > 0) {
+        return;
+    }
+    if (!he->doomed) {
+        reclaim_entry(c, he);
+    } else if (RB_EMPTY_ROOT(&(he->root)) && list_empty(&(he->entry))) {
+        // already taken off rcache_doomed by reap_doomed()
+        free_entry(c, he);
+    }
+}
+
+// called with rcache_lock held; renews the entry of h if the file got
+// invalidated since
+static struct hash_entry *rcache_handle_entry(struct cinq_cache *c, struct cinq_handle *h) {
+    if (h->rentry->doomed) {
+        struct hash_entry *old = h->rentry;
+        __atomic_store_n(&(h->rentry), rcache_pin(c, &(h->fpnt)), __ATOMIC_RELEASE);
+        rcache_unpin(c, old);
+    }
+    return h->rentry;
+}
+
+static struct hash_entry *wcache_pin(struct cinq_cache *c, struct fingerprint *fp) {
+    struct hash_entry *he = hash_find(c, c->wcache, fp);
+    if (he == NULL) {
+        he = hash_add(c, c->wcache, fp);
+    }
+    he->refs++;
+    return he;
+}
+
+static void wcache_unpin(struct hash_entry *he) {
+    if (--he->refs == 0 && RB_EMPTY_ROOT(&(he->root))) {
+        list_del(&(he->entry));
+        FREE(he, sizeof(struct hash_entry));
+    }
+}
+
+
+struct cinq_handle *cinq_cache_open(struct cinq_cache *c, struct fingerprint *fp) {
+    struct cinq_handle *h = (struct cinq_handle *) ALLOC(sizeof(struct cinq_handle));
+    if (h == NULL) {
+        return NULL;
+    }
+    h->cache = c;
+    h->fpnt = *fp;
+    lock(c->rcache_lock);
+    h->rentry = rcache_pin(c, fp);
+    unlock(c->rcache_lock);
+    lock(c->wcache_lock);
+    h->wentry = wcache_pin(c, fp);
+    unlock(c->wcache_lock);
+    return h;
+}
+
+struct cinq_handle *cinq_open(struct fingerprint *fp) {
+    return cinq_cache_open(&default_cache, fp);
+}
+
+
+void cinq_close(struct cinq_handle *h) {
+    struct cinq_cache *c = h->cache;
+    lock(c->rcache_lock);
+    rcache_unpin(c, h->rentry);
+    unlock(c->rcache_lock);
+    lock(c->wcache_lock);
+    wcache_unpin(h->wentry);
+    unlock(c->wcache_lock);
+    FREE(h, sizeof(struct cinq_handle));
+}
+
+
+static void add_entry(struct data_set *dset, char *data, offset_t offset, offset_t len) {
+    struct data_entry *de = (struct data_entry *) ALLOC(sizeof(struct data_entry));
+    de->data = data;
+    de->offset = offset;
+    de->len = len;
+    list_add(&(de->entry), &(dset->entries));
+}
+
+// adds the pieces of a snapshot within [from, to), cut to fit
+static void read_frozen(struct data_set *dset, struct cinq_snapshot *s, offset_t from, offset_t to) {
+    struct mynode *my = first_overlap(&(s->root), from, to - from);
+    while (my && my->offset < to) {
+        offset_t start = my->offset > from ? my->offset : from;
+        offset_t end = my->offset + my->len < to ? my->offset + my->len : to;
+        add_entry(dset, my->data + (start - my->offset), start, end - start);
+        
+        struct rb_node *next = rb_next(&(my->node));
+        my = next ? container_of(next, struct mynode, node) : NULL;
+    }
+}
+
+// Extents written after a snapshot cover those in it; the gaps between
+// them are filled from the snapshot.
+static struct data_set *__wcache_read(struct cinq_cache *c, struct hash_entry *he, offset_t offset, offset_t len) {
+    struct data_set* dset = NULL;
+    
+    stat_inc(&c->counters, STAT_WREAD);
+    if (he == NULL) {
+        // nothing found, return NULL
+        return NULL;
+    }
+    struct rb_root* rbroot = &(he->root);
+    offset_t covered = offset; // the range before is served
+    
+    dset = (struct data_set *) ALLOC(sizeof(struct data_set));
+    INIT_LIST_HEAD(&(dset->entries));
+    
+    struct mynode* my = first_overlap(rbroot, offset, len);
+    while (my) {
+        
+        if (offset + len <= my->offset) {
+            break;
+        }
+        
+        if (he->frozen && covered < my->offset) {
+            read_frozen(dset, he->frozen, covered, my->offset);
+        }
+        add_entry(dset, my->data, my->offset, my->len);
+        covered = my->offset + my->len;
+        
+        struct rb_node* next = rb_next(&(my->node));
+        if (next == NULL) {
+            break;
+        }
+        my = container_of(next, struct mynode, node);
+    }
+    if (he->frozen && covered < offset + len) {
+        read_frozen(dset, he->frozen, covered, offset + len);
+    }
+    
+    return dset;
+}
+
+struct data_set *cinq_wcache_read(struct cinq_cache *c, struct fingerprint *fp, offset_t offset, offset_t len) {
+    LAT_BEGIN(c, t);
+    RECORD(CINQ_OP_WREAD, fp, offset, len);
+    lock(c->wcache_lock);
+    struct data_set *dset = __wcache_read(c, hash_find(c, c->wcache, fp), offset, len);
+    unlock(c->wcache_lock);
+    LAT_END(c, t, CINQ_OP_WREAD);
+    return dset;
+}
+
+struct data_set *wcache_read(struct fingerprint *fp, offset_t offset, offset_t len) {
+    return cinq_wcache_read(&default_cache, fp, offset, len);
+}
+
+struct data_set *wcache_read_h(struct cinq_handle *h, offset_t offset, offset_t len) {
+    struct cinq_cache *c = h->cache;
+    LAT_BEGIN(c, t);
+    RECORD(CINQ_OP_WREAD, &(h->fpnt), offset, len);
+    lock(c->wcache_lock);
+    struct data_set *dset = __wcache_read(c, h->wentry, offset, len);
+    unlock(c->wcache_lock);
+    LAT_END(c, t, CINQ_OP_WREAD);
+    return dset;
+}
+
+
+
+static int wcache_insert_data(struct cinq_cache *c, struct rb_root *root, offset_t offset, offset_t len, char* data) {
+    struct rb_node **new = &(root->rb_node), *parent = NULL;
+
+	/* Figure out where to put new node */
+	while (*new) {
+		struct mynode *this = container_of(*new, struct mynode, node);
+
+		parent = *new;
+		if (offset + len <= this->offset)
+			new = &((*new)->rb_left);
+		else if (this->offset + this->len <= offset)
+			new = &((*new)->rb_right);
+		else
+			return -1;
+	}
+	
+    struct mynode* my_new = (struct mynode *) ALLOC(sizeof(struct mynode));
+    my_new->offset = offset;
+    my_new->len = len;
+    my_new->data = (char *) ALLOC(len);
+    my_new->seg = NULL;
+    memcpy(my_new->data, data, len);
+    c->wcache_size += len;
+    // lru_entry not set for this
+
+	/* Add new node and rebalance tree. */
+	rb_link_node(&my_new->node, parent, new);
+	rb_insert_color(&my_new->node, root);
+	
+    return 0;
+}
+
+
+// W-cache log: indexes len bytes at data, already in seg
+static void wlog_link(struct hash_entry *he, struct wlog_seg *seg, char *data, offset_t offset, offset_t len) {
+    struct rb_node **new = &(he->root.rb_node), *parent = NULL;
+    while (*new) {
+        parent = *new;
+        if (offset < container_of(*new, struct mynode, node)->offset) {
+            new = &((*new)->rb_left);
+        } else {
+            new = &((*new)->rb_right);
+        }
+    }
+    
+    struct mynode *my = (struct mynode *) ALLOC(sizeof(struct mynode));
+    my->data = data;
+    my->offset = offset;
+    my->len = len;
+    my->h_entry = he;
+    my->seg = seg;
+    list_add(&(my->lru_entry), &(seg->extents));
+    rb_link_node(&my->node, parent, new);
+    rb_insert_color(&my->node, &(he->root));
+}
+
+
+// W-cache log: drops [offset, offset + len) from the index, cutting the
+// extents that stick out of it
+static void wlog_punch(struct cinq_cache *c, struct hash_entry *he, offset_t offset, offset_t len) {
+    offset_t end = offset + len;
+    struct mynode *my = first_overlap(&(he->root), offset, len);
+    while (my && my->offset < end) {
+        struct rb_node *next = rb_next(&(my->node));
+        offset_t my_end = my->offset + my->len;
+        offset_t cut;
+        
+        if (my->offset < offset) {
+            if (my_end > end) {
+                // the range is inside, keep the tail apart
+                wlog_link(he, my->seg, my->data + (end - my->offset), end, my_end - end);
+                my_end = end;
+            }
+            cut = my_end - offset;
+            my->len = offset - my->offset;
+            wlog_dead(c, my->seg, cut);
+        } else if (my_end > end) {
+            cut = end - my->offset;
+            my->data += cut;
+            my->offset = end;
+            my->len -= cut;
+            wlog_dead(c, my->seg, cut);
+        } else {
+            cut = my->len;
+            rb_erase(&(my->node), &(he->root));
+            wcache_drop_data(c, my);
+            FREE(my, sizeof(struct mynode));
+        }
+        c->wcache_size -= cut;
+        my = next ? container_of(next, struct mynode, node) : NULL;
+    }
+}
+
+
+// segments holding data of a snapshot stay, as snapshots are read
+// without the lock
+static int seg_frozen(void *arg, struct wlog_seg *seg) {
+    struct mynode *my;
+    list_for_each_entry(my, &(seg->extents), lru_entry) {
+        if (my->h_entry->frozen) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Moves the live data of the emptiest sealed segment to the head, which
+// frees the segment. Returns 0 if no segment is worth it.
+// called with wcache_lock held
+static int wlog_compact(struct cinq_cache *c) {
+    struct wlog_seg *victim = wlog_victim(c->wlog, WLOG_COMPACT_PCT, seg_frozen, NULL);
+    struct mynode *my;
+    offset_t moved = 0;
+    if (victim == NULL) {
+        return 0;
+    }
+    while (!list_empty(&(victim->extents))) {
+        struct wlog_seg *seg;
+        my = list_first_entry(&(victim->extents), struct mynode, lru_entry);
+        char *data = wlog_add(c, my->data, my->len, &seg);
+        if (data == NULL) {
+            break;
+        }
+        int last = my->lru_entry.next == &(victim->extents);
+        list_del(&(my->lru_entry));
+        list_add(&(my->lru_entry), &(seg->extents));
+        my->data = data;
+        my->seg = seg;
+        moved += my->len;
+        wlog_dead(c, victim, my->len); // frees the victim at last
+        if (last) {
+            break;
+        }
+    }
+    stat_inc(&c->counters, STAT_WLOG_COMPACT);
+    stat_add(&c->counters, STAT_WLOG_MOVED_BYTES, moved);
+    return 1;
+}
+
+#ifndef __KERNEL__
+#define compact_wake(c)     pthread_cond_signal(&(c)->compact_cond)
+#else
+#define compact_wake(c)     wlog_compact(c)
+#endif // __KERNEL__
+
+
+// W-cache log: appends the data, at most a segment a time, then lets them
+// cover what was there
+static int __wlog_write(struct cinq_cache *c, struct hash_entry *he, struct data_entry *de) {
+    offset_t done = 0;
+    while (done < de->len) {
+        offset_t len = de->len - done;
+        struct wlog_seg *head = c->wlog->head, *seg;
+        if (len > c->wlog->seg_size) {
+            len = c->wlog->seg_size;
+        }
+        char *data = wlog_add(c, de->data + done, len, &seg);
+        if (data == NULL) {
+            return -1;
+        }
+        wlog_punch(c, he, de->offset + done, len);
+        wlog_link(he, seg, data, de->offset + done, len);
+        c->wcache_size += len;
+        done += len;
+        if (seg != head) {
+            compact_wake(c); // a segment was sealed
+        }
+    }
+    return 0;
+}
+
+
+// he is the entry of fpnt, or NULL to look it up
+static int __wcache_write(struct cinq_cache *c, struct fingerprint *fpnt, struct hash_entry *he, struct data_entry *de) {
+    stat_inc(&c->counters, STAT_WWRITE);
+    stat_add(&c->counters, STAT_WWRITE_BYTES, de->len);
+    trace_event(TRACE_DEBUG, EV_WWRITE, de->offset, de->len, c->wcache_size);
+    if (he == NULL) {
+        he = hash_find(c, c->wcache, fpnt);
+    }
+    if (he == NULL) {
+        // new element in hash
+        he = hash_add(c, c->wcache, fpnt);
+    }
+    if (c->wlog) {
+        return __wlog_write(c, he, de);
+    }
+    struct rb_root* rbroot = &(he->root);
+    
+    // find first overlap
+    struct mynode* my = first_overlap(rbroot, de->offset, de->len);
+    if (my == NULL) {
+        // no overlap, just insert and quit
+        wcache_insert_data(c, rbroot, de->offset, de->len, de->data);
+        return 0;
+    }
+    
+    // split and insert
+    offset_t offset = de->offset, len = de->len;
+    while (len > 0) {
+        
+        my = first_overlap(rbroot, offset, len);
+        if (my == NULL) {
+            wcache_insert_data(c, rbroot, offset, len, de->data + (offset - de->offset));
+            break;
+        } else if (my->offset <= offset) {
+            // case 1
+            offset_t write_len = len; // the length of data written to overlapped segment
+            if (offset + write_len > my->offset + my->len) {
+                write_len = my->offset + my->len - offset;
+            }
+            
+            if (epoch_readers()) {
+                // readers may see the old bytes; change a copy
+                char *data = (char *) ALLOC(my->len);
+                memcpy(data, my->data, my->len);
+                wcache_retire(c, my->data, my->len, free_retired, NULL);
+                my->data = data;
+            }
+            // write to overlapped segment
+            memcpy(my->data + (offset - my->offset), de->data + (offset - de->offset), write_len);
+            
+            offset += write_len;
+            len -= write_len;
+            // go on to next round
+        } else {
+            // offst < my->offset
+            // case 2
+            // insert non-overlapping part
+            offset_t seg_len = my->offset - offset;
+            wcache_insert_data(c, rbroot, offset, seg_len, de->data + (offset - de->offset));
+            offset += seg_len;
+            len -= seg_len;
+            // go on to next round, will be handled immediately by case 1
+        }
+    }
+    
+    return 0;
+}
+
+// Data input are SAFE to free by users after the function returns.
+int cinq_wcache_write(struct cinq_cache *c, struct fingerprint *fpnt, struct data_entry *de) {
+    LAT_BEGIN(c, t);
+    RECORD(CINQ_OP_WWRITE, fpnt, de->offset, de->len);
+    lock(c->wcache_lock);
+    int ret = __wcache_write(c, fpnt, NULL, de);
+    unlock(c->wcache_lock);
+    LAT_END(c, t, CINQ_OP_WWRITE);
+    return ret;
+}
+
+int wcache_write(struct fingerprint *fpnt, struct data_entry *de) {
+    return cinq_wcache_write(&default_cache, fpnt, de);
+}
+
+int wcache_write_h(struct cinq_handle *h, struct data_entry *de) {
+    struct cinq_cache *c = h->cache;
+    LAT_BEGIN(c, t);
+    RECORD(CINQ_OP_WWRITE, &(h->fpnt), de->offset, de->len);
+    lock(c->wcache_lock);
+    int ret = __wcache_write(c, &(h->fpnt), h->wentry, de);
+    unlock(c->wcache_lock);
+    LAT_END(c, t, CINQ_OP_WWRITE);
+    return ret;
+}
+
+
+
+static struct cinq_snapshot *__wcache_snapshot(struct cinq_cache *c, struct hash_entry *he) {
+    if (he == NULL || he->frozen || RB_EMPTY_ROOT(&(he->root))) {
+        return NULL;
+    }
+    struct cinq_snapshot *s = (struct cinq_snapshot *) ALLOC(sizeof(struct cinq_snapshot));
+    if (s == NULL) {
+        return NULL;
+    }
+    // the tree moves whole: rbtree nodes do not point back at their root
+    s->cache = c;
+    s->he = he;
+    s->root = he->root;
+    he->root = RB_ROOT;
+    he->frozen = s;
+    he->refs++; // the entry lives as long as the snapshot
+    stat_inc(&c->counters, STAT_WSNAPSHOT);
+    return s;
+}
+
+struct cinq_snapshot *cinq_wcache_snapshot(struct cinq_cache *c, struct fingerprint *fp) {
+    lock(c->wcache_lock);
+    struct cinq_snapshot *s = __wcache_snapshot(c, hash_find(c, c->wcache, fp));
+    unlock(c->wcache_lock);
+    return s;
+}
+
+struct cinq_snapshot *wcache_snapshot(struct fingerprint *fp) {
+    return cinq_wcache_snapshot(&default_cache, fp);
+}
+
+struct cinq_snapshot *wcache_snapshot_h(struct cinq_handle *h) {
+    struct cinq_cache *c = h->cache;
+    lock(c->wcache_lock);
+    struct cinq_snapshot *s = __wcache_snapshot(c, h->wentry);
+    unlock(c->wcache_lock);
+    return s;
+}
+
+
+// No lock: the tree is read only until the snapshot is released.
+struct data_set *wcache_snapshot_data(struct cinq_snapshot *s) {
+    struct data_set *dset = (struct data_set *) ALLOC(sizeof(struct data_set));
+    struct rb_node *n;
+    INIT_LIST_HEAD(&(dset->entries));
+    for (n = rb_first(&(s->root)); n; n = rb_next(n)) {
+        struct mynode *my = rb_entry(n, struct mynode, node);
+        add_entry(dset, my->data, my->offset, my->len);
+    }
+    return dset;
+}
+
+
+void wcache_snapshot_release(struct cinq_snapshot *s) {
+    struct cinq_cache *c = s->cache;
+    offset_t n = 0, bytes = 0;
+    lock(c->wcache_lock);
+    for (;;) {
+        struct rb_node *first = rb_first(&(s->root));
+        if (first == NULL) {
+            break;
+        }
+        rb_erase(first, &(s->root));
+        
+        struct mynode *node = rb_entry(first, struct mynode, node);
+        c->wcache_size -= node->len;
+        stat_add(&c->counters, STAT_WSNAPSHOT_BYTES, node->len);
+        n++;
+        bytes += node->len;
+        wcache_drop_data(c, node);
+        FREE(node, sizeof(struct mynode));
+    }
+    s->he->frozen = NULL;
+    wcache_unpin(s->he);
+    trace_event(TRACE_INFO, EV_WRELEASE, n, bytes, c->wcache_size);
+    unlock(c->wcache_lock);
+    FREE(s, sizeof(struct cinq_snapshot));
+}
+
+
+
+int cinq_rcache_l2_enable(struct cinq_cache *c, const struct l2_config *cfg) {
+    cinq_rcache_l2_disable(c);
+    c->l2 = l2_create(cfg, release_data, c);
+    return c->l2 ? 0 : -1;
+}
+
+int rcache_l2_enable(const struct l2_config *cfg) {
+    return cinq_rcache_l2_enable(&default_cache, cfg);
+}
+
+
+void cinq_rcache_l2_disable(struct cinq_cache *c) {
+    if (c->l2) {
+        l2_destroy(c->l2);
+        c->l2 = NULL;
+    }
+}
+
+void rcache_l2_disable() {
+    cinq_rcache_l2_disable(&default_cache);
+}
+
+
+int cinq_rcache_arena_enable_on(struct cinq_cache *c, size_t bytes, int node) {
+    int ret = -1;
+    lock(c->rcache_lock);
+    if (c->data_arena == NULL && c->rcache_size == 0) {
+        c->data_arena = arena_create_on(bytes, node);
+        ret = c->data_arena ? 0 : -1;
+    }
+    unlock(c->rcache_lock);
+    return ret;
+}
+
+int cinq_rcache_arena_enable(struct cinq_cache *c, size_t bytes) {
+    return cinq_rcache_arena_enable_on(c, bytes, -1);
+}
+
+int rcache_arena_enable(size_t bytes) {
+    return cinq_rcache_arena_enable(&default_cache, bytes);
+}
+
+
+#ifndef __KERNEL__
+
+// Compacts one segment after another while any is worth it, then sleeps
+// until a segment is sealed.
+static void *compactor_run(void *arg) {
+    struct cinq_cache *c = (struct cinq_cache *) arg;
+    lock(c->wcache_lock);
+    while (!c->compact_stop) {
+        if (!wlog_compact(c)) {
+            pthread_cond_wait(&c->compact_cond, &c->wcache_lock);
+            continue;
+        }
+        unlock(c->wcache_lock);
+        relax();
+        lock(c->wcache_lock);
+    }
+    unlock(c->wcache_lock);
+    return NULL;
+}
+
+static int compactor_start(struct cinq_cache *c) {
+    c->compact_stop = 0;
+    return pthread_create(&c->compactor, NULL, compactor_run, c) == 0 ? 0 : -1;
+}
+
+static void compactor_stop(struct cinq_cache *c) {
+    lock(c->wcache_lock);
+    c->compact_stop = 1;
+    compact_wake(c);
+    unlock(c->wcache_lock);
+    pthread_join(c->compactor, NULL);
+}
+
+#else
+
+// segments are compacted as they are sealed
+#define compactor_start(c)  0
+#define compactor_stop(c)
+
+#endif // __KERNEL__
+
+
+int cinq_wcache_log_enable(struct cinq_cache *c, size_t segment_bytes) {
+    int ret = -1;
+    lock(c->wcache_lock);
+    if (c->wlog == NULL && c->wcache_size == 0 && segment_bytes > 0) {
+        c->wlog = wlog_create(segment_bytes);
+        ret = c->wlog ? 0 : -1;
+    }
+    unlock(c->wcache_lock);
+    if (ret == 0 && compactor_start(c) != 0) {
+        lock(c->wcache_lock);
+        wlog_destroy(c->wlog);
+        c->wlog = NULL;
+        unlock(c->wcache_lock);
+        ret = -1;
+    }
+    return ret;
+}
+
+int wcache_log_enable(size_t segment_bytes) {
+    return cinq_wcache_log_enable(&default_cache, segment_bytes);
+}
+
+
+int cinq_rcache_set_policy(struct cinq_cache *c, int policy) {
+    int ret = -1;
+    if (policy != CINQ_EVICT_LRU && policy != CINQ_EVICT_GDSF) {
+        return -1;
+    }
+    lock(c->rcache_lock);
+    if (list_empty(&c->lru_list)) {
+        c->evict_policy = policy;
+        c->gdsf_clock = 0;
+        ret = 0;
+    }
+    unlock(c->rcache_lock);
+    return ret;
+}
+
+int rcache_set_policy(int policy) {
+    return cinq_rcache_set_policy(&default_cache, policy);
+}
+
+
+static void destroy_sketch(void *arg, void *p, size_t len) {
+    sketch_destroy((struct sketch *) p);
+}
+
+int cinq_rcache_tinylfu_enable(struct cinq_cache *c, size_t width) {
+    struct sketch *sk = NULL;
+    if (width) {
+        sk = sketch_create(width);
+        if (sk == NULL) {
+            return -1;
+        }
+    }
+    lock(c->rcache_lock);
+    struct sketch *old = c->admission;
+    __atomic_store_n(&(c->admission), sk, __ATOMIC_RELEASE);
+    if (old) {
+        // gets may be counting in it
+        epoch_defer(&(c->rlimbo), old, 0, destroy_sketch, NULL);
+        epoch_reap(&(c->rlimbo), 0);
+    }
+    unlock(c->rcache_lock);
+    return 0;
+}
+
+int rcache_tinylfu_enable(size_t width) {
+    return cinq_rcache_tinylfu_enable(&default_cache, width);
+}
+
+
+static void destroy_mrc(void *arg, void *p, size_t len) {
+    mrc_destroy((struct mrc *) p);
+}
+
+int cinq_rcache_mrc_enable(struct cinq_cache *c, unsigned int sample_1_in) {
+    struct mrc *m = NULL;
+    if (sample_1_in) {
+        m = mrc_create(sample_1_in, MRC_MAX_KEYS);
+        if (m == NULL) {
+            return -1;
+        }
+    }
+    lock(c->rcache_lock);
+    lock(c->mrc_lock);
+    // keys queued so far go to the old curve
+    mrc_feed_all(c);
+    struct mrc *old = c->mrc;
+    __atomic_store_n(&(c->mrc), m, __ATOMIC_RELEASE);
+    unlock(c->mrc_lock);
+    if (old) {
+        // gets may be sampling against it
+        epoch_defer(&(c->rlimbo), old, 0, destroy_mrc, NULL);
+        epoch_reap(&(c->rlimbo), 0);
+    }
+    unlock(c->rcache_lock);
+    return 0;
+}
+
+int rcache_mrc_enable(unsigned int sample_1_in) {
+    return cinq_rcache_mrc_enable(&default_cache, sample_1_in);
+}
+
+
+// predicted hit ratio of an R-cache of 'bytes'; called with mrc_lock held
+// and the queued keys fed
+static unsigned long __rcache_mrc_hit_ppm(struct cinq_cache *c, size_t bytes) {
+    return c->mrc ? mrc_hit_ppm(c->mrc, bytes >> MRC_BLOCK_SHIFT) : 0;
+}
+
+unsigned long cinq_rcache_mrc_hit_ppm(struct cinq_cache *c, size_t bytes) {
+    lock(c->mrc_lock);
+    mrc_feed_all(c);
+    unsigned long ppm = __rcache_mrc_hit_ppm(c, bytes);
+    unlock(c->mrc_lock);
+    return ppm;
+}
+
+unsigned long rcache_mrc_hit_ppm(size_t bytes) {
+    return cinq_rcache_mrc_hit_ppm(&default_cache, bytes);
+}
+
+
+int cinq_rcache_l0_enable(struct cinq_cache *c, unsigned int slots, size_t max_len) {
+    unsigned int n = 1;
+    if (slots && max_len == 0) {
+        return -1;
+    }
+    while (n < slots && n < L0_MAX_SLOTS) {
+        n <<= 1;
+    }
+    lock(c->rcache_lock);
+    if (c->l0 == NULL && slots) {
+        struct l0 *l = l0_create();
+        if (l == NULL) {
+            unlock(c->rcache_lock);
+            return -1;
+        }
+        __atomic_store_n(&(c->l0), l, __ATOMIC_RELEASE);
+    }
+    // kept when off, so that copies left in threads stay checked
+    if (c->l0) {
+        __atomic_store_n(&(c->l0->max_len), max_len, __ATOMIC_RELAXED);
+        __atomic_store_n(&(c->l0->slots), slots ? n : 0, __ATOMIC_RELAXED);
+    }
+    unlock(c->rcache_lock);
+    return 0;
+}
+
+int rcache_l0_enable(unsigned int slots, size_t max_len) {
+    return cinq_rcache_l0_enable(&default_cache, slots, max_len);
+}
+
+
+int cinq_rcache_set_limit(struct cinq_cache *c, size_t bytes) {
+    if (bytes == 0) {
+        return -1;
+    }
+    lock(c->rcache_lock);
+    c->limit_target = bytes;
+    if (c->limit_target >= c->rcache_limit) {
+        c->rcache_limit = c->limit_target;
+    }
+    // step down at most SHRINK_STEP below usage at a time, so puts in
+    // between evict no more than they bring; a newer call takes over
+    while (c->limit_target == (ssize_t) bytes && c->rcache_limit > c->limit_target) {
+        ssize_t used = rcache_used(c);
+        ssize_t next = (used < c->rcache_limit ? used : c->rcache_limit) - SHRINK_STEP;
+        c->rcache_limit = next > c->limit_target ? next : c->limit_target;
+        shrink_rcache(c, c->rcache_limit, INT_MAX);
+        unlock(c->rcache_lock);
+        relax();
+        lock(c->rcache_lock);
+    }
+    unlock(c->rcache_lock);
+    return 0;
+}
+
+int rcache_set_limit(size_t bytes) {
+    return cinq_rcache_set_limit(&default_cache, bytes);
+}
+
+
+size_t cinq_rcache_shrink(struct cinq_cache *c, size_t bytes) {
+    size_t freed = 0;
+    lock(c->rcache_lock);
+    while (freed < bytes && !list_empty(&c->lru_list)) {
+        ssize_t used = rcache_used(c);
+        ssize_t step = bytes - freed < SHRINK_STEP ? bytes - freed : SHRINK_STEP;
+        shrink_rcache(c, used - step, INT_MAX);
+        freed += used - rcache_used(c);
+        unlock(c->rcache_lock);
+        relax();
+        lock(c->rcache_lock);
+    }
+    unlock(c->rcache_lock);
+    return freed;
+}
+
+size_t rcache_shrink(size_t bytes) {
+    return cinq_rcache_shrink(&default_cache, bytes);
+}
+
+
+#ifdef __KERNEL__
+
+// Memory pressure in the kernel: R-cache data count as reclaimable pages.
+
+static unsigned long rcache_shrink_count(struct shrinker *s, struct shrink_control *sc) {
+    struct cinq_cache *c = container_of(s, struct cinq_cache, shrinker);
+    return c->rcache_size >> PAGE_SHIFT; // a racy read is good enough
+}
+
+static unsigned long rcache_shrink_scan(struct shrinker *s, struct shrink_control *sc) {
+    struct cinq_cache *c = container_of(s, struct cinq_cache, shrinker);
+    size_t freed = cinq_rcache_shrink(c, sc->nr_to_scan << PAGE_SHIFT);
+    return freed ? freed >> PAGE_SHIFT : SHRINK_STOP;
+}
+
+#endif // __KERNEL__
+
+
+#ifndef __KERNEL__
+
+// Sleeps until R-cache passes the high watermark, then evicts down to the
+// low one in batches, letting puts and gets in between.
+static void *reclaimer_run(void *arg) {
+    struct cinq_cache *c = (struct cinq_cache *) arg;
+    lock(c->rcache_lock);
+    while (!c->reclaim_stop) {
+        if (rcache_used(c) < reclaim_mark(c, c->reclaim_high) || list_empty(&c->lru_list)) {
+            pthread_cond_wait(&c->reclaim_cond, &c->rcache_lock);
+            continue;
+        }
+        while (!c->reclaim_stop && rcache_used(c) >= reclaim_mark(c, c->reclaim_low)) {
+            int n = shrink_rcache(c, reclaim_mark(c, c->reclaim_low), RECLAIM_BATCH);
+            if (n == 0) {
+                break;
+            }
+            stat_add(&c->counters, STAT_BG_RECLAIM, n);
+            unlock(c->rcache_lock);
+            relax();
+            lock(c->rcache_lock);
+        }
+    }
+    unlock(c->rcache_lock);
+    return NULL;
+}
+
+
+int cinq_rcache_reclaimer_start(struct cinq_cache *c, unsigned int low_pct, unsigned int high_pct) {
+    int ret = -1;
+    if (low_pct == 0 || low_pct >= high_pct || high_pct >= 100) {
+        return -1;
+    }
+    lock(c->rcache_lock);
+    if (c->reclaim_high == 0) {
+        c->reclaim_low = low_pct;
+        c->reclaim_high = high_pct;
+        c->reclaim_stop = 0;
+        ret = pthread_create(&c->reclaimer, NULL, reclaimer_run, c) == 0 ? 0 : -1;
+        if (ret) {
+            c->reclaim_low = c->reclaim_high = 0;
+        } else {
+            reclaim_wake(c); // R-cache may be past high already
+        }
+    }
+    unlock(c->rcache_lock);
+    return ret;
+}
+
+
+
+void cinq_rcache_reclaimer_stop(struct cinq_cache *c) {
+    lock(c->rcache_lock);
+    if (c->reclaim_high == 0) {
+        unlock(c->rcache_lock);
+        return;
+    }
+    c->reclaim_stop = 1;
+    reclaim_wake(c);
+    unlock(c->rcache_lock);
+    pthread_join(c->reclaimer, NULL);
+    
+    lock(c->rcache_lock);
+    c->reclaim_low = c->reclaim_high = 0;
+    // puts relied on the reclaimer down to the limit
+    shrink_rcache(c, c->rcache_limit, INT_MAX);
+    unlock(c->rcache_lock);
+}
+
+#else
+
+int cinq_rcache_reclaimer_start(struct cinq_cache *c, unsigned int low_pct, unsigned int high_pct) {
+    return -1;
+}
+
+void cinq_rcache_reclaimer_stop(struct cinq_cache *c) {
+}
+
+#endif // __KERNEL__
+
+int rcache_reclaimer_start(unsigned int low_pct, unsigned int high_pct) {
+    return cinq_rcache_reclaimer_start(&default_cache, low_pct, high_pct);
+}
+
+void rcache_reclaimer_stop() {
+    cinq_rcache_reclaimer_stop(&default_cache);
+}
+
+
+int cinq_rcache_set_quota(struct cinq_cache *c, unsigned long uid, size_t quota, unsigned int weight) {
+    if (weight == 0) {
+        return -1;
+    }
+    lock(c->rcache_lock);
+    struct tenant *t = tenant_get(&c->tenants, uid);
+    if (t) {
+        tenant_set(&c->tenants, t, quota, weight);
+        limit_tenant_size(c, t);
+    }
+    unlock(c->rcache_lock);
+    return t ? 0 : -1;
+}
+
+int rcache_set_quota(unsigned long uid, size_t quota, unsigned int weight) {
+    return cinq_rcache_set_quota(&default_cache, uid, quota, weight);
+}
+
+
+int cinq_rcache_tenant_stats(struct cinq_cache *c, unsigned long uid, struct cinq_tenant_stats *st) {
+    lock(c->rcache_lock);
+    access_drain(c, 0);
+    struct tenant *t = tenant_find(&c->tenants, uid);
+    if (t) {
+        tenant_stats(t, st);
+    }
+    unlock(c->rcache_lock);
+    return t ? 0 : -1;
+}
+
+int rcache_tenant_stats(unsigned long uid, struct cinq_tenant_stats *st) {
+    return cinq_rcache_tenant_stats(&default_cache, uid, st);
+}
+
+
+static unsigned long tree_depth(struct rb_node *n) {
+    if (n == NULL) {
+        return 0;
+    }
+    unsigned long l = tree_depth(n->rb_left), r = tree_depth(n->rb_right);
+    return (l > r ? l : r) + 1;
+}
+
+
+// count entries, nodes and the max tree depth of a cache
+static void index_shape(struct cinq_cache *c, struct list_head *htab, unsigned long *entries, unsigned long *nodes, unsigned long *depth) {
+    unsigned int i;
+    *entries = *nodes = *depth = 0;
+    for (i = 0; i < c->n_slot; i++) {
+        struct hash_entry *he;
+        list_for_each_entry(he, &htab[i], entry) {
+            struct rb_node *n;
+            (*entries)++;
+            for (n = rb_first(&(he->root)); n; n = rb_next(n)) {
+                (*nodes)++;
+            }
+            unsigned long d = tree_depth(he->root.rb_node);
+            if (d > *depth) {
+                *depth = d;
+            }
+        }
+    }
+}
+
+
+void cinq_cache_get_stats(struct cinq_cache *c, struct cinq_stats *st) {
+    unsigned long v[N_STAT_COUNTER];
+    stat_sum(&c->counters, v);
+    
+    st->rget = v[STAT_RGET];
+    st->rget_hits = v[STAT_RGET_HIT];
+    st->rget_partial = v[STAT_RGET_PARTIAL];
+    st->rget_misses = v[STAT_RGET_MISS];
+    st->rget_bytes = v[STAT_RGET_BYTES];
+    st->rput = v[STAT_RPUT];
+    st->rput_bytes = v[STAT_RPUT_BYTES];
+    st->evictions = v[STAT_EVICT];
+    st->evicted_bytes = v[STAT_EVICT_BYTES];
+    st->l2_spills = v[STAT_L2_SPILL];
+    st->l2_hits = v[STAT_L2_HIT];
+    st->invalidations = v[STAT_INVALIDATE];
+    st->invalidated_bytes = v[STAT_INVALIDATE_BYTES];
+    st->admit_rejects = v[STAT_ADMIT_REJECT];
+    st->bg_reclaims = v[STAT_BG_RECLAIM];
+    st->direct_reclaims = v[STAT_DIRECT_RECLAIM];
+    lock(c->rcache_lock);
+    st->rcache_size = c->rcache_size;
+    st->rcache_meta = rcache_used(c) - c->rcache_size;
+    st->rcache_limit = c->rcache_limit;
+    unlock(c->rcache_lock);
+    
+    lock(c->mrc_lock);
+    mrc_feed_all(c);
+    st->mrc_samples = c->mrc ? c->mrc->samples : 0;
+    int i;
+    for (i = 0; i < CINQ_MRC_POINTS; i++) {
+        // from 1/8 to 8 times the limit
+        st->mrc_size[i] = i < 3 ? st->rcache_limit >> (3 - i) : st->rcache_limit << (i - 3);
+        st->mrc_hit_ppm[i] = __rcache_mrc_hit_ppm(c, st->mrc_size[i]);
+    }
+    unlock(c->mrc_lock);
+    st->rcache_entries = st->rcache_nodes = st->rcache_depth = 0;
+    
+    st->wread = v[STAT_WREAD];
+    st->wwrite = v[STAT_WWRITE];
+    st->wwrite_bytes = v[STAT_WWRITE_BYTES];
+    st->wcollect = v[STAT_WCOLLECT];
+    st->wcollect_bytes = v[STAT_WCOLLECT_BYTES];
+    st->wsnapshots = v[STAT_WSNAPSHOT];
+    st->wsnapshot_bytes = v[STAT_WSNAPSHOT_BYTES];
+    st->wlog_compactions = v[STAT_WLOG_COMPACT];
+    st->wlog_moved_bytes = v[STAT_WLOG_MOVED_BYTES];
+    st->wdeferred = v[STAT_WDEFERRED];
+    st->rget_lockless = v[STAT_RGET_LOCKLESS];
+    st->rget_l0 = v[STAT_RGET_L0];
+    lock(c->wcache_lock);
+    st->wcache_dirty = c->wcache_size;
+    st->wlog_segments = c->wlog ? c->wlog->n_seg : 0;
+    unlock(c->wcache_lock);
+    st->wcache_entries = st->wcache_nodes = st->wcache_depth = 0;
+    
+    cinq_cache_merge_latency(&c, 1, st->latency);
+}
+
+void cinq_cache_stats(struct cinq_stats *st) {
+    cinq_cache_get_stats(&default_cache, st);
+}
+
+
+void cinq_cache_get_index_stats(struct cinq_cache *c, struct cinq_stats *st) {
+    lock(c->rcache_lock);
+    index_shape(c, c->rcache, &st->rcache_entries, &st->rcache_nodes, &st->rcache_depth);
+    unlock(c->rcache_lock);
+    lock(c->wcache_lock);
+    index_shape(c, c->wcache, &st->wcache_entries, &st->wcache_nodes, &st->wcache_depth);
+    unlock(c->wcache_lock);
+}
+
+void cinq_cache_index_stats(struct cinq_stats *st) {
+    cinq_cache_get_index_stats(&default_cache, st);
+}
+
+
+void cinq_cache_merge_latency(struct cinq_cache *const *cs, int n, struct cinq_latency *lat) {
+    int op;
+    for (op = 0; op < CINQ_N_OP; op++) {
+#ifndef CINQ_NO_LATENCY
+        struct hist sum;
+        int i, j;
+        hist_clear(&sum);
+        for (j = 0; j < n; j++) {
+            for (i = 0; cs[j]->latency && i < STAT_N_SHARD; i++) {
+                hist_merge(&sum, &cs[j]->latency[i][op]);
+            }
+        }
+        hist_summary(&sum, &lat[op]);
+#else
+        memset(&lat[op], 0, sizeof(struct cinq_latency));
+#endif // CINQ_NO_LATENCY
+    }
+}
+
+
+void cinq_cache_latency_enable(struct cinq_cache *c, int on) {
+#ifndef CINQ_NO_LATENCY
+    if (on && !c->latency_on) {
+        int i, op;
+        if (c->latency == NULL) {
+            c->latency = (struct hist (*)[CINQ_N_OP]) ALLOC_LINE(STAT_N_SHARD * sizeof(*c->latency));
+            if (c->latency == NULL) {
+                return;
+            }
+        }
+        for (i = 0; i < STAT_N_SHARD; i++) {
+            for (op = 0; op < CINQ_N_OP; op++) {
+                hist_clear(&c->latency[i][op]);
+            }
+        }
+        hist_clock_init();
+    }
+    c->latency_on = on;
+#endif // CINQ_NO_LATENCY
+}
+
+void cinq_latency_enable(int on) {
+    cinq_cache_latency_enable(&default_cache, on);
+}
+
+
+static void cache_fini(struct cinq_cache *c) {
+    unsigned int i;
+    
+#ifdef __KERNEL__
+    unregister_shrinker(&c->shrinker);
+#endif
+    cinq_rcache_reclaimer_stop(c);
+    cinq_rcache_l2_disable(c);
+    if (c->wlog) {
+        compactor_stop(c);
+    }
+    
+    // fini wcache
+    for (i = 0; i < c->n_slot; i++) {
+        struct list_head* slot_list = &c->wcache[i];
+        struct list_head *cur, *tmp;
+        list_for_each_safe(cur, tmp, slot_list) {
+            struct hash_entry* he = list_entry(cur, struct hash_entry, entry);
+            list_del(&(he->entry));
+            
+            // free all the rbtrees in the list
+            for (;;) {
+                struct rb_node* first = rb_first(&(he->root));
+                if (first == NULL) {
+                    break;
+                }
+                rb_erase(first, &(he->root));
+                
+                struct mynode *node = rb_entry(first, struct mynode, node);
+                c->wcache_size -= node->len;
+                wcache_drop_data(c, node);
+                FREE(node, sizeof(struct mynode));
+            }
+            
+            FREE(he, sizeof(struct hash_entry));
+        }
+    }
+    
+    // fini rcache
+    lock(c->rcache_lock);
+    reap_doomed(c, INT_MAX);
+    unlock(c->rcache_lock);
+    for (i = 0; i < c->n_slot; i++) {
+        struct list_head* slot_list = &c->rcache[i];
+        // TODO free all the rbtrees in the list
+        struct list_head *cur, *tmp;
+        list_for_each_safe(cur, tmp, slot_list) {
+            struct hash_entry* he = list_entry(cur, struct hash_entry, entry);
+            list_del(&(he->entry));
+            
+            // free all the rbtrees in the list
+            for (;;) {
+                struct rb_node* first = rb_first(&(he->root));
+                if (first == NULL) {
+                    break;
+                }
+                rb_erase(first, &(he->root));
+                
+                struct mynode *node = rb_entry(first, struct mynode, node);
+                release_data(c, node->data, node->len);
+                list_del(&(node->lru_entry)); // remove from lru
+                list_del(&(node->tenant_lru));
+                c->rcache_size -= node->len;
+                c->rcache_meta -= sizeof(struct mynode);
+                FREE(node, sizeof(struct mynode));
+            }
+            
+            c->rcache_meta -= sizeof(struct hash_entry);
+            FREE(he, sizeof(struct hash_entry));
+        }
+    }
+    
+    tenant_table_fini(&c->tenants);
+    cinq_rcache_tinylfu_enable(c, 0);
+    cinq_rcache_mrc_enable(c, 0);
+    c->prio_tree = RB_ROOT;
+    epoch_reap(&(c->rlimbo), 1);
+    if (c->l0) {
+        l0_destroy(c->l0);
+        c->l0 = NULL;
+    }
+    
+    if (c->data_arena) {
+        arena_destroy(c->data_arena);
+        c->data_arena = NULL;
+    }
+    epoch_reap(&(c->wlimbo), 1);
+    if (c->wlog) {
+        wlog_destroy(c->wlog);
+        c->wlog = NULL;
+    }
+#ifndef CINQ_NO_LATENCY
+    if (c->latency) {
+        FREE(c->latency, STAT_N_SHARD * sizeof(*c->latency));
+        c->latency = NULL;
+    }
+#endif // CINQ_NO_LATENCY
+    lock_fini(c->rcache_lock);
+    lock_fini(c->wcache_lock);
+    lock_fini(c->mrc_lock);
+}
+
+// finalize cache system
+void rwcache_fini() {
+    cache_fini(&default_cache);
 }
 
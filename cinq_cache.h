@@ -69,23 +69,292 @@ struct data_set {
 // if free_data is not 0, all 'data' field in ds will be FREE'ed
 void free_data_set(struct data_set* ds, int free_data);
 
+// Admission policies of the second-tier (L2) cache.
+enum l2_admit_policy {
+    L2_ADMIT_ALL = 0,   // every extent evicted from R-cache
+    L2_ADMIT_REUSED,    // only extents that got hit at least once in R-cache
+};
+
+// Configuration of the L2 tier, a log-structured segment file on local disk.
+struct l2_config {
+    const char *path;       // backing file, created and truncated
+    size_t capacity;        // bytes of the backing file
+    size_t segment_size;    // bytes per log segment, 0 for default
+    size_t max_pending;     // max bytes queued for writing, 0 for default
+    int admit;              // enum l2_admit_policy
+    offset_t admit_max_len; // larger extents are not admitted, 0 for no bound
+};
+
+// eviction policies of R-cache, see rcache_set_policy()
+enum cinq_evict_policy {
+    CINQ_EVICT_LRU = 0,     // least recently used first
+    CINQ_EVICT_GDSF,        // GreedyDual-Size-Frequency: lowest hits / size first
+};
+
+// An independent cache, see cinq_cache_create().
+struct cinq_cache;
+
+// settings of cinq_cache_create()
+struct cinq_config {
+    size_t limit;           // R-cache limit in bytes, 0 for 512M
+    unsigned int slots;     // hash slots of each of R-cache and W-cache, 0 for 1024
+    int policy;             // enum cinq_evict_policy
+};
+
+// public operations whose latencies are tracked
+enum cinq_op {
+    CINQ_OP_RGET,
+    CINQ_OP_RPUT,
+    CINQ_OP_WREAD,
+    CINQ_OP_WWRITE,
+    CINQ_OP_WCOLLECT,
+    CINQ_N_OP
+};
+
+// latency distribution of an operation, in nanoseconds
+struct cinq_latency {
+    unsigned long count;
+    unsigned long p50;
+    unsigned long p99;
+    unsigned long p999;
+    unsigned long max;
+};
+
+// points of the miss ratio curve in struct cinq_stats
+#define CINQ_MRC_POINTS     7
+
+// Snapshot of cache statistics, see cinq_cache_stats().
+struct cinq_stats {
+    // R-cache
+    unsigned long rget;             // rcache_get() calls
+    unsigned long rget_hits;        // ... with the range fully served
+    unsigned long rget_partial;     // ... with the range partly served
+    unsigned long rget_misses;      // ... with nothing served
+    unsigned long rget_lockless;    // hits served without the R-cache lock
+    unsigned long rget_l0;          // hits served from copies of the thread
+    unsigned long rget_bytes;       // bytes returned by rcache_get()
+    unsigned long rput;             // rcache_put() calls let in
+    unsigned long rput_bytes;       // bytes they passed; take-backs from
+                                    // L2 count as l2_hits, not here
+    unsigned long evictions;        // extents evicted
+    unsigned long evicted_bytes;
+    unsigned long l2_spills;        // evicted extents queued to L2
+    unsigned long l2_hits;          // extents taken back from L2
+    unsigned long invalidations;    // rcache_invalidate*() calls
+    unsigned long invalidated_bytes; // stale bytes freed
+    unsigned long admit_rejects;    // rcache_put() calls turned away by TinyLFU
+    unsigned long bg_reclaims;      // extents freed by the background reclaimer
+    unsigned long direct_reclaims;  // rcache_put() calls that hit the limit
+                                    // with the reclaimer running
+    unsigned long rcache_size;      // bytes cached
+    unsigned long rcache_meta;      // bytes of the index, counted against the limit
+    unsigned long rcache_limit;
+    // filled only by cinq_cache_index_stats(), 0 otherwise
+    unsigned long rcache_entries;   // fingerprints cached
+    unsigned long rcache_nodes;     // extents cached
+    unsigned long rcache_depth;     // max depth of the extent trees
+    unsigned long mrc_samples;      // block accesses sampled for the curve
+    unsigned long mrc_size[CINQ_MRC_POINTS];    // 1/8, 1/4, ... 8 times the limit
+    unsigned long mrc_hit_ppm[CINQ_MRC_POINTS]; // predicted hit ratio at each size,
+                                                // in parts per million
+
+    // W-cache
+    unsigned long wread;            // wcache_read() calls
+    unsigned long wwrite;           // wcache_write() calls
+    unsigned long wwrite_bytes;
+    unsigned long wcollect;         // wcache_collect() calls
+    unsigned long wcollect_bytes;
+    unsigned long wsnapshots;       // wcache_snapshot() calls that froze data
+    unsigned long wsnapshot_bytes;  // bytes freed by wcache_snapshot_release()
+    unsigned long wcache_dirty;     // bytes written and not yet collected or released
+    unsigned long wcache_entries;   // as above, by cinq_cache_index_stats()
+    unsigned long wcache_nodes;
+    unsigned long wcache_depth;
+    unsigned long wlog_segments;    // log segments held, spares included
+    unsigned long wlog_compactions; // segments emptied by moving live data
+    unsigned long wlog_moved_bytes;
+    unsigned long wdeferred;        // frees held back for readers in an epoch
+
+    // indexed by enum cinq_op, all zero unless enabled by cinq_latency_enable()
+    struct cinq_latency latency[CINQ_N_OP];
+};
+
+// R-cache usage of one uid, see rcache_tenant_stats()
+struct cinq_tenant_stats {
+    unsigned long uid;
+    unsigned long usage;            // bytes cached on behalf of uid
+    unsigned long quota;            // 0 for none
+    unsigned long weight;
+    unsigned long gets;             // rcache_get() calls by uid
+    unsigned long hits;             // ... with the range fully served
+    unsigned long partial;          // ... with the range partly served
+    unsigned long misses;           // ... with nothing served
+    unsigned long evictions;        // extents of uid evicted
+};
+
+// formats of cinq_cache_stats_dump()
+#define CINQ_STATS_TEXT     0   // one "name value" pair per line
+#define CINQ_STATS_JSON     1   // one flat JSON object
+
 // init cache system
 void rwcache_init(void);
 
+// Attach an L2 tier to R-cache. Extents evicted from R-cache are written
+// to it asynchronously, and R-cache misses are served from it. Extents
+// taken back only fill what R-cache lacks, and are dropped if the file
+// was put or invalidated while they were read.
+// Returns 0 on success, or -1 if the backing file cannot be set up.
+int rcache_l2_enable(const struct l2_config *cfg);
+
+// Detach and destroy the L2 tier; its content is dropped.
+void rcache_l2_disable(void);
+
+// Carve R-cache data from an arena of 'bytes', backed by huge pages when
+// the system has them and by normal pages otherwise. Extents the arena
+// cannot hold fall back to ALLOC. Must be called while R-cache is empty;
+// the arena lives until rwcache_fini().
+// Returns 0 on success, or -1 if the arena cannot be set up.
+int rcache_arena_enable(size_t bytes);
+
+// Switches W-cache to log-structured storage: writes are appended to log
+// segments of segment_bytes and only an index of extents points into them,
+// so overwrites neither copy in place nor allocate. A background thread
+// moves the live data out of segments mostly overwritten or collected.
+// Collects hand over copies. Data returned by wcache_read() outside an
+// epoch also become invalid when their segment is compacted. Must be
+// called while W-cache is empty; the log lives until rwcache_fini().
+// Returns 0 on success, or -1 if W-cache holds data or on failure.
+int wcache_log_enable(size_t segment_bytes);
+
+// Sets the enum cinq_evict_policy of R-cache. Must be called while
+// R-cache is empty; the policy lasts until rwcache_fini(). Uids over their
+// share still lose their least recently used extents first.
+// Returns 0 on success, or -1 if R-cache holds data or policy is unknown.
+int rcache_set_policy(int policy);
+
+// Switches TinyLFU admission of R-cache on with a frequency sketch of
+// width counters per row, or off if width is 0. Once R-cache is full,
+// rcache_put() keeps an extent out unless it was requested more often
+// of late than the extent it would evict, and drops the range from L2.
+// Puts over cached data and extents brought back from L2 are always
+// admitted. A width of a few times the number of extents
+// cached works well. Returns 0 on success, or -1 if out of memory.
+int rcache_tinylfu_enable(size_t width);
+
+// Sets rcache_limit to bytes until rwcache_fini(); the default is 512M.
+// A cut is carried out in steps of a few megabytes, letting other calls
+// run in between; the call returns once R-cache is within the new limit
+// or a later call has changed it. Returns 0, or -1 if bytes is 0.
+int rcache_set_limit(size_t bytes);
+
+// Evicts at least bytes from R-cache, or all of it, in the same steps.
+// The limit stays. This is the hook for memory pressure notifications; in
+// the kernel a shrinker calls it. Returns the bytes freed.
+size_t rcache_shrink(size_t bytes);
+
+// Starts a thread that evicts R-cache extents ahead of demand. It wakes
+// once R-cache uses high_pct percent of rcache_limit and evicts until
+// usage is below low_pct percent; rcache_put() then evicts by itself only
+// when the limit is reached. Requires 0 < low_pct < high_pct < 100.
+// Returns 0 on success, or -1 on bad watermarks, if a reclaimer runs
+// already, or if the thread cannot start. Not available in the kernel.
+int rcache_reclaimer_start(unsigned int low_pct, unsigned int high_pct);
+
+// Stops the reclaimer, evicting down to the limit if it fell behind.
+void rcache_reclaimer_stop(void);
+
+// Switches miss ratio curve estimation on, sampling 1 in sample_1_in of
+// the 4K blocks read by rcache_get(), or off if sample_1_in is 0. The
+// curve gives the hit ratio an LRU R-cache of some size would have had
+// on the blocks read so far, so the limit can be set from it; 100 keeps
+// the cost low and the error within a few percent. Switching on again
+// starts a new curve. Returns 0 on success, or -1 if out of memory.
+int rcache_mrc_enable(unsigned int sample_1_in);
+
+// Predicted hit ratio of an R-cache of bytes, in parts per million;
+// 0 if estimation is off.
+unsigned long rcache_mrc_hit_ppm(size_t bytes);
+
+// Sets the R-cache partition of uid. Extents are charged to the uid that
+// puts them. quota is a hard cap on the bytes of uid, 0 for none. weight
+// sets the share of uid when the cache is full: rcache_limit * weight /
+// the total weight of uids holding data; eviction takes from the uid most
+// over its share first. Uids never set have weight 1 and no quota.
+// Returns 0 on success, or -1 if weight is 0 or out of memory.
+int rcache_set_quota(unsigned long uid, size_t quota, unsigned int weight);
+
+// Fills st with the R-cache usage of uid. Gets are counted only while uid
+// holds data or has a quota or weight set, and the figures of uid are
+// dropped once it holds nothing with neither set.
+// Returns 0 on success, or -1 if uid is unknown.
+int rcache_tenant_stats(unsigned long uid, struct cinq_tenant_stats *st);
+
+// Takes a snapshot of statistics. Counters are summed up from per-thread
+// shards and the locks are held only to read a few sizes, so it is cheap
+// enough to poll. Entry, node and depth figures are left 0.
+void cinq_cache_stats(struct cinq_stats *st);
+
+// Fills the entry, node and depth figures of st, leaving the rest alone.
+// Walks the indexes under the cache locks, blocking puts and writes for
+// O(cached extents); meant for debugging, not for polling.
+void cinq_cache_index_stats(struct cinq_stats *st);
+
+// Switches latency histograms of public operations on or off.
+// Switching on clears them. Build with CINQ_NO_LATENCY to compile them out.
+void cinq_latency_enable(int on);
+
+// Starts recording every public cache call into a binary trace at path,
+// for the replay tool. Returns 0 on success, or -1 if already recording
+// or the file cannot be created.
+int cinq_record_start(const char *path);
+
+// Stops recording and flushes the trace.
+void cinq_record_stop(void);
+
+// Formats a snapshot into buf in CINQ_STATS_TEXT or CINQ_STATS_JSON.
+// Returns the length of the full output like snprintf(), or -1 on a bad
+// format.
+int cinq_cache_stats_dump(const struct cinq_stats *st, int format, char *buf, size_t size);
+
 // finalize cache system
 void rwcache_fini(void);
 
+// An open file, see cinq_open().
+struct cinq_handle;
+
+// Opens fp for the calls ending in _h, which take the returned handle in
+// place of the fingerprint and skip looking it up. The handle pins the
+// index entries of fp until cinq_close(). Handles of the same file may be
+// open at once; each must be closed before rwcache_fini().
+// Returns NULL if out of memory.
+struct cinq_handle *cinq_open(struct fingerprint *fp);
+
+void cinq_close(struct cinq_handle *h);
+
 // Returns data set sorted by offsets of its entries without overlaps.
 // Users take charge of deallocation of returned data.
+// In user space, a range wholly cached is served without the R-cache lock;
+// such hits reach LRU a batch at a time. TinyLFU and the miss ratio curve
+// count every get without the lock too.
 extern struct data_set *rcache_get(struct fingerprint *fp, offset_t offset, offset_t len);
 
 // Add previous non-hit data.
 // Data input are SAFE to free by users after the function returns.
 extern void rcache_put(struct fingerprint *fp, struct data_entry *de);
 
+// Drops R-cache and L2 data overlapping [offset, offset + len), e.g. when
+// the backend object changed. Extents partly in the range are dropped whole.
+extern void rcache_invalidate(struct fingerprint *fp, offset_t offset, offset_t len);
+
+// Drops all R-cache and L2 data of fp in O(1). The data stop being served
+// at once; their memory is freed bit by bit by later puts, or before any
+// live data is evicted.
+extern void rcache_invalidate_file(struct fingerprint *fp);
+
 // Returns data set sorted by offsets of its entries without overlaps.
 // Users should NOT deallocate returned data.
-// They are SAFE to use until wcache_collect() is invoked.
+// They are SAFE to use until wcache_collect() or wcache_snapshot_release()
+// is invoked, or if read inside an epoch, until cinq_epoch_exit().
 extern struct data_set *wcache_read(struct fingerprint *fp, offset_t offset, offset_t len);
 
 // Data input are SAFE to free by users after the function returns.
@@ -96,5 +365,245 @@ extern int wcache_write(struct fingerprint *fp, struct data_entry *de);
 // Return NULL if nothing found.
 extern struct data_set *wcache_collect(struct fingerprint *fp);
 
+// Freezes the dirty extents of fp in O(1) for flushing. Writes from then
+// on go to a fresh tree that collects do not mix with the snapshot, while
+// reads see fresh extents over frozen ones. A file has one snapshot at a
+// time. Returns NULL if fp has no dirty data or a snapshot already.
+struct cinq_snapshot;
+extern struct cinq_snapshot *wcache_snapshot(struct fingerprint *fp);
+
+// Returns the frozen extents. Users should NOT deallocate returned data,
+// and may read them without any lock until the snapshot is released.
+extern struct data_set *wcache_snapshot_data(struct cinq_snapshot *s);
+
+// Frees the snapshot and its data, typically once flushed. Data returned
+// by wcache_read() outside an epoch may come from the snapshot and become
+// invalid too.
+// Snapshots must be released before rwcache_fini().
+extern void wcache_snapshot_release(struct cinq_snapshot *s);
+
+// Variants of the calls above on an open file.
+extern struct data_set *rcache_get_h(struct cinq_handle *h, offset_t offset, offset_t len);
+extern void rcache_put_h(struct cinq_handle *h, struct data_entry *de);
+extern struct data_set *wcache_read_h(struct cinq_handle *h, offset_t offset, offset_t len);
+extern int wcache_write_h(struct cinq_handle *h, struct data_entry *de);
+extern struct data_set *wcache_collect_h(struct cinq_handle *h);
+extern struct cinq_snapshot *wcache_snapshot_h(struct cinq_handle *h);
+
+
+
+// Independent caches. The functions without a cache argument work on a
+// default cache set up by rwcache_init(); each one has a counterpart that
+// takes the cache first, named with a cinq_ prefix, e.g. cinq_rcache_get()
+// for rcache_get(). The exceptions are cinq_cache_open(),
+// cinq_cache_get_stats(), cinq_cache_get_index_stats() and
+// cinq_cache_latency_enable() for cinq_open(), cinq_cache_stats(),
+// cinq_cache_index_stats() and cinq_latency_enable(). Handles remember their
+// cache, so the _h calls have no counterpart. Caches share no state but
+// the recorder and the tracer.
+
+// Creates a cache with cfg, or with the defaults if cfg is NULL.
+// Returns NULL on a bad policy or if out of memory.
+struct cinq_cache *cinq_cache_create(const struct cinq_config *cfg);
+
+// Frees c and all its data; handles of c must be closed before.
+void cinq_cache_destroy(struct cinq_cache *c);
+
+struct cinq_handle *cinq_cache_open(struct cinq_cache *c, struct fingerprint *fp);
+struct data_set *cinq_rcache_get(struct cinq_cache *c, struct fingerprint *fp, offset_t offset, offset_t len);
+void cinq_rcache_put(struct cinq_cache *c, struct fingerprint *fp, struct data_entry *de);
+void cinq_rcache_invalidate(struct cinq_cache *c, struct fingerprint *fp, offset_t offset, offset_t len);
+void cinq_rcache_invalidate_file(struct cinq_cache *c, struct fingerprint *fp);
+struct data_set *cinq_wcache_read(struct cinq_cache *c, struct fingerprint *fp, offset_t offset, offset_t len);
+int cinq_wcache_write(struct cinq_cache *c, struct fingerprint *fp, struct data_entry *de);
+struct data_set *cinq_wcache_collect(struct cinq_cache *c, struct fingerprint *fp);
+struct cinq_snapshot *cinq_wcache_snapshot(struct cinq_cache *c, struct fingerprint *fp);
+int cinq_rcache_l2_enable(struct cinq_cache *c, const struct l2_config *cfg);
+void cinq_rcache_l2_disable(struct cinq_cache *c);
+int cinq_rcache_arena_enable(struct cinq_cache *c, size_t bytes);
+// as cinq_rcache_arena_enable(), preferring the memory of NUMA node 'node'
+int cinq_rcache_arena_enable_on(struct cinq_cache *c, size_t bytes, int node);
+int cinq_wcache_log_enable(struct cinq_cache *c, size_t segment_bytes);
+int cinq_rcache_set_policy(struct cinq_cache *c, int policy);
+int cinq_rcache_tinylfu_enable(struct cinq_cache *c, size_t width);
+int cinq_rcache_mrc_enable(struct cinq_cache *c, unsigned int sample_1_in);
+unsigned long cinq_rcache_mrc_hit_ppm(struct cinq_cache *c, size_t bytes);
+int cinq_rcache_set_limit(struct cinq_cache *c, size_t bytes);
+size_t cinq_rcache_shrink(struct cinq_cache *c, size_t bytes);
+int cinq_rcache_reclaimer_start(struct cinq_cache *c, unsigned int low_pct, unsigned int high_pct);
+void cinq_rcache_reclaimer_stop(struct cinq_cache *c);
+int cinq_rcache_set_quota(struct cinq_cache *c, unsigned long uid, size_t quota, unsigned int weight);
+int cinq_rcache_tenant_stats(struct cinq_cache *c, unsigned long uid, struct cinq_tenant_stats *st);
+void cinq_cache_get_stats(struct cinq_cache *c, struct cinq_stats *st);
+void cinq_cache_get_index_stats(struct cinq_cache *c, struct cinq_stats *st);
+void cinq_cache_latency_enable(struct cinq_cache *c, int on);
+
+// Fills lat, indexed by enum cinq_op, with the latency of the calls on
+// all n caches of cs together, as if they were one cache.
+void cinq_cache_merge_latency(struct cinq_cache *const *cs, int n, struct cinq_latency *lat);
+
+#ifndef __KERNEL__
+
+// Epochs let readers use data returned by wcache_read() without holding
+// anything. Between enter and exit, W-cache memory the data may point into
+// is not freed or changed in place, whatever collects, overwrites,
+// snapshot releases or log compaction do meanwhile; it is freed once every
+// thread inside has left. While any thread is inside, collects hand over
+// copies and overwrites copy the extents they change. Epochs nest and
+// cover all caches. Enter returns 0, or -1 if out of memory.
+int cinq_epoch_enter(void);
+void cinq_epoch_exit(void);
+
+// Gives every thread calling rcache_get() a direct-mapped table of slots
+// copies of extents it got, up to max_len bytes each, or takes the tables
+// out of use if slots is 0. slots is rounded up to a power of two. A get
+// of the same range that a copy answered last is served from it with no
+// lock, unless a put, an eviction or an invalidation has touched the file
+// since; every 32nd such hit goes to R-cache to keep the extent warm
+// there. Such hits write no shared memory but the counters of TinyLFU and
+// the miss ratio curve, if on. Only gets wholly served by one extent are
+// copied.
+// Hits on copies are counted in cinq_stats, not in tenant statistics.
+// Threads use up to slots * max_len bytes each, freed when they exit.
+// Returns 0 on success, or -1 if max_len is 0 or out of memory.
+int rcache_l0_enable(unsigned int slots, size_t max_len);
+int cinq_rcache_l0_enable(struct cinq_cache *c, unsigned int slots, size_t max_len);
+
+// Asynchronous calls, in the manner of io_uring. The caller fills
+// submission entries from cinq_get_sqe() and hands them over in one batch
+// with cinq_submit(); worker threads of the ring run them and post one
+// completion entry each, reaped with cinq_reap(). One thread drives a ring.
+
+// submission entry
+struct cinq_sqe {
+    int op;                         // enum cinq_op
+    struct fingerprint fp;
+    struct cinq_handle *handle;     // used in place of fp if not NULL
+    struct data_entry de;           // range, and data of puts and writes;
+                                    // data must stay valid until completion
+    unsigned long user_data;        // copied to the completion
+};
+
+// completion entry
+struct cinq_cqe {
+    unsigned long user_data;
+    int res;                        // wcache_write() result, 0 for other ops,
+                                    // -1 for an unknown op
+    struct data_set *ds;            // result of gets, reads and collects
+};
+
+struct cinq_ring;
+
+// Creates a ring for up to 'entries' operations in flight, rounded up to
+// a power of two, run by 'workers' threads. Returns NULL on failure.
+struct cinq_ring *cinq_ring_create(unsigned int entries, int workers);
+
+// Waits for submitted operations to run, then stops the workers.
+// Completions not reaped are dropped along with their data sets.
+void cinq_ring_destroy(struct cinq_ring *r);
+
+// Returns a free submission entry, or NULL if 'entries' operations are
+// already in flight or waiting to be reaped.
+struct cinq_sqe *cinq_get_sqe(struct cinq_ring *r);
+
+// Hands the entries got since the last call to the workers.
+// Returns the number submitted.
+unsigned int cinq_submit(struct cinq_ring *r);
+
+// Moves up to max completions into cqes, waiting until at least min are
+// there. Returns the number moved.
+unsigned int cinq_reap(struct cinq_ring *r, struct cinq_cqe *cqes, unsigned int max, unsigned int min);
+
+// An eventfd that turns readable when completions are posted, for event
+// loops; reading it is up to the caller. -1 if eventfd is not available.
+int cinq_ring_fd(struct cinq_ring *r);
+
+
+// Watches a PSI file, such as /proc/pressure/memory or the memory.pressure
+// file of a cgroup, and calls rcache_shrink(shrink_bytes) each time memory
+// stalls reach stall_us within window_us, as in a "some" PSI trigger.
+// path NULL stands for /proc/pressure/memory. Returns 0 on success, or -1
+// if a monitor runs already or the kernel refuses the trigger.
+int cinq_psi_start(const char *path, unsigned int stall_us, unsigned int window_us,
+                   size_t shrink_bytes);
+
+// Stops the PSI monitor.
+void cinq_psi_stop(void);
+
+
+// NUMA mode: one cache per node, called a shard, whose R-cache data come
+// from an arena on that node. R-cache puts go to the shard of the calling
+// thread's node, after the range is dropped from the other shards; gets
+// look there first and then in the other shards, and invalidations reach
+// every shard. The W-cache of a file lives in one
+// shard chosen by its fingerprint, so writers on any node see each other.
+// On a single node, or if the node layout cannot be read, there is one
+// shard and no binding.
+
+#define CINQ_NUMA_MAX_NODES     64
+
+struct cinq_numa;
+
+// traffic of the threads running on one node
+struct cinq_node_stats {
+    int node;                       // NUMA node id
+    unsigned long rget;             // cinq_numa_rcache_get() calls
+    unsigned long local_hits;       // ... fully served by the shard of this node
+    unsigned long remote_hits;      // ... fully served, with other nodes' help
+    unsigned long partial;          // ... with the range partly served
+    unsigned long misses;
+    unsigned long local_bytes;      // bytes returned from this node
+    unsigned long remote_bytes;     // bytes copied across nodes
+    unsigned long rput;             // cinq_numa_rcache_put() calls
+    unsigned long rput_bytes;
+};
+
+// Creates a shard with cfg for every node with both CPUs and memory.
+// arena_bytes, if not 0, is the size of the arena of each shard.
+// Returns NULL if a shard cannot be set up.
+struct cinq_numa *cinq_numa_create(const struct cinq_config *cfg, size_t arena_bytes);
+
+void cinq_numa_destroy(struct cinq_numa *n);
+
+int cinq_numa_shards(struct cinq_numa *n);
+
+// The cache of shard i, for settings and cinq_cache_get_stats(). Its
+// counters cover lookups in the shard, whichever node they came from.
+struct cinq_cache *cinq_numa_shard(struct cinq_numa *n, int i);
+
+// Fills st with the traffic of the threads on the node of shard i.
+// Returns 0 on success, or -1 if there is no shard i.
+int cinq_numa_node_stats(struct cinq_numa *n, int i, struct cinq_node_stats *st);
+
+// Switches latency histograms on or off in every shard.
+void cinq_numa_latency_enable(struct cinq_numa *n, int on);
+
+// Fills lat, indexed by enum cinq_op, with the latency of all shards together.
+void cinq_numa_latency(struct cinq_numa *n, struct cinq_latency *lat);
+
+// Serves each byte of the range from the nearest shard holding it, asking
+// shards in turn until the range is covered. Entries are in offset order.
+// Returns NULL if no shard holds any of the range.
+struct data_set *cinq_numa_rcache_get(struct cinq_numa *n, struct fingerprint *fp, offset_t offset, offset_t len);
+
+// Puts into the shard of the caller's node, dropping the copies of the
+// range on the other nodes. Puts of a file are serialized across nodes,
+// so that only the last one leaves a copy behind.
+void cinq_numa_rcache_put(struct cinq_numa *n, struct fingerprint *fp, struct data_entry *de);
+void cinq_numa_rcache_invalidate(struct cinq_numa *n, struct fingerprint *fp, offset_t offset, offset_t len);
+void cinq_numa_rcache_invalidate_file(struct cinq_numa *n, struct fingerprint *fp);
+struct data_set *cinq_numa_wcache_read(struct cinq_numa *n, struct fingerprint *fp, offset_t offset, offset_t len);
+int cinq_numa_wcache_write(struct cinq_numa *n, struct fingerprint *fp, struct data_entry *de);
+struct data_set *cinq_numa_wcache_collect(struct cinq_numa *n, struct fingerprint *fp);
+struct cinq_snapshot *cinq_numa_wcache_snapshot(struct cinq_numa *n, struct fingerprint *fp);
+
+#ifdef CINQ_NUMA_FAKE_NODES
+// For tests: the calling thread acts as if on the node of shard i, or on
+// that of its CPU again if i is -1.
+void cinq_numa_fake_shard(int i);
+#endif // CINQ_NUMA_FAKE_NODES
+
+#endif // __KERNEL__
+
 
 #endif // CINQAIN_CACHE_H_
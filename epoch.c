@@ -0,0 +1,234 @@
+/*
+ * Copyright (C) 2012 Yang Zhang <yang.zhang@stanzax.org>
+ * Copyright (C) 2012 Jinglei Ren <jinglei.ren@stanzax.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "epoch.h"
+
+#include <stdlib.h>
+#include <limits.h>
+#include <pthread.h>
+
+
+struct epoch_rec {
+    struct list_head entry;
+    unsigned long epoch;    // global epoch when entered, 0 if outside
+    unsigned long pin;      // the same for epoch_pin()
+    int nest;
+    int pin_nest;
+    int unowned;            // the owner has exited, free for reuse
+} __attribute__((aligned(64)));
+
+struct retired {
+    struct list_head entry;
+    unsigned long epoch;
+    epoch_free_f fn;
+    void *arg;
+    void *p;
+    size_t len;
+};
+
+int epoch_active = 0;
+
+static unsigned long epoch_global = 1;
+
+// all records ever handed out, guarded by epoch_lock
+static LIST_HEAD(epoch_recs);
+static pthread_mutex_t epoch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread struct epoch_rec *my_rec = NULL;
+
+// hands records of exiting threads back
+static pthread_key_t epoch_key;
+static pthread_once_t epoch_key_once = PTHREAD_ONCE_INIT;
+
+
+static void epoch_rec_release(void *arg) {
+    struct epoch_rec *r = (struct epoch_rec *) arg;
+    pthread_mutex_lock(&epoch_lock);
+    r->unowned = 1;
+    pthread_mutex_unlock(&epoch_lock);
+}
+
+static void epoch_key_init(void) {
+    pthread_key_create(&epoch_key, epoch_rec_release);
+}
+
+
+static struct epoch_rec *epoch_rec_new(void) {
+    struct epoch_rec *r;
+    pthread_once(&epoch_key_once, epoch_key_init);
+
+    pthread_mutex_lock(&epoch_lock);
+    list_for_each_entry(r, &epoch_recs, entry) {
+        if (r->unowned) {
+            r->unowned = 0;
+            goto out;
+        }
+    }
+    if (posix_memalign((void **) &r, 64, sizeof(struct epoch_rec)) != 0) {
+        pthread_mutex_unlock(&epoch_lock);
+        return NULL;
+    }
+    r->epoch = 0;
+    r->pin = 0;
+    r->nest = 0;
+    r->pin_nest = 0;
+    r->unowned = 0;
+    list_add(&r->entry, &epoch_recs);
+out:
+    pthread_mutex_unlock(&epoch_lock);
+    pthread_setspecific(epoch_key, r);
+    return r;
+}
+
+
+// the oldest epoch a thread is in, or has pinned if pins, ULONG_MAX if none
+static unsigned long epoch_safe(int pins) {
+    unsigned long safe = ULONG_MAX;
+    struct epoch_rec *r;
+    // pairs with the fence in epoch_pin(): a reader not seen inside sees
+    // what was unlinked before
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    pthread_mutex_lock(&epoch_lock);
+    list_for_each_entry(r, &epoch_recs, entry) {
+        unsigned long e = __atomic_load_n(pins ? &r->pin : &r->epoch, __ATOMIC_SEQ_CST);
+        if (e && e < safe) {
+            safe = e;
+        }
+    }
+    pthread_mutex_unlock(&epoch_lock);
+    return safe;
+}
+
+
+int cinq_epoch_enter(void) {
+    struct epoch_rec *r = my_rec;
+    if (r == NULL) {
+        r = my_rec = epoch_rec_new();
+        if (r == NULL) {
+            return -1;
+        }
+    }
+    if (r->nest++ == 0) {
+        // counted before the epoch is read, so a retirement either sees us
+        // or stamps past the epoch we read
+        __atomic_fetch_add(&epoch_active, 1, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&r->epoch, __atomic_load_n(&epoch_global, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+    }
+    return 0;
+}
+
+
+void cinq_epoch_exit(void) {
+    struct epoch_rec *r = my_rec;
+    if (--r->nest == 0) {
+        __atomic_store_n(&r->epoch, 0, __ATOMIC_RELEASE);
+        __atomic_fetch_sub(&epoch_active, 1, __ATOMIC_RELEASE);
+    }
+}
+
+
+int epoch_pin(void) {
+    struct epoch_rec *r = my_rec;
+    if (r == NULL) {
+        r = my_rec = epoch_rec_new();
+        if (r == NULL) {
+            return -1;
+        }
+    }
+    if (r->pin_nest++ == 0) {
+        __atomic_store_n(&r->pin, __atomic_load_n(&epoch_global, __ATOMIC_SEQ_CST), __ATOMIC_RELAXED);
+        // the epoch is visible before anything is read
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+    return 0;
+}
+
+
+void epoch_unpin(void) {
+    struct epoch_rec *r = my_rec;
+    if (--r->pin_nest == 0) {
+        __atomic_store_n(&r->pin, 0, __ATOMIC_RELEASE);
+    }
+}
+
+
+void epoch_limbo_init(struct epoch_limbo *lb, int pins) {
+    INIT_LIST_HEAD(&lb->list);
+    lb->pending = 0;
+    lb->pins = pins;
+}
+
+
+// Queues p on lb, or returns 0 if out of memory.
+static int limbo_add(struct epoch_limbo *lb, void *p, size_t len, epoch_free_f fn, void *arg) {
+    struct retired *x = (struct retired *) malloc(sizeof(struct retired));
+    if (x == NULL) {
+        return 0;
+    }
+    x->epoch = __atomic_fetch_add(&epoch_global, 1, __ATOMIC_SEQ_CST);
+    x->fn = fn;
+    x->arg = arg;
+    x->p = p;
+    x->len = len;
+    list_add_tail(&x->entry, &lb->list);
+    lb->pending++;
+    return 1;
+}
+
+
+int epoch_retire(struct epoch_limbo *lb, void *p, size_t len, epoch_free_f fn, void *arg) {
+    if (!epoch_readers()) {
+        fn(arg, p, len);
+        return 0;
+    }
+    if (!limbo_add(lb, p, len, fn, arg)) {
+        // Readers may hold p, and may wait for the lock our caller holds,
+        // so neither freeing nor waiting them out is safe; p is leaked.
+        return 1;
+    }
+    if (lb->pending >= EPOCH_REAP_BATCH) {
+        epoch_reap(lb, 0);
+    }
+    return 1;
+}
+
+
+int epoch_defer(struct epoch_limbo *lb, void *p, size_t len, epoch_free_f fn, void *arg) {
+    if (!limbo_add(lb, p, len, fn, arg)) {
+        // as in epoch_retire(), waiting out pins under our caller's lock
+        // may never end; p is leaked
+        return -1;
+    }
+    return 0;
+}
+
+
+void epoch_reap(struct epoch_limbo *lb, int all) {
+    unsigned long safe = all ? ULONG_MAX : epoch_safe(lb->pins);
+    struct retired *x, *tmp;
+
+    list_for_each_entry_safe(x, tmp, &lb->list, entry) {
+        if (x->epoch >= safe) {
+            break; // stamps only grow along the list
+        }
+        list_del(&x->entry);
+        lb->pending--;
+        x->fn(x->arg, x->p, x->len);
+        free(x);
+    }
+}
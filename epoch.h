@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2012 Yang Zhang <yang.zhang@stanzax.org>
+ * Copyright (C) 2012 Jinglei Ren <jinglei.ren@stanzax.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+//
+//  epoch.h
+//  Cinquain Cache
+//
+//  Epoch-based reclamation of W-cache data handed out to readers.
+//
+//  A reader thread enters an epoch around its use of returned pointers.
+//  Memory they may point to is not freed but retired to a limbo list,
+//  stamped with the global epoch, which each retirement advances. An
+//  entry is freed once every reader inside an epoch entered after its
+//  stamp. While no reader is inside, retiring frees at once.
+//
+//  Readers inside the library pin instead, in epochs of their own: a limbo
+//  list waits either for readers or for pins, never for both.
+//
+
+#ifndef CINQUAIN_EPOCH_H_
+#define CINQUAIN_EPOCH_H_
+
+#include "cinq_cache.h"
+
+// pending entries that make a retirement try to free the list
+#define EPOCH_REAP_BATCH    64
+
+// Frees p of len; arg is as given to epoch_retire().
+typedef void (*epoch_free_f)(void *arg, void *p, size_t len);
+
+struct epoch_limbo {
+    struct list_head list;      // oldest first
+    unsigned long pending;
+    int pins;                   // waits for pins rather than readers
+};
+
+#ifdef __KERNEL__
+
+// no readers outside the cache locks in kernel mode
+#define epoch_readers()     0
+static inline void epoch_limbo_init(struct epoch_limbo *lb, int pins) { INIT_LIST_HEAD(&lb->list); lb->pending = 0; lb->pins = pins; }
+static inline int epoch_retire(struct epoch_limbo *lb, void *p, size_t len, epoch_free_f fn, void *arg) { fn(arg, p, len); return 0; }
+static inline void epoch_reap(struct epoch_limbo *lb, int all) { }
+static inline int epoch_defer(struct epoch_limbo *lb, void *p, size_t len, epoch_free_f fn, void *arg) { fn(arg, p, len); return 0; }
+static inline int epoch_pin(void) { return 0; }
+static inline void epoch_unpin(void) { }
+
+#else // user space
+
+extern int epoch_active;
+
+// Non-zero if any thread is inside an epoch. Read under the lock that
+// serializes retirements, it is exact for readers that got their pointers
+// under that lock.
+#define epoch_readers()     __atomic_load_n(&epoch_active, __ATOMIC_SEQ_CST)
+
+// Sets up lb for epoch_retire() if pins is 0, or for epoch_defer().
+void epoch_limbo_init(struct epoch_limbo *lb, int pins);
+
+// Frees p by fn at once if no reader is inside an epoch, otherwise once
+// all current readers have left; if out of memory then, p is never freed.
+// The caller serializes calls on lb. Returns 1 if the free is deferred.
+int epoch_retire(struct epoch_limbo *lb, void *p, size_t len, epoch_free_f fn, void *arg);
+
+// Frees what no reader, or no pin for a list of epoch_defer(), can see
+// any more, or everything if all.
+void epoch_reap(struct epoch_limbo *lb, int all);
+
+// Like epoch_retire(), but waits for pins rather than readers, and always
+// for the next epoch_reap(), as pins are not counted. Returns 0, or -1 if
+// out of memory, when p is never freed.
+int epoch_defer(struct epoch_limbo *lb, void *p, size_t len, epoch_free_f fn, void *arg);
+
+// Enter and exit an epoch for readers inside the library, which see only
+// memory handed to epoch_defer(). They are cheaper than cinq_epoch_enter()
+// as no shared counter is written, and neither waits for the other. Pin
+// returns 0, or -1 if out of memory.
+int epoch_pin(void);
+void epoch_unpin(void);
+
+#endif // __KERNEL__
+
+#endif // CINQUAIN_EPOCH_H_
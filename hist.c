@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2012 Yang Zhang <yang.zhang@stanzax.org>
+ * Copyright (C) 2012 Jinglei Ren <jinglei.ren@stanzax.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "hist.h"
+
+#ifndef __KERNEL__
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#endif // __KERNEL__
+
+
+#if !defined(__KERNEL__) && (defined(__x86_64__) || defined(__i386__))
+
+// TSC ticks are calibrated against the monotonic clock over the time
+// elapsed since the first hist_clock_init(), so no calibration loop is
+// needed and the estimate keeps improving.
+static unsigned long tick0, ns0;
+static pthread_once_t clock_once = PTHREAD_ONCE_INIT;
+
+static unsigned long mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static void clock_start(void) {
+    ns0 = mono_ns();
+    tick0 = hist_now();
+}
+
+void hist_clock_init(void) {
+    pthread_once(&clock_once, clock_start);
+}
+
+double hist_ns_per_tick(void) {
+    unsigned long ticks = hist_now() - tick0;
+    unsigned long ns = mono_ns() - ns0;
+    if (ticks == 0 || ns == 0) {
+        return 1.0;
+    }
+    return (double) ns / ticks;
+}
+
+#else
+
+// ticks are nanoseconds already
+void hist_clock_init(void) {
+}
+
+double hist_ns_per_tick(void) {
+    return 1.0;
+}
+
+#endif
+
+
+unsigned long hist_bucket_top(int b) {
+    if (b < HIST_SUB) {
+        return b;
+    }
+    int shift = b / HIST_SUB - 1;
+    unsigned long low = (unsigned long) (HIST_SUB + b % HIST_SUB) << shift;
+    return low + (1UL << shift) - 1;
+}
+
+
+void hist_merge(struct hist *dst, const struct hist *src) {
+    int b;
+    for (b = 0; b < HIST_N_BUCKET; b++) {
+        dst->count[b] += __atomic_load_n(&src->count[b], __ATOMIC_RELAXED);
+    }
+    unsigned long max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+    if (max > dst->max) {
+        dst->max = max;
+    }
+}
+
+
+void hist_clear(struct hist *h) {
+    memset(h, 0, sizeof(struct hist));
+}
+
+
+void hist_summary(const struct hist *h, struct cinq_latency *lat) {
+    static const double q[3] = { 0.5, 0.99, 0.999 };
+    unsigned long *out[3] = { &lat->p50, &lat->p99, &lat->p999 };
+    double scale = hist_ns_per_tick();
+    unsigned long total = 0, seen = 0;
+    int b, i = 0;
+
+    for (b = 0; b < HIST_N_BUCKET; b++) {
+        total += h->count[b];
+    }
+    lat->count = total;
+    lat->p50 = lat->p99 = lat->p999 = 0;
+    lat->max = (unsigned long) (h->max * scale);
+    if (total == 0) {
+        return;
+    }
+
+    for (b = 0; b < HIST_N_BUCKET && i < 3; b++) {
+        seen += h->count[b];
+        while (i < 3 && seen >= q[i] * total) {
+            unsigned long top = hist_bucket_top(b);
+            if (top > h->max) {
+                top = h->max;
+            }
+            *out[i++] = (unsigned long) (top * scale);
+        }
+    }
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2012 Yang Zhang <yang.zhang@stanzax.org>
+ * Copyright (C) 2012 Jinglei Ren <jinglei.ren@stanzax.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+//
+//  hist.h
+//  Cinquain Cache
+//
+//  Log-linear latency histograms in the manner of HdrHistogram.
+//
+//  Values are clock ticks. Each power of two is split into HIST_SUB linear
+//  buckets, so any recorded value is off by less than 1/HIST_SUB.
+//  Ticks come from the TSC on x86 and from the monotonic clock elsewhere;
+//  they are converted to nanoseconds only when percentiles are read.
+//
+
+#ifndef CINQUAIN_HIST_H_
+#define CINQUAIN_HIST_H_
+
+#include "cinq_cache.h"
+
+#define HIST_SUB_BITS   4
+#define HIST_SUB        (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS   40  // values up to 2^40 ticks, longer ones saturate
+#define HIST_N_BUCKET   ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct hist {
+    unsigned long count[HIST_N_BUCKET];
+    unsigned long max;
+} __attribute__((aligned(64)));
+
+
+#ifdef __KERNEL__
+
+#include <linux/sched/clock.h>
+static inline unsigned long hist_now(void) { return local_clock(); }
+
+#elif defined(__x86_64__) || defined(__i386__)
+
+#include <x86intrin.h>
+static inline unsigned long hist_now(void) { return __rdtsc(); }
+
+#else
+
+#include <time.h>
+static inline unsigned long hist_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+#endif // __KERNEL__
+
+
+static inline int hist_bucket(unsigned long v) {
+    if (v < HIST_SUB) {
+        return (int) v;
+    }
+    int msb = 63 - __builtin_clzl(v);
+    if (msb >= HIST_MAX_BITS) {
+        return HIST_N_BUCKET - 1;
+    }
+    int shift = msb - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB + (int) ((v >> shift) & (HIST_SUB - 1));
+}
+
+// Only the owner shard writes a histogram; relaxed atomics keep sums sane
+// when threads outnumber shards.
+static inline void hist_record(struct hist *h, unsigned long v) {
+    __atomic_fetch_add(&h->count[hist_bucket(v)], 1, __ATOMIC_RELAXED);
+    if (v > __atomic_load_n(&h->max, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&h->max, v, __ATOMIC_RELAXED);
+    }
+}
+
+// The highest value falling in bucket b.
+unsigned long hist_bucket_top(int b);
+
+// Adds src to dst.
+void hist_merge(struct hist *dst, const struct hist *src);
+
+void hist_clear(struct hist *h);
+
+// Fills count and the percentiles of lat in nanoseconds.
+void hist_summary(const struct hist *h, struct cinq_latency *lat);
+
+// Starts the tick-to-nanosecond calibration; later calls do nothing.
+void hist_clock_init(void);
+
+// Nanoseconds per tick, as calibrated so far.
+double hist_ns_per_tick(void);
+
+#endif // CINQUAIN_HIST_H_
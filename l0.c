@@ -0,0 +1,275 @@
+/*
+ * Copyright (C) 2012 Yang Zhang <yang.zhang@stanzax.org>
+ * Copyright (C) 2012 Jinglei Ren <jinglei.ren@stanzax.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "l0.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+
+struct l0_slot {
+    char fp[FINGERPRINT_BYTES];
+    offset_t offset;            // the range got
+    offset_t len;
+    offset_t ext_offset;        // the extent that served it
+    offset_t ext_len;
+    unsigned long gen;          // of the file when the extent was looked up
+    unsigned int hits;
+    int valid;
+    char *data;                 // max_len bytes, NULL until first filled
+};
+
+// the table of one thread for one cache
+struct l0_table {
+    struct list_head entry;
+    unsigned long id;
+    unsigned int slots;
+    size_t max_len;
+    struct l0_slot *slot;
+};
+
+static unsigned long l0_next_id = 0;
+
+// caches with L0, guarded by l0_lock
+static LIST_HEAD(l0_live);
+static pthread_mutex_t l0_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// caches destroyed so far; a thread that has seen fewer sweeps its tables
+static unsigned long l0_dead = 0;
+
+// tables of this thread, one per cache used
+static __thread struct list_head *my_tables = NULL;
+static __thread unsigned long my_dead = 0;
+
+// frees tables of exiting threads
+static pthread_key_t l0_key;
+static pthread_once_t l0_key_once = PTHREAD_ONCE_INIT;
+
+
+static void table_free(struct l0_table *t) {
+    unsigned int i;
+    for (i = 0; i < t->slots; i++) {
+        free(t->slot[i].data);
+    }
+    free(t->slot);
+    free(t);
+}
+
+static void l0_tables_release(void *arg) {
+    struct list_head *tables = (struct list_head *) arg;
+    struct l0_table *t, *tmp;
+    list_for_each_entry_safe(t, tmp, tables, entry) {
+        list_del(&(t->entry));
+        table_free(t);
+    }
+    free(tables);
+}
+
+static void l0_key_init(void) {
+    pthread_key_create(&l0_key, l0_tables_release);
+}
+
+
+// frees the tables of this thread for caches destroyed since the last sweep
+static void sweep_tables(void) {
+    struct l0_table *t, *tmp;
+    struct l0 *l;
+
+    pthread_mutex_lock(&l0_lock);
+    my_dead = __atomic_load_n(&l0_dead, __ATOMIC_RELAXED);
+    list_for_each_entry_safe(t, tmp, my_tables, entry) {
+        int live = 0;
+        list_for_each_entry(l, &l0_live, entry) {
+            if (l->id == t->id) {
+                live = 1;
+                break;
+            }
+        }
+        if (!live) {
+            list_del(&(t->entry));
+            table_free(t);
+        }
+    }
+    pthread_mutex_unlock(&l0_lock);
+}
+
+
+// the table of this thread for l, made anew if the size of l changed
+static struct l0_table *my_table(struct l0 *l, unsigned int slots) {
+    size_t max_len = __atomic_load_n(&(l->max_len), __ATOMIC_RELAXED);
+    struct l0_table *t;
+
+    if (my_tables == NULL) {
+        pthread_once(&l0_key_once, l0_key_init);
+        my_tables = (struct list_head *) malloc(sizeof(struct list_head));
+        if (my_tables == NULL) {
+            return NULL;
+        }
+        INIT_LIST_HEAD(my_tables);
+        pthread_setspecific(l0_key, my_tables);
+        my_dead = __atomic_load_n(&l0_dead, __ATOMIC_RELAXED);
+    } else if (__atomic_load_n(&l0_dead, __ATOMIC_RELAXED) != my_dead) {
+        sweep_tables();
+    }
+    list_for_each_entry(t, my_tables, entry) {
+        if (t->id == l->id) {
+            if (t->slots == slots && t->max_len == max_len) {
+                return t;
+            }
+            list_del(&(t->entry));
+            table_free(t);
+            break;
+        }
+    }
+
+    t = (struct l0_table *) malloc(sizeof(struct l0_table));
+    if (t == NULL) {
+        return NULL;
+    }
+    t->slot = (struct l0_slot *) calloc(slots, sizeof(struct l0_slot));
+    if (t->slot == NULL) {
+        free(t);
+        return NULL;
+    }
+    t->id = l->id;
+    t->slots = slots;
+    t->max_len = max_len;
+    list_add(&(t->entry), my_tables);
+    return t;
+}
+
+static struct l0_slot *slot_of(struct l0_table *t, struct fingerprint *fp, offset_t offset, offset_t len) {
+    unsigned long h = 14695981039346656037UL;
+    int i;
+    for (i = 0; i < FINGERPRINT_BYTES; i++) {
+        h = (h ^ (unsigned char) fp->value[i]) * 1099511628211UL;
+    }
+    h = (h ^ offset) * 0x9e3779b97f4a7c15UL;
+    h = (h ^ len) * 0x9e3779b97f4a7c15UL;
+    return &t->slot[(h >> 32) & (t->slots - 1)];
+}
+
+
+struct l0 *l0_create(void) {
+    struct l0 *l = (struct l0 *) calloc(1, sizeof(struct l0));
+    if (l) {
+        l->id = __atomic_add_fetch(&l0_next_id, 1, __ATOMIC_RELAXED);
+        pthread_mutex_lock(&l0_lock);
+        list_add(&(l->entry), &l0_live);
+        pthread_mutex_unlock(&l0_lock);
+    }
+    return l;
+}
+
+void l0_destroy(struct l0 *l) {
+    pthread_mutex_lock(&l0_lock);
+    list_del(&(l->entry));
+    __atomic_fetch_add(&l0_dead, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&l0_lock);
+    if (my_tables) {
+        sweep_tables();
+    }
+    free(l);
+}
+
+
+unsigned int l0_my_tables(void) {
+    struct l0_table *t;
+    unsigned int n = 0;
+    if (my_tables) {
+        list_for_each_entry(t, my_tables, entry) {
+            n++;
+        }
+    }
+    return n;
+}
+
+
+struct data_set *l0_get(struct l0 *l, struct fingerprint *fp, offset_t offset, offset_t len, unsigned long *gen) {
+    unsigned int slots = __atomic_load_n(&(l->slots), __ATOMIC_RELAXED);
+    if (slots == 0) {
+        return NULL;
+    }
+    // pairs with l0_bump(): a copy filled under this generation was
+    // looked up before any change made since
+    *gen = __atomic_load_n(l0_gen(l, fp), __ATOMIC_ACQUIRE);
+
+    struct l0_table *t = my_table(l, slots);
+    if (t == NULL) {
+        return NULL;
+    }
+    struct l0_slot *s = slot_of(t, fp, offset, len);
+    if (!s->valid || s->gen != *gen || s->offset != offset || s->len != len
+        || memcmp(s->fp, fp->value, FINGERPRINT_BYTES) != 0) {
+        return NULL;
+    }
+    if (++s->hits % L0_REFRESH == 0) {
+        return NULL;
+    }
+
+    struct data_set *ds = (struct data_set *) malloc(sizeof(struct data_set));
+    struct data_entry *de = (struct data_entry *) malloc(sizeof(struct data_entry));
+    char *data = (char *) malloc(s->ext_len);
+    if (ds == NULL || de == NULL || data == NULL) {
+        free(ds);
+        free(de);
+        free(data);
+        return NULL;
+    }
+    memcpy(data, s->data, s->ext_len);
+    de->data = data;
+    de->offset = s->ext_offset;
+    de->len = s->ext_len;
+    INIT_LIST_HEAD(&(ds->entries));
+    list_add(&(de->entry), &(ds->entries));
+    return ds;
+}
+
+
+void l0_fill(struct l0 *l, struct fingerprint *fp, offset_t offset, offset_t len, unsigned long gen, struct data_set *ds) {
+    unsigned int slots = __atomic_load_n(&(l->slots), __ATOMIC_RELAXED);
+    if (slots == 0 || ds == NULL || len == 0 || !list_is_singular(&(ds->entries))) {
+        return;
+    }
+    struct data_entry *de = list_first_entry(&(ds->entries), struct data_entry, entry);
+    if (de->offset > offset || de->offset + de->len < offset + len) {
+        return;
+    }
+
+    struct l0_table *t = my_table(l, slots);
+    if (t == NULL || de->len > t->max_len) {
+        return;
+    }
+    struct l0_slot *s = slot_of(t, fp, offset, len);
+    if (s->data == NULL) {
+        s->data = (char *) malloc(t->max_len);
+        if (s->data == NULL) {
+            return;
+        }
+    }
+    memcpy(s->fp, fp->value, FINGERPRINT_BYTES);
+    s->offset = offset;
+    s->len = len;
+    s->ext_offset = de->offset;
+    s->ext_len = de->len;
+    memcpy(s->data, de->data, de->len);
+    s->gen = gen;
+    s->hits = 0;
+    s->valid = 1;
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2012 Yang Zhang <yang.zhang@stanzax.org>
+ * Copyright (C) 2012 Jinglei Ren <jinglei.ren@stanzax.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+//
+//  l0.h
+//  Cinquain Cache
+//
+//  A direct-mapped front cache in each thread for the hottest small
+//  extents of R-cache.
+//
+//  Every thread keeps its own table of copies, keyed by fingerprint,
+//  offset and length, so hits take no lock and write nothing shared.
+//  Copies stay valid through generation numbers: R-cache bumps the one of
+//  a file after every change to its extents, and a copy made under an
+//  older generation is not served. Files share generations by hash, so a
+//  collision only costs a miss.
+//
+//  Tables of a destroyed cache are freed by each thread at its next use of
+//  L0, or at its exit.
+//
+
+#ifndef CINQUAIN_L0_H_
+#define CINQUAIN_L0_H_
+
+#include "cinq_cache.h"
+
+// generation numbers per cache
+#define L0_GENS         4096
+
+// slots per thread at most
+#define L0_MAX_SLOTS    (1U << 20)
+
+// every this many hits of a copy go to R-cache, to keep the extent warm
+// in its LRU
+#define L0_REFRESH      32
+
+struct l0 {
+    struct list_head entry;     // in the list of live caches
+    unsigned long id;           // tells the tables of threads apart
+    unsigned int slots;         // a power of 2 per thread, 0 if off
+    size_t max_len;             // longest extent copied
+    unsigned long gens[L0_GENS];
+};
+
+static inline unsigned long *l0_gen(struct l0 *l, struct fingerprint *fp) {
+    unsigned int h = 2166136261U;
+    int i;
+    for (i = 0; i < FINGERPRINT_BYTES; i++) {
+        h = (h ^ (unsigned char) fp->value[i]) * 16777619U;
+    }
+    return &l->gens[h % L0_GENS];
+}
+
+// Invalidates the copies of fp in every thread; call after the change.
+static inline void l0_bump(struct l0 *l, struct fingerprint *fp) {
+    __atomic_fetch_add(l0_gen(l, fp), 1, __ATOMIC_RELEASE);
+}
+
+#ifdef __KERNEL__
+
+static inline struct l0 *l0_create(void) { return NULL; }
+static inline void l0_destroy(struct l0 *l) { }
+static inline struct data_set *l0_get(struct l0 *l, struct fingerprint *fp, offset_t offset, offset_t len, unsigned long *gen) { return NULL; }
+static inline void l0_fill(struct l0 *l, struct fingerprint *fp, offset_t offset, offset_t len, unsigned long gen, struct data_set *ds) { }
+
+#else // user space
+
+// Creates the shared part, off until slots are set. Returns NULL if out
+// of memory.
+struct l0 *l0_create(void);
+
+// Frees the shared part, and the table of the calling thread; tables of
+// other threads go at their next l0_get() or l0_fill(), or exit.
+void l0_destroy(struct l0 *l);
+
+// Returns a copy of the data set last filled for the range if still
+// valid, or NULL. Sets *gen to the generation to fill with after a
+// lookup in R-cache.
+struct data_set *l0_get(struct l0 *l, struct fingerprint *fp, offset_t offset, offset_t len, unsigned long *gen);
+
+// Keeps a copy of ds, the answer to a get of the range, if it is a single
+// extent covering the range and short enough.
+void l0_fill(struct l0 *l, struct fingerprint *fp, offset_t offset, offset_t len, unsigned long gen, struct data_set *ds);
+
+// Tables the calling thread holds, for tests.
+unsigned int l0_my_tables(void);
+
+#endif // __KERNEL__
+
+#endif // CINQUAIN_L0_H_
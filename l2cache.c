@@ -0,0 +1,474 @@
+/*
+ * Copyright (C) 2012 Yang Zhang <yang.zhang@stanzax.org>
+ * Copyright (C) 2012 Jinglei Ren <jinglei.ren@stanzax.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "l2cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "rbtree.h"
+
+
+#define L2_N_SLOT 1024
+
+#define L2_DEFAULT_SEGMENT  (64UL * 1024 * 1024)
+#define L2_DEFAULT_PENDING  (64UL * 1024 * 1024)
+
+#define l2_slot(fpnt)     (*((unsigned int *)(fpnt).value) % L2_N_SLOT)
+
+
+enum l2_state {
+    L2_QUEUED,  // waiting for the writer, data in 'pending'
+    L2_WRITING, // being written, data still in 'pending'
+    L2_ONDISK,  // data only on disk
+    L2_DEAD,    // dropped while being written, freed by the writer
+};
+
+// index of extents of a fingerprint
+struct l2_file {
+    struct fingerprint fpnt;
+    struct list_head entry;
+    struct rb_root root;
+};
+
+struct l2_extent {
+    struct l2_file *file;
+    offset_t offset;
+    offset_t len;
+    off_t pos;          // position in the backing file
+    unsigned int seg;
+    int state;
+    char *pending;
+    struct rb_node node;
+    struct list_head seg_entry;
+    struct list_head queue_entry;
+};
+
+struct l2_segment {
+    struct list_head extents;
+};
+
+struct l2cache {
+    int fd;
+    size_t segment_size;
+    size_t max_pending;
+    int admit;
+    offset_t admit_max_len;
+    l2_release_f release;
+    void *release_arg;
+
+    struct l2_segment *segs;
+    unsigned int n_seg;
+    unsigned int head;      // segment being appended
+    size_t head_used;
+
+    struct list_head slots[L2_N_SLOT];
+
+    // extents waiting for the writer, oldest at head
+    struct list_head queue;
+    size_t pending_bytes;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t writer;
+    int stop;
+};
+
+
+static struct l2_file *l2_file_find(struct l2cache *l2, struct fingerprint *fpnt) {
+    struct l2_file *f;
+    list_for_each_entry(f, &l2->slots[l2_slot(*fpnt)], entry) {
+        if (memcmp(f->fpnt.value, fpnt->value, FINGERPRINT_BYTES) == 0) {
+            return f;
+        }
+    }
+    return NULL;
+}
+
+
+// find the first extent overlapping [offset, offset + len)
+static struct l2_extent *l2_first_overlap(struct l2_file *f, offset_t offset, offset_t len) {
+    struct rb_node *n = f->root.rb_node;
+    struct l2_extent *ret = NULL;
+    while (n) {
+        struct l2_extent *ext = rb_entry(n, struct l2_extent, node);
+        if (offset + len <= ext->offset) {
+            n = n->rb_left;
+        } else if (ext->offset + ext->len <= offset) {
+            n = n->rb_right;
+        } else {
+            ret = ext;
+            n = n->rb_left;
+        }
+    }
+    return ret;
+}
+
+
+// remove an extent from the index, its segment and the write queue
+static void l2_unlink(struct l2cache *l2, struct l2_extent *ext) {
+    struct l2_file *f = ext->file;
+
+    rb_erase(&ext->node, &f->root);
+    if (RB_EMPTY_ROOT(&f->root)) {
+        list_del(&f->entry);
+        free(f);
+    }
+    ext->file = NULL;
+    list_del(&ext->seg_entry);
+
+    switch (ext->state) {
+    case L2_QUEUED:
+        list_del(&ext->queue_entry);
+        l2->pending_bytes -= ext->len;
+        l2->release(l2->release_arg, ext->pending, ext->len);
+        free(ext);
+        break;
+    case L2_WRITING:
+        // the writer owns it for now
+        ext->state = L2_DEAD;
+        break;
+    default:
+        free(ext);
+        break;
+    }
+}
+
+
+static void l2_drop_locked(struct l2cache *l2, struct fingerprint *fp, offset_t offset, offset_t len) {
+    struct l2_file *f = l2_file_find(l2, fp);
+    if (f == NULL) {
+        return;
+    }
+
+    struct l2_extent *ext = l2_first_overlap(f, offset, len);
+    while (ext && ext->offset < offset + len) {
+        // 'f' is freed along with its last extent, when 'next' is NULL
+        struct rb_node *next = rb_next(&ext->node);
+        l2_unlink(l2, ext);
+        if (next == NULL) {
+            break;
+        }
+        ext = rb_entry(next, struct l2_extent, node);
+    }
+}
+
+
+// reserve room for len bytes at the head of the log, reusing the oldest
+// segment when the current one is full
+static off_t l2_reserve(struct l2cache *l2, offset_t len, unsigned int *seg) {
+    if (l2->head_used + len > l2->segment_size) {
+        l2->head = (l2->head + 1) % l2->n_seg;
+        l2->head_used = 0;
+
+        struct l2_segment *s = &l2->segs[l2->head];
+        while (!list_empty(&s->extents)) {
+            l2_unlink(l2, list_first_entry(&s->extents, struct l2_extent, seg_entry));
+        }
+    }
+
+    off_t pos = (off_t) l2->head * l2->segment_size + l2->head_used;
+    l2->head_used += len;
+    *seg = l2->head;
+    return pos;
+}
+
+
+static int pwrite_full(int fd, const char *buf, size_t len, off_t pos) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, buf, len, pos);
+        if (n <= 0) {
+            return -1;
+        }
+        buf += n;
+        len -= n;
+        pos += n;
+    }
+    return 0;
+}
+
+
+static int pread_full(int fd, char *buf, size_t len, off_t pos) {
+    while (len > 0) {
+        ssize_t n = pread(fd, buf, len, pos);
+        if (n <= 0) {
+            return -1;
+        }
+        buf += n;
+        len -= n;
+        pos += n;
+    }
+    return 0;
+}
+
+
+static void *l2_writer(void *arg) {
+    struct l2cache *l2 = (struct l2cache *) arg;
+
+    pthread_mutex_lock(&l2->lock);
+    while (!l2->stop) {
+        if (list_empty(&l2->queue)) {
+            pthread_cond_wait(&l2->cond, &l2->lock);
+            continue;
+        }
+
+        struct l2_extent *ext = list_first_entry(&l2->queue, struct l2_extent, queue_entry);
+        list_del_init(&ext->queue_entry);
+        ext->state = L2_WRITING;
+        char *data = ext->pending;
+        offset_t len = ext->len;
+        off_t pos = ext->pos;
+        pthread_mutex_unlock(&l2->lock);
+
+        int err = pwrite_full(l2->fd, data, len, pos);
+
+        pthread_mutex_lock(&l2->lock);
+        l2->pending_bytes -= len;
+        if (ext->state == L2_DEAD) {
+            free(ext);
+        } else {
+            ext->pending = NULL;
+            ext->state = L2_ONDISK;
+            if (err) {
+                l2_unlink(l2, ext);
+            }
+        }
+        l2->release(l2->release_arg, data, len);
+    }
+    pthread_mutex_unlock(&l2->lock);
+    return NULL;
+}
+
+
+struct l2cache *l2_create(const struct l2_config *cfg, l2_release_f release, void *arg) {
+    size_t seg_size = cfg->segment_size ? cfg->segment_size : L2_DEFAULT_SEGMENT;
+    if (seg_size > cfg->capacity) {
+        seg_size = cfg->capacity;
+    }
+    if (seg_size == 0 || cfg->path == NULL) {
+        return NULL;
+    }
+
+    struct l2cache *l2 = (struct l2cache *) calloc(1, sizeof(struct l2cache));
+    if (l2 == NULL) {
+        return NULL;
+    }
+    l2->segment_size = seg_size;
+    l2->n_seg = cfg->capacity / seg_size;
+    l2->max_pending = cfg->max_pending ? cfg->max_pending : L2_DEFAULT_PENDING;
+    l2->admit = cfg->admit;
+    l2->admit_max_len = cfg->admit_max_len;
+    l2->release = release;
+    l2->release_arg = arg;
+
+    l2->fd = open(cfg->path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (l2->fd < 0) {
+        free(l2);
+        return NULL;
+    }
+    if (ftruncate(l2->fd, (off_t) l2->n_seg * seg_size) != 0) {
+        goto fail_fd;
+    }
+
+    l2->segs = (struct l2_segment *) calloc(l2->n_seg, sizeof(struct l2_segment));
+    if (l2->segs == NULL) {
+        goto fail_fd;
+    }
+    unsigned int i;
+    for (i = 0; i < l2->n_seg; i++) {
+        INIT_LIST_HEAD(&l2->segs[i].extents);
+    }
+    for (i = 0; i < L2_N_SLOT; i++) {
+        INIT_LIST_HEAD(&l2->slots[i]);
+    }
+    INIT_LIST_HEAD(&l2->queue);
+
+    pthread_mutex_init(&l2->lock, NULL);
+    pthread_cond_init(&l2->cond, NULL);
+    if (pthread_create(&l2->writer, NULL, l2_writer, l2) != 0) {
+        pthread_cond_destroy(&l2->cond);
+        pthread_mutex_destroy(&l2->lock);
+        free(l2->segs);
+        goto fail_fd;
+    }
+    return l2;
+
+fail_fd:
+    close(l2->fd);
+    free(l2);
+    return NULL;
+}
+
+
+void l2_destroy(struct l2cache *l2) {
+    pthread_mutex_lock(&l2->lock);
+    l2->stop = 1;
+    pthread_cond_signal(&l2->cond);
+    pthread_mutex_unlock(&l2->lock);
+    pthread_join(l2->writer, NULL);
+
+    unsigned int i;
+    for (i = 0; i < l2->n_seg; i++) {
+        struct l2_segment *s = &l2->segs[i];
+        while (!list_empty(&s->extents)) {
+            l2_unlink(l2, list_first_entry(&s->extents, struct l2_extent, seg_entry));
+        }
+    }
+
+    pthread_cond_destroy(&l2->cond);
+    pthread_mutex_destroy(&l2->lock);
+    close(l2->fd);
+    free(l2->segs);
+    free(l2);
+}
+
+
+int l2_admit(struct l2cache *l2, offset_t len, unsigned int hits) {
+    if (len > l2->segment_size) {
+        return 0;
+    }
+    if (l2->admit_max_len && len > l2->admit_max_len) {
+        return 0;
+    }
+    if (l2->admit == L2_ADMIT_REUSED && hits == 0) {
+        return 0;
+    }
+    return 1;
+}
+
+
+int l2_put(struct l2cache *l2, struct fingerprint *fp, offset_t offset, offset_t len, char *data) {
+    struct l2_extent *ext = (struct l2_extent *) malloc(sizeof(struct l2_extent));
+
+    pthread_mutex_lock(&l2->lock);
+    if (ext == NULL || len == 0 || len > l2->segment_size ||
+        l2->pending_bytes + len > l2->max_pending) {
+        // the disk falls behind, shed load rather than stall eviction
+        goto drop;
+    }
+
+    // stale copies must not survive the newer one
+    l2_drop_locked(l2, fp, offset, len);
+    // may reuse the oldest segment
+    ext->pos = l2_reserve(l2, len, &ext->seg);
+
+    struct l2_file *f = l2_file_find(l2, fp);
+    if (f == NULL) {
+        f = (struct l2_file *) malloc(sizeof(struct l2_file));
+        if (f == NULL) {
+            goto drop;
+        }
+        f->fpnt = *fp;
+        f->root = RB_ROOT;
+        list_add(&f->entry, &l2->slots[l2_slot(*fp)]);
+    }
+
+    ext->file = f;
+    ext->offset = offset;
+    ext->len = len;
+    ext->state = L2_QUEUED;
+    ext->pending = data;
+
+    struct rb_node **new = &f->root.rb_node, *parent = NULL;
+    while (*new) {
+        struct l2_extent *this = rb_entry(*new, struct l2_extent, node);
+        parent = *new;
+        if (offset < this->offset) {
+            new = &((*new)->rb_left);
+        } else {
+            new = &((*new)->rb_right);
+        }
+    }
+    rb_link_node(&ext->node, parent, new);
+    rb_insert_color(&ext->node, &f->root);
+
+    list_add_tail(&ext->seg_entry, &l2->segs[ext->seg].extents);
+    list_add_tail(&ext->queue_entry, &l2->queue);
+    l2->pending_bytes += len;
+    pthread_cond_signal(&l2->cond);
+    pthread_mutex_unlock(&l2->lock);
+    return 0;
+
+drop:
+    pthread_mutex_unlock(&l2->lock);
+    free(ext);
+    l2->release(l2->release_arg, data, len);
+    return -1;
+}
+
+
+struct data_set *l2_take(struct l2cache *l2, struct fingerprint *fp, offset_t offset, offset_t len) {
+    struct data_set *dset = NULL;
+
+    pthread_mutex_lock(&l2->lock);
+    struct l2_file *f = l2_file_find(l2, fp);
+    if (f == NULL) {
+        goto out;
+    }
+    struct l2_extent *ext = l2_first_overlap(f, offset, len);
+    if (ext == NULL) {
+        goto out;
+    }
+
+    dset = (struct data_set *) malloc(sizeof(struct data_set));
+    INIT_LIST_HEAD(&dset->entries);
+
+    while (ext && ext->offset < offset + len) {
+        struct rb_node *next = rb_next(&ext->node);
+
+        struct data_entry *de = (struct data_entry *) malloc(sizeof(struct data_entry));
+        de->data = (char *) malloc(ext->len);
+        de->offset = ext->offset;
+        de->len = ext->len;
+        if (ext->pending) {
+            memcpy(de->data, ext->pending, ext->len);
+        } else if (pread_full(l2->fd, de->data, ext->len, ext->pos) != 0) {
+            free(de->data);
+            free(de);
+            de = NULL;
+        }
+        if (de) {
+            list_add_tail(&de->entry, &dset->entries);
+        }
+
+        // 'f' is freed along with its last extent, when 'next' is NULL
+        l2_unlink(l2, ext);
+        if (next == NULL) {
+            break;
+        }
+        ext = rb_entry(next, struct l2_extent, node);
+    }
+
+    if (list_empty(&dset->entries)) {
+        free(dset);
+        dset = NULL;
+    }
+
+out:
+    pthread_mutex_unlock(&l2->lock);
+    return dset;
+}
+
+
+void l2_drop(struct l2cache *l2, struct fingerprint *fp, offset_t offset, offset_t len) {
+    pthread_mutex_lock(&l2->lock);
+    l2_drop_locked(l2, fp, offset, len);
+    pthread_mutex_unlock(&l2->lock);
+}
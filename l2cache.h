@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2012 Yang Zhang <yang.zhang@stanzax.org>
+ * Copyright (C) 2012 Jinglei Ren <jinglei.ren@stanzax.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+//
+//  l2cache.h
+//  Cinquain Cache
+//
+//  Second-tier cache for extents evicted from R-cache.
+//
+//  Extents are appended to a log of fixed-size segments in a local file.
+//  An in-memory index maps (fingerprint, offset) to their places in the log.
+//  When the log wraps around, the oldest segment is reused and whatever
+//  it still holds is dropped. L2 is exclusive to R-cache: an extent leaves
+//  L2 when it is taken back into R-cache or overwritten there.
+//
+
+#ifndef CINQUAIN_L2CACHE_H_
+#define CINQUAIN_L2CACHE_H_
+
+#include "cinq_cache.h"
+
+struct l2cache;
+
+// Releases a data buffer handed over by l2_put(); arg is as given to
+// l2_create().
+typedef void (*l2_release_f)(void *arg, char *data, offset_t len);
+
+#ifdef __KERNEL__
+
+// no local file in kernel mode
+static inline struct l2cache *l2_create(const struct l2_config *cfg, l2_release_f release, void *arg) { return NULL; }
+static inline void l2_destroy(struct l2cache *l2) { }
+static inline int l2_admit(struct l2cache *l2, offset_t len, unsigned int hits) { return 0; }
+static inline int l2_put(struct l2cache *l2, struct fingerprint *fp, offset_t offset, offset_t len, char *data) { return -1; }
+static inline struct data_set *l2_take(struct l2cache *l2, struct fingerprint *fp, offset_t offset, offset_t len) { return NULL; }
+static inline void l2_drop(struct l2cache *l2, struct fingerprint *fp, offset_t offset, offset_t len) { }
+
+#else // user space
+
+// Creates the L2 tier and starts its writer thread. Returns NULL on failure.
+struct l2cache *l2_create(const struct l2_config *cfg, l2_release_f release, void *arg);
+
+// Stops the writer thread and releases all pending data.
+// The backing file is left on disk.
+void l2_destroy(struct l2cache *l2);
+
+// Returns non-zero if an evicted extent of len bytes, hit 'hits' times
+// while cached in R-cache, should be put to L2.
+int l2_admit(struct l2cache *l2, offset_t len, unsigned int hits);
+
+// Queues an extent for writing. L2 takes over 'data' and releases it by the
+// release function, whether the call succeeds or not.
+// Returns 0 if queued, or -1 if dropped.
+int l2_put(struct l2cache *l2, struct fingerprint *fp, offset_t offset, offset_t len, char *data);
+
+// Removes all extents overlapping [offset, offset + len) from L2 and
+// returns them sorted by offsets. Returns NULL if nothing found.
+// Users take charge of deallocation of returned data.
+struct data_set *l2_take(struct l2cache *l2, struct fingerprint *fp, offset_t offset, offset_t len);
+
+// Drops all extents overlapping [offset, offset + len) from L2.
+void l2_drop(struct l2cache *l2, struct fingerprint *fp, offset_t offset, offset_t len);
+
+#endif // __KERNEL__
+
+#endif // CINQUAIN_L2CACHE_H_
@@ -11,6 +11,10 @@
  * using the generic single-entry routines.
  */
 
+#ifndef prefetch
+#define prefetch(x) __builtin_prefetch(x)
+#endif // prefetch
+
 #define LIST_HEAD_INIT(name) { &(name), &(name) }
 
 #define LIST_HEAD(name) \
@@ -56,6 +60,25 @@ static inline void list_add(struct list_head *new, struct list_head *head)
 }
 
 
+/**
+ * list_add_rcu - add a new entry for lockless readers
+ * @new: new entry to be added
+ * @head: list head to add it after
+ *
+ * Like list_add(), but @new is complete before readers following
+ * ->next can reach it. Writers still need mutual exclusion.
+ */
+static inline void list_add_rcu(struct list_head *new, struct list_head *head)
+{
+	struct list_head *next = head->next;
+
+	new->next = next;
+	new->prev = head;
+	__atomic_store_n(&head->next, new, __ATOMIC_RELEASE);
+	next->prev = new;
+}
+
+
 /**
  * list_add_tail - add a new entry
  * @new: new entry to be added
@@ -0,0 +1,233 @@
+/*
+ * Copyright (C) 2012 Yang Zhang <yang.zhang@stanzax.org>
+ * Copyright (C) 2012 Jinglei Ren <jinglei.ren@stanzax.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "mrc.h"
+
+#ifdef __KERNEL__
+#include <linux/vmalloc.h>
+#define ALLOC(nbytes)   vzalloc(nbytes)
+#define FREE(ptr)       vfree(ptr)
+#else
+#include <stdlib.h>
+#include <string.h>
+#define ALLOC(nbytes)   calloc(1, (nbytes))
+#define FREE(ptr)       free(ptr)
+#endif // __KERNEL__
+
+
+#define MRC_P           (1UL << MRC_P_BITS)
+
+struct mrc_key {
+    struct list_head link;      // in a bucket, or in the free list
+    unsigned long key;
+    unsigned int slot;          // time of the last access
+};
+
+
+// Fenwick tree over slots: slot i is at index i + 1
+static void tree_add(struct mrc *m, unsigned int slot, int v) {
+    unsigned int i;
+    for (i = slot + 1; i <= m->n_slot; i += i & -i) {
+        m->tree[i] += v;
+    }
+}
+
+// live slots before 'slot'
+static unsigned long tree_sum(struct mrc *m, unsigned int slot) {
+    unsigned long sum = 0;
+    unsigned int i;
+    for (i = slot; i > 0; i -= i & -i) {
+        sum += m->tree[i];
+    }
+    return sum;
+}
+
+
+static struct list_head *mrc_bucket(struct mrc *m, unsigned long key) {
+    return &m->buckets[(key >> 24) & m->bucket_mask];
+}
+
+static struct mrc_key *mrc_find(struct mrc *m, unsigned long key) {
+    struct mrc_key *k;
+    list_for_each_entry(k, mrc_bucket(m, key), link) {
+        if (k->key == key) {
+            return k;
+        }
+    }
+    return NULL;
+}
+
+
+// Renumbers live slots from 0 in access order, and rebuilds the tree.
+static void mrc_compact(struct mrc *m) {
+    unsigned int i, j = 0;
+    for (i = 0; i < m->now; i++) {
+        if (m->owner[i]) {
+            m->owner[j] = m->owner[i];
+            m->owner[j]->slot = j;
+            j++;
+        }
+    }
+    m->now = j;
+    memset(m->owner + j, 0, (m->n_slot - j) * sizeof(struct mrc_key *));
+    memset(m->tree, 0, (m->n_slot + 1) * sizeof(int));
+    for (i = 1; i <= m->n_slot; i++) {
+        if (i <= j) {
+            m->tree[i]++;
+        }
+        unsigned int up = i + (i & -i);
+        if (up <= m->n_slot) {
+            m->tree[up] += m->tree[i];
+        }
+    }
+}
+
+
+static void mrc_drop(struct mrc *m, struct mrc_key *k) {
+    tree_add(m, k->slot, -1);
+    m->owner[k->slot] = NULL;
+    list_move(&k->link, &m->free);
+    m->n_keys--;
+}
+
+// Halves the sample rate, dropping keys no longer sampled. Counts taken
+// at the old rate are halved too, to weigh as much as new ones.
+static void mrc_lower(struct mrc *m) {
+    unsigned int i;
+    int b;
+    while (m->n_keys == m->max_keys && m->threshold > 1) {
+        __atomic_store_n(&m->threshold, m->threshold / 2, __ATOMIC_RELAXED);
+        for (b = 0; b < HIST_N_BUCKET; b++) {
+            m->dist.count[b] /= 2;
+        }
+        m->cold /= 2;
+        for (i = 0; i < m->now; i++) {
+            struct mrc_key *k = m->owner[i];
+            if (k && mrc_hash(k->key) >= m->threshold) {
+                mrc_drop(m, k);
+            }
+        }
+    }
+}
+
+
+struct mrc *mrc_create(unsigned int sample_1_in, unsigned int max_keys) {
+    struct mrc *m;
+    unsigned int i, n_bucket = 1;
+
+    if (sample_1_in == 0 || max_keys == 0) {
+        return NULL;
+    }
+    m = (struct mrc *) ALLOC(sizeof(struct mrc));
+    if (m == NULL) {
+        return NULL;
+    }
+    while (n_bucket < max_keys) {
+        n_bucket <<= 1;
+    }
+    m->threshold = MRC_P / sample_1_in;
+    if (m->threshold == 0) {
+        m->threshold = 1;
+    }
+    m->max_keys = max_keys;
+    m->n_slot = 4 * max_keys; // compaction comes at most once per 3 * max_keys accesses
+    m->bucket_mask = n_bucket - 1;
+    m->keys = (struct mrc_key *) ALLOC(max_keys * sizeof(struct mrc_key));
+    m->buckets = (struct list_head *) ALLOC(n_bucket * sizeof(struct list_head));
+    m->owner = (struct mrc_key **) ALLOC(m->n_slot * sizeof(struct mrc_key *));
+    m->tree = (int *) ALLOC((m->n_slot + 1) * sizeof(int));
+    if (m->keys == NULL || m->buckets == NULL || m->owner == NULL || m->tree == NULL) {
+        mrc_destroy(m);
+        return NULL;
+    }
+    INIT_LIST_HEAD(&m->free);
+    for (i = 0; i < max_keys; i++) {
+        list_add(&m->keys[i].link, &m->free);
+    }
+    for (i = 0; i < n_bucket; i++) {
+        INIT_LIST_HEAD(&m->buckets[i]);
+    }
+    return m;
+}
+
+
+void mrc_destroy(struct mrc *m) {
+    if (m->keys) {
+        FREE(m->keys);
+    }
+    if (m->buckets) {
+        FREE(m->buckets);
+    }
+    if (m->owner) {
+        FREE(m->owner);
+    }
+    if (m->tree) {
+        FREE(m->tree);
+    }
+    FREE(m);
+}
+
+
+void mrc_access(struct mrc *m, unsigned long key) {
+    if (mrc_hash(key) >= m->threshold) {
+        return;
+    }
+    m->samples++;
+    if (m->now == m->n_slot) {
+        mrc_compact(m);
+    }
+
+    struct mrc_key *k = mrc_find(m, key);
+    if (k) {
+        // distinct sampled keys since the last access, each standing for
+        // 1/R keys
+        unsigned long d = tree_sum(m, m->now) - tree_sum(m, k->slot + 1);
+        hist_record(&m->dist, d * MRC_P / m->threshold);
+        tree_add(m, k->slot, -1);
+        m->owner[k->slot] = NULL;
+    } else {
+        if (m->n_keys == m->max_keys) {
+            mrc_lower(m);
+            if (mrc_hash(key) >= m->threshold) {
+                return;
+            }
+        }
+        m->cold++;
+        k = list_first_entry(&m->free, struct mrc_key, link);
+        k->key = key;
+        list_move(&k->link, mrc_bucket(m, key));
+        m->n_keys++;
+    }
+    k->slot = m->now++;
+    m->owner[k->slot] = k;
+    tree_add(m, k->slot, 1);
+}
+
+
+unsigned long mrc_hit_ppm(struct mrc *m, unsigned long units) {
+    unsigned long hits = 0, total = m->cold;
+    int b;
+    for (b = 0; b < HIST_N_BUCKET; b++) {
+        total += m->dist.count[b];
+        // a hit if fewer than 'units' other keys came in between
+        if (hist_bucket_top(b) < units) {
+            hits += m->dist.count[b];
+        }
+    }
+    return total ? (unsigned long) ((unsigned long long) hits * 1000000 / total) : 0;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2012 Yang Zhang <yang.zhang@stanzax.org>
+ * Copyright (C) 2012 Jinglei Ren <jinglei.ren@stanzax.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+//
+//  mrc.h
+//  Cinquain Cache
+//
+//  Miss ratio curve estimation by spatially hashed sampling (Waldspurger
+//  et al., "Efficient MRC Construction with SHARDS", FAST 2015).
+//
+//  Only keys whose hash falls below a threshold are tracked, so a sample
+//  rate R of the key space is. Reuse distances among sampled keys, counted
+//  with a Fenwick tree over access times, are scaled by 1/R into a
+//  histogram. Once max_keys are tracked, the threshold is halved and keys
+//  above it dropped. The caller serializes all calls but mrc_sampled(),
+//  which lets callers filter keys before taking their lock.
+//
+
+#ifndef CINQUAIN_MRC_H_
+#define CINQUAIN_MRC_H_
+
+#include "hist.h"
+
+#define MRC_P_BITS      24  // hash bits compared with the threshold
+
+// the sampling hash of a key: its top bits
+#define mrc_hash(key)   ((key) >> (64 - MRC_P_BITS))
+
+struct mrc_key;
+
+struct mrc {
+    unsigned long threshold;    // keys hashing below are sampled, of 2^MRC_P_BITS
+    unsigned int max_keys;
+    unsigned int n_keys;
+    unsigned int n_slot;        // access times before the slots are compacted
+    unsigned int now;           // next access time
+    struct mrc_key *keys;       // max_keys of them
+    struct list_head free;      // keys not in use
+    struct list_head *buckets;  // keys in use, hashed
+    unsigned int bucket_mask;
+    struct mrc_key **owner;     // key last accessed at each time, or NULL
+    int *tree;                  // Fenwick tree of live times, 1-based
+    struct hist dist;           // scaled reuse distances
+    unsigned long cold;         // first accesses to sampled keys
+    unsigned long samples;      // accesses to sampled keys
+};
+
+// Creates an estimator sampling 1 in sample_1_in keys and tracking up to
+// max_keys of them, NULL if out of memory.
+struct mrc *mrc_create(unsigned int sample_1_in, unsigned int max_keys);
+
+void mrc_destroy(struct mrc *m);
+
+// Non-zero if key is sampled at the current rate. Needs no serialization;
+// a key let through as the rate drops is filtered by mrc_access().
+static inline int mrc_sampled(struct mrc *m, unsigned long key) {
+    return mrc_hash(key) < __atomic_load_n(&m->threshold, __ATOMIC_RELAXED);
+}
+
+// Counts an access to key, a well-mixed hash.
+void mrc_access(struct mrc *m, unsigned long key);
+
+// Predicted LRU hit ratio, in parts per million, of a cache of 'units'
+// keys.
+unsigned long mrc_hit_ppm(struct mrc *m, unsigned long units);
+
+#endif // CINQUAIN_MRC_H_
@@ -0,0 +1,443 @@
+/*
+ * Copyright (C) 2012 Yang Zhang <yang.zhang@stanzax.org>
+ * Copyright (C) 2012 Jinglei Ren <jinglei.ren@stanzax.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+//
+//  numa.c
+//  Cinquain Cache
+//
+//  NUMA mode: a cache shard per node, with node-local R-cache data.
+//
+//  The node layout comes from /sys/devices/system/node. A thread finds
+//  its node through sched_getcpu(), which glibc serves from rseq without
+//  a system call, and a table from CPU to shard built at creation.
+//
+
+#define _GNU_SOURCE     // sched_getcpu()
+
+#include "cinq_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+
+
+// CPUs beyond this are taken for the first shard
+#define NUMA_MAX_CPUS   4096
+
+// locks serializing puts, picked by file
+#define NUMA_PUT_LOCKS  64
+
+enum node_stat {
+    NODE_RGET,
+    NODE_LOCAL_HIT,
+    NODE_REMOTE_HIT,
+    NODE_PARTIAL,
+    NODE_MISS,
+    NODE_LOCAL_BYTES,
+    NODE_REMOTE_BYTES,
+    NODE_RPUT,
+    NODE_RPUT_BYTES,
+    N_NODE_STAT,
+};
+
+// written by the threads of one node only, so kept off the lines of others
+struct node_counters {
+    unsigned long v[N_NODE_STAT];
+} __attribute__((aligned(64)));
+
+struct cinq_numa {
+    int n_shard;
+    int node[CINQ_NUMA_MAX_NODES];      // node id of each shard
+    struct cinq_cache *shard[CINQ_NUMA_MAX_NODES];
+    struct node_counters counters[CINQ_NUMA_MAX_NODES];
+    pthread_mutex_t put_lock[NUMA_PUT_LOCKS];
+    unsigned char cpu_shard[NUMA_MAX_CPUS];
+};
+
+#ifdef CINQ_NUMA_FAKE_NODES
+static __thread int fake_shard = -1;
+
+void cinq_numa_fake_shard(int i) {
+    fake_shard = i;
+}
+#endif // CINQ_NUMA_FAKE_NODES
+
+
+// Reads a list such as "0-3,8,10-11" into set. Returns -1 if the file
+// cannot be read.
+static int read_list(const char *path, unsigned char *set, int max) {
+    char buf[4096];
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+    char *p = fgets(buf, sizeof(buf), f);
+    fclose(f);
+    if (p == NULL) {
+        return -1;
+    }
+    memset(set, 0, max);
+    while (*p >= '0' && *p <= '9') {
+        long lo = strtol(p, &p, 10), hi = lo;
+        if (*p == '-') {
+            hi = strtol(p + 1, &p, 10);
+        }
+        for (; lo <= hi && lo < max; lo++) {
+            set[lo] = 1;
+        }
+        if (*p == ',') {
+            p++;
+        }
+    }
+    return 0;
+}
+
+
+// Finds the nodes with both CPUs and memory and maps their CPUs to shards.
+// Leaves a single shard for node 0 if the layout is unknown.
+static void find_nodes(struct cinq_numa *n) {
+    unsigned char cpus[CINQ_NUMA_MAX_NODES], mems[CINQ_NUMA_MAX_NODES];
+    unsigned char on_node[NUMA_MAX_CPUS];
+    char path[64];
+    int i, cpu;
+
+#ifdef CINQ_NUMA_FAKE_NODES
+    // a fixed layout for tests: shards on node 0, CPUs dealt round-robin
+    for (cpu = 0; cpu < NUMA_MAX_CPUS; cpu++) {
+        n->cpu_shard[cpu] = (unsigned char) (cpu % CINQ_NUMA_FAKE_NODES);
+    }
+    for (i = 0; i < CINQ_NUMA_FAKE_NODES; i++) {
+        n->node[i] = 0;
+    }
+    n->n_shard = CINQ_NUMA_FAKE_NODES;
+    return;
+#endif // CINQ_NUMA_FAKE_NODES
+
+    n->n_shard = 0;
+    if (read_list("/sys/devices/system/node/has_cpu", cpus, CINQ_NUMA_MAX_NODES) == 0 &&
+        read_list("/sys/devices/system/node/has_memory", mems, CINQ_NUMA_MAX_NODES) == 0) {
+        for (i = 0; i < CINQ_NUMA_MAX_NODES; i++) {
+            if (!cpus[i] || !mems[i]) {
+                continue;
+            }
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", i);
+            if (read_list(path, on_node, NUMA_MAX_CPUS) != 0) {
+                continue;
+            }
+            for (cpu = 0; cpu < NUMA_MAX_CPUS; cpu++) {
+                if (on_node[cpu]) {
+                    n->cpu_shard[cpu] = (unsigned char) n->n_shard;
+                }
+            }
+            n->node[n->n_shard++] = i;
+        }
+    }
+    if (n->n_shard <= 1) {
+        // nothing to keep apart; leave memory placement to the system
+        memset(n->cpu_shard, 0, sizeof(n->cpu_shard));
+        n->node[0] = n->n_shard ? n->node[0] : 0;
+        n->n_shard = 1;
+    }
+}
+
+
+static inline int caller_shard(struct cinq_numa *n) {
+#ifdef CINQ_NUMA_FAKE_NODES
+    if (fake_shard >= 0) {
+        return fake_shard % n->n_shard;
+    }
+#endif // CINQ_NUMA_FAKE_NODES
+    int cpu = sched_getcpu();
+    return cpu >= 0 && cpu < NUMA_MAX_CPUS ? n->cpu_shard[cpu] : 0;
+}
+
+static inline unsigned int file_hash(struct fingerprint *fp) {
+    unsigned int h;
+    memcpy(&h, fp->value, sizeof(h));
+    return h * 2654435761U >> 16;
+}
+
+// the shard holding the W-cache of a file
+static inline int home_shard(struct cinq_numa *n, struct fingerprint *fp) {
+    return (int) (file_hash(fp) % n->n_shard);
+}
+
+static inline void count(struct cinq_numa *n, int shard, int stat, unsigned long v) {
+    __atomic_fetch_add(&n->counters[shard].v[stat], v, __ATOMIC_RELAXED);
+}
+
+
+struct cinq_numa *cinq_numa_create(const struct cinq_config *cfg, size_t arena_bytes) {
+    struct cinq_numa *n;
+    int i;
+    // the counters of nodes must not share lines
+    if (posix_memalign((void **) &n, 64, sizeof(struct cinq_numa)) != 0) {
+        return NULL;
+    }
+    memset(n, 0, sizeof(struct cinq_numa));
+    for (i = 0; i < NUMA_PUT_LOCKS; i++) {
+        pthread_mutex_init(&n->put_lock[i], NULL);
+    }
+    find_nodes(n);
+    for (i = 0; i < n->n_shard; i++) {
+        n->shard[i] = cinq_cache_create(cfg);
+        if (n->shard[i] == NULL) {
+            goto fail;
+        }
+        if (arena_bytes &&
+            cinq_rcache_arena_enable_on(n->shard[i], arena_bytes, n->n_shard > 1 ? n->node[i] : -1) != 0) {
+            goto fail;
+        }
+    }
+    return n;
+
+fail:
+    cinq_numa_destroy(n);
+    return NULL;
+}
+
+
+void cinq_numa_destroy(struct cinq_numa *n) {
+    int i;
+    for (i = 0; i < n->n_shard; i++) {
+        if (n->shard[i]) {
+            cinq_cache_destroy(n->shard[i]);
+        }
+    }
+    for (i = 0; i < NUMA_PUT_LOCKS; i++) {
+        pthread_mutex_destroy(&n->put_lock[i]);
+    }
+    free(n);
+}
+
+
+int cinq_numa_shards(struct cinq_numa *n) {
+    return n->n_shard;
+}
+
+
+struct cinq_cache *cinq_numa_shard(struct cinq_numa *n, int i) {
+    return i >= 0 && i < n->n_shard ? n->shard[i] : NULL;
+}
+
+
+int cinq_numa_node_stats(struct cinq_numa *n, int i, struct cinq_node_stats *st) {
+    if (i < 0 || i >= n->n_shard) {
+        return -1;
+    }
+    unsigned long *v = n->counters[i].v;
+    st->node = n->node[i];
+    st->rget = __atomic_load_n(&v[NODE_RGET], __ATOMIC_RELAXED);
+    st->local_hits = __atomic_load_n(&v[NODE_LOCAL_HIT], __ATOMIC_RELAXED);
+    st->remote_hits = __atomic_load_n(&v[NODE_REMOTE_HIT], __ATOMIC_RELAXED);
+    st->partial = __atomic_load_n(&v[NODE_PARTIAL], __ATOMIC_RELAXED);
+    st->misses = __atomic_load_n(&v[NODE_MISS], __ATOMIC_RELAXED);
+    st->local_bytes = __atomic_load_n(&v[NODE_LOCAL_BYTES], __ATOMIC_RELAXED);
+    st->remote_bytes = __atomic_load_n(&v[NODE_REMOTE_BYTES], __ATOMIC_RELAXED);
+    st->rput = __atomic_load_n(&v[NODE_RPUT], __ATOMIC_RELAXED);
+    st->rput_bytes = __atomic_load_n(&v[NODE_RPUT_BYTES], __ATOMIC_RELAXED);
+    return 0;
+}
+
+
+void cinq_numa_latency_enable(struct cinq_numa *n, int on) {
+    int i;
+    for (i = 0; i < n->n_shard; i++) {
+        cinq_cache_latency_enable(n->shard[i], on);
+    }
+}
+
+
+void cinq_numa_latency(struct cinq_numa *n, struct cinq_latency *lat) {
+    cinq_cache_merge_latency(n->shard, n->n_shard, lat);
+}
+
+
+// Adds [offset, offset + len) of de to out before at, copying the bytes
+// unless they are all of de. Returns the bytes added.
+static unsigned long add_part(struct list_head *at, struct data_entry *de, offset_t offset, offset_t len) {
+    struct data_entry *part = de;
+    if (offset != de->offset || len != de->len) {
+        part = (struct data_entry *) malloc(sizeof(struct data_entry));
+        if (part == NULL) {
+            return 0;
+        }
+        part->data = (char *) malloc(len);
+        if (part->data == NULL) {
+            free(part);
+            return 0;
+        }
+        memcpy(part->data, de->data + (offset - de->offset), len);
+        part->offset = offset;
+        part->len = len;
+    }
+    list_add_tail(&part->entry, at);
+    return len;
+}
+
+// Moves what ds holds beyond the entries of out into out, which stays in
+// offset order, and frees ds. Returns the bytes moved.
+static unsigned long merge_set(struct data_set *out, struct data_set *ds) {
+    struct data_entry *de, *tmp, *x;
+    unsigned long got = 0;
+
+    list_for_each_entry_safe(de, tmp, &ds->entries, entry) {
+        offset_t cur = de->offset, end = de->offset + de->len;
+        struct list_head *at = &out->entries;
+        int whole = 1;
+
+        list_del(&de->entry);
+        list_for_each_entry(x, &out->entries, entry) {
+            if (x->offset + x->len <= cur) {
+                continue;
+            }
+            if (x->offset >= end) {
+                at = &x->entry;
+                break;
+            }
+            whole = 0;
+            if (x->offset > cur) {
+                got += add_part(&x->entry, de, cur, x->offset - cur);
+            }
+            cur = x->offset + x->len;
+            if (cur >= end) {
+                break;
+            }
+        }
+        if (cur < end) {
+            got += add_part(at, de, cur, end - cur);
+        }
+        if (!whole) {
+            free(de->data);
+            free(de);
+        }
+    }
+    free_data_set(ds, 1);
+    return got;
+}
+
+// bytes of [offset, offset + len) that the disjoint entries of ds hold
+static unsigned long range_held(struct data_set *ds, offset_t offset, offset_t len) {
+    struct data_entry *de;
+    unsigned long held = 0;
+    list_for_each_entry(de, &ds->entries, entry) {
+        offset_t lo = de->offset > offset ? de->offset : offset;
+        offset_t hi = de->offset + de->len < offset + len ? de->offset + de->len : offset + len;
+        if (hi > lo) {
+            held += hi - lo;
+        }
+    }
+    return held;
+}
+
+struct data_set *cinq_numa_rcache_get(struct cinq_numa *n, struct fingerprint *fp, offset_t offset, offset_t len) {
+    int me = caller_shard(n);
+    struct data_set *out = NULL;
+    unsigned long held = 0;
+    int i, remote = 0;
+
+    count(n, me, NODE_RGET, 1);
+    // the nearest copy of a byte wins; further shards fill the holes
+    for (i = 0; i < n->n_shard && held < len; i++) {
+        struct data_set *ds = cinq_rcache_get(n->shard[(me + i) % n->n_shard], fp, offset, len);
+        if (ds == NULL) {
+            continue;
+        }
+        if (out == NULL) {
+            out = (struct data_set *) malloc(sizeof(struct data_set));
+            if (out == NULL) {
+                free_data_set(ds, 1);
+                break;
+            }
+            INIT_LIST_HEAD(&out->entries);
+        }
+        unsigned long got = merge_set(out, ds);
+        if (got) {
+            count(n, me, i ? NODE_REMOTE_BYTES : NODE_LOCAL_BYTES, got);
+            remote |= (i != 0);
+            held = range_held(out, offset, len);
+        }
+    }
+    if (held == 0) {
+        free_data_set(out, 1);
+        count(n, me, NODE_MISS, 1);
+        return NULL;
+    }
+    if (held < len) {
+        count(n, me, NODE_PARTIAL, 1);
+    } else {
+        count(n, me, remote ? NODE_REMOTE_HIT : NODE_LOCAL_HIT, 1);
+    }
+    return out;
+}
+
+
+void cinq_numa_rcache_put(struct cinq_numa *n, struct fingerprint *fp, struct data_entry *de) {
+    pthread_mutex_t *m = &n->put_lock[file_hash(fp) % NUMA_PUT_LOCKS];
+    int me = caller_shard(n);
+    int i;
+    count(n, me, NODE_RPUT, 1);
+    count(n, me, NODE_RPUT_BYTES, de->len);
+    // older copies of the range on other nodes would be served as hits;
+    // a put from another node between dropping them and our put would
+    // leave two copies that differ
+    pthread_mutex_lock(m);
+    for (i = 1; i < n->n_shard; i++) {
+        cinq_rcache_invalidate(n->shard[(me + i) % n->n_shard], fp, de->offset, de->len);
+    }
+    cinq_rcache_put(n->shard[me], fp, de);
+    pthread_mutex_unlock(m);
+}
+
+
+void cinq_numa_rcache_invalidate(struct cinq_numa *n, struct fingerprint *fp, offset_t offset, offset_t len) {
+    int i;
+    for (i = 0; i < n->n_shard; i++) {
+        cinq_rcache_invalidate(n->shard[i], fp, offset, len);
+    }
+}
+
+
+void cinq_numa_rcache_invalidate_file(struct cinq_numa *n, struct fingerprint *fp) {
+    int i;
+    for (i = 0; i < n->n_shard; i++) {
+        cinq_rcache_invalidate_file(n->shard[i], fp);
+    }
+}
+
+
+struct data_set *cinq_numa_wcache_read(struct cinq_numa *n, struct fingerprint *fp, offset_t offset, offset_t len) {
+    return cinq_wcache_read(n->shard[home_shard(n, fp)], fp, offset, len);
+}
+
+
+int cinq_numa_wcache_write(struct cinq_numa *n, struct fingerprint *fp, struct data_entry *de) {
+    return cinq_wcache_write(n->shard[home_shard(n, fp)], fp, de);
+}
+
+
+struct data_set *cinq_numa_wcache_collect(struct cinq_numa *n, struct fingerprint *fp) {
+    return cinq_wcache_collect(n->shard[home_shard(n, fp)], fp);
+}
+
+
+struct cinq_snapshot *cinq_numa_wcache_snapshot(struct cinq_numa *n, struct fingerprint *fp) {
+    return cinq_wcache_snapshot(n->shard[home_shard(n, fp)], fp);
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2012 Yang Zhang <yang.zhang@stanzax.org>
+ * Copyright (C) 2012 Jinglei Ren <jinglei.ren@stanzax.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+//
+//  pressure.c
+//  Cinquain Cache
+//
+//  Shrinks R-cache on memory pressure reported by PSI.
+//
+//  A PSI trigger is armed by writing "some <stall> <window>" to a pressure
+//  file; the file then reports POLLPRI whenever tasks stall on memory for
+//  that long within a window. Kernel builds use a shrinker instead.
+//
+
+#include "cinq_cache.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+
+static int psi_fd = -1;
+static int psi_stop_fd = -1;    // eventfd to wake the monitor for exit
+static size_t psi_shrink_bytes;
+static pthread_t psi_thread;
+static pthread_mutex_t psi_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static void *psi_monitor(void *arg) {
+    struct pollfd fds[2];
+
+    fds[0].fd = psi_fd;
+    fds[0].events = POLLPRI;
+    fds[1].fd = psi_stop_fd;
+    fds[1].events = POLLIN;
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            continue; // EINTR
+        }
+        if (fds[1].revents) {
+            break;
+        }
+        if (fds[0].revents & POLLERR) {
+            break; // the pressure file is gone, e.g. the cgroup was removed
+        }
+        if (fds[0].revents & POLLPRI) {
+            rcache_shrink(psi_shrink_bytes);
+        }
+    }
+    return NULL;
+}
+
+
+int cinq_psi_start(const char *path, unsigned int stall_us, unsigned int window_us,
+                   size_t shrink_bytes) {
+    char trigger[64];
+    int len;
+
+    pthread_mutex_lock(&psi_lock);
+    if (psi_fd >= 0) {
+        goto fail;
+    }
+    psi_fd = open(path ? path : "/proc/pressure/memory", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (psi_fd < 0) {
+        goto fail;
+    }
+    len = snprintf(trigger, sizeof(trigger), "some %u %u", stall_us, window_us);
+    // the trigger string goes with its terminating NUL
+    if (write(psi_fd, trigger, len + 1) != len + 1) {
+        goto fail_close;
+    }
+    psi_stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (psi_stop_fd < 0) {
+        goto fail_close;
+    }
+    psi_shrink_bytes = shrink_bytes;
+    if (pthread_create(&psi_thread, NULL, psi_monitor, NULL) != 0) {
+        close(psi_stop_fd);
+        psi_stop_fd = -1;
+        goto fail_close;
+    }
+    pthread_mutex_unlock(&psi_lock);
+    return 0;
+
+fail_close:
+    close(psi_fd);
+    psi_fd = -1;
+fail:
+    pthread_mutex_unlock(&psi_lock);
+    return -1;
+}
+
+
+void cinq_psi_stop() {
+    unsigned long long one = 1;
+
+    pthread_mutex_lock(&psi_lock);
+    if (psi_fd < 0) {
+        pthread_mutex_unlock(&psi_lock);
+        return;
+    }
+    if (write(psi_stop_fd, &one, sizeof(one)) == sizeof(one)) {
+        pthread_join(psi_thread, NULL);
+    }
+    close(psi_stop_fd);
+    close(psi_fd);
+    psi_stop_fd = psi_fd = -1;
+    pthread_mutex_unlock(&psi_lock);
+}
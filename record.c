@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2012 Yang Zhang <yang.zhang@stanzax.org>
+ * Copyright (C) 2012 Jinglei Ren <jinglei.ren@stanzax.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "record.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+
+
+// records per thread buffer, about 64K bytes
+#define RECORD_BUF_RECS     1365
+
+struct record_buf {
+    struct list_head entry;
+    int busy;           // the owner is appending
+    int unowned;        // the owner has exited, free for reuse
+    int thread;
+    unsigned int n;
+    struct cinq_trace_rec recs[RECORD_BUF_RECS];
+};
+
+int record_on = 0;
+
+static int record_fd = -1;
+static unsigned long long record_t0;
+
+// all buffers ever handed out, guarded by record_lock
+static LIST_HEAD(record_bufs);
+static pthread_mutex_t record_lock = PTHREAD_MUTEX_INITIALIZER;
+static int record_threads = 0;
+
+static __thread struct record_buf *my_buf = NULL;
+
+// hands buffers of exiting threads back
+static pthread_key_t record_key;
+static pthread_once_t record_key_once = PTHREAD_ONCE_INIT;
+
+
+static unsigned long long mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static void write_full(int fd, const void *buf, size_t len) {
+    const char *p = (const char *) buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0) {
+            return;
+        }
+        p += n;
+        len -= n;
+    }
+}
+
+
+// O_APPEND makes each flush land whole, with no lock
+static void record_flush(struct record_buf *b) {
+    if (b->n && record_fd >= 0) {
+        write_full(record_fd, b->recs, b->n * sizeof(struct cinq_trace_rec));
+    }
+    b->n = 0;
+}
+
+
+static void record_buf_release(void *arg) {
+    struct record_buf *b = (struct record_buf *) arg;
+    pthread_mutex_lock(&record_lock);
+    record_flush(b);
+    b->unowned = 1;
+    pthread_mutex_unlock(&record_lock);
+}
+
+static void record_key_init(void) {
+    pthread_key_create(&record_key, record_buf_release);
+}
+
+
+static struct record_buf *record_buf_new(void) {
+    struct record_buf *b;
+    pthread_once(&record_key_once, record_key_init);
+
+    pthread_mutex_lock(&record_lock);
+    list_for_each_entry(b, &record_bufs, entry) {
+        if (b->unowned) {
+            b->unowned = 0;
+            goto out;
+        }
+    }
+    b = (struct record_buf *) calloc(1, sizeof(struct record_buf));
+    if (b == NULL) {
+        pthread_mutex_unlock(&record_lock);
+        return NULL;
+    }
+    list_add(&b->entry, &record_bufs);
+out:
+    b->thread = record_threads++;
+    pthread_mutex_unlock(&record_lock);
+    pthread_setspecific(record_key, b);
+    return b;
+}
+
+
+void record_op(int op, struct fingerprint *fp, offset_t offset, offset_t len) {
+    struct record_buf *b = my_buf;
+    if (b == NULL) {
+        b = my_buf = record_buf_new();
+        if (b == NULL) {
+            return;
+        }
+    }
+
+    // pairs with cinq_record_stop(): either it sees us busy and waits, or
+    // we see recording is off
+    __atomic_store_n(&b->busy, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&record_on, __ATOMIC_SEQ_CST)) {
+        struct cinq_trace_rec *r = &b->recs[b->n++];
+        r->ts = mono_ns() - record_t0;
+        r->uid = fp->uid;
+        memcpy(r->fp, fp->value, FINGERPRINT_BYTES);
+        r->offset = offset;
+        r->len = (unsigned int) len;
+        r->op = (unsigned char) op;
+        r->thread = (unsigned char) b->thread;
+        r->reserved = 0;
+        if (b->n == RECORD_BUF_RECS) {
+            record_flush(b);
+        }
+    }
+    __atomic_store_n(&b->busy, 0, __ATOMIC_RELEASE);
+}
+
+
+int cinq_record_start(const char *path) {
+    pthread_mutex_lock(&record_lock);
+    if (record_fd >= 0) {
+        pthread_mutex_unlock(&record_lock);
+        return -1;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd < 0) {
+        pthread_mutex_unlock(&record_lock);
+        return -1;
+    }
+    write_full(fd, CINQ_TRACE_MAGIC, strlen(CINQ_TRACE_MAGIC));
+    record_fd = fd;
+    record_t0 = mono_ns();
+    __atomic_store_n(&record_on, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&record_lock);
+    return 0;
+}
+
+
+void cinq_record_stop(void) {
+    pthread_mutex_lock(&record_lock);
+    if (record_fd < 0) {
+        pthread_mutex_unlock(&record_lock);
+        return;
+    }
+    __atomic_store_n(&record_on, 0, __ATOMIC_SEQ_CST);
+
+    struct record_buf *b;
+    list_for_each_entry(b, &record_bufs, entry) {
+        while (__atomic_load_n(&b->busy, __ATOMIC_SEQ_CST)) {
+            sched_yield();
+        }
+        record_flush(b);
+    }
+    close(record_fd);
+    record_fd = -1;
+    pthread_mutex_unlock(&record_lock);
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2012 Yang Zhang <yang.zhang@stanzax.org>
+ * Copyright (C) 2012 Jinglei Ren <jinglei.ren@stanzax.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+//
+//  record.h
+//  Cinquain Cache
+//
+//  Workload recording for offline replay.
+//
+//  Every public cache call is appended as a fixed-size record to a buffer
+//  of the calling thread, which goes to the trace file in one write() when
+//  full. A trace file is CINQ_TRACE_MAGIC followed by records.
+//
+
+#ifndef CINQUAIN_RECORD_H_
+#define CINQUAIN_RECORD_H_
+
+#include "cinq_cache.h"
+
+#define CINQ_TRACE_MAGIC    "CINQTRC1"
+
+// on-disk record, little endian
+struct cinq_trace_rec {
+    unsigned long long ts;      // nanoseconds since recording started
+    unsigned long long uid;
+    char fp[FINGERPRINT_BYTES];
+    unsigned long long offset;
+    unsigned int len;
+    unsigned char op;           // enum cinq_op
+    unsigned char thread;       // recording thread, modulo 256
+    unsigned short reserved;
+} __attribute__((packed));
+
+#ifdef __KERNEL__
+
+#define record_on   0
+static inline void record_op(int op, struct fingerprint *fp, offset_t offset, offset_t len) { }
+
+#else // user space
+
+extern int record_on;
+
+// Appends a record; call only if record_on.
+void record_op(int op, struct fingerprint *fp, offset_t offset, offset_t len);
+
+#endif // __KERNEL__
+
+#define RECORD(op, fp, offset, len)     do { \
+        if (record_on) { \
+            record_op((op), (fp), (offset), (len)); \
+        } \
+    } while (0)
+
+#endif // CINQUAIN_RECORD_H_
@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2012 Yang Zhang <yang.zhang@stanzax.org>
+ * Copyright (C) 2012 Jinglei Ren <jinglei.ren@stanzax.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+//
+//  replay.c
+//  Cinquain Cache
+//
+//  Replays a trace recorded by cinq_record_start() through the cache.
+//
+//  Calls run as fast as possible, in the order of their timestamps: the
+//  file holds the buffers of recording threads in flush order. With
+//  several threads, records are partitioned by fingerprint, so calls on
+//  one file keep their order.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cinq_cache.h"
+#include "record.h"
+
+
+static const struct cinq_trace_rec *recs;
+static unsigned long n_recs;
+// indexes of recs in time order
+static unsigned long *order;
+static int n_threads = 1;
+
+struct worker {
+    pthread_t tid;
+    int id;
+    unsigned long ops;
+    unsigned long bytes;
+};
+
+
+static unsigned int fp_hash(const char *fp) {
+    unsigned int h = 2166136261U;
+    int i;
+    for (i = 0; i < FINGERPRINT_BYTES; i++) {
+        h = (h ^ (unsigned char) fp[i]) * 16777619U;
+    }
+    return h;
+}
+
+
+static void *worker_run(void *arg) {
+    struct worker *w = (struct worker *) arg;
+    char *buf = NULL;
+    offset_t buf_len = 0;
+    unsigned long i;
+
+    for (i = 0; i < n_recs; i++) {
+        const struct cinq_trace_rec *r = &recs[order[i]];
+        if (n_threads > 1 && fp_hash(r->fp) % n_threads != (unsigned int) w->id) {
+            continue;
+        }
+
+        struct fingerprint fp;
+        fp.uid = r->uid;
+        memcpy(fp.value, r->fp, FINGERPRINT_BYTES);
+        struct data_entry de;
+        de.offset = r->offset;
+        de.len = r->len;
+        if (de.len > buf_len) {
+            buf = (char *) realloc(buf, de.len);
+            memset(buf, 0, de.len);
+            buf_len = de.len;
+        }
+        de.data = buf;
+
+        switch (r->op) {
+        case CINQ_OP_RGET:
+            free_data_set(rcache_get(&fp, de.offset, de.len), 1);
+            break;
+        case CINQ_OP_RPUT:
+            rcache_put(&fp, &de);
+            break;
+        case CINQ_OP_WREAD:
+            free_data_set(wcache_read(&fp, de.offset, de.len), 0);
+            break;
+        case CINQ_OP_WWRITE:
+            wcache_write(&fp, &de);
+            break;
+        case CINQ_OP_WCOLLECT:
+            free_data_set(wcache_collect(&fp), 1);
+            break;
+        default:
+            continue;
+        }
+        w->ops++;
+        w->bytes += de.len;
+    }
+
+    free(buf);
+    return NULL;
+}
+
+
+// by timestamp, then by place in the file, which keeps the order of
+// records of one thread with equal stamps
+static int by_time(const void *a, const void *b) {
+    unsigned long i = *(const unsigned long *) a, j = *(const unsigned long *) b;
+    if (recs[i].ts != recs[j].ts) {
+        return recs[i].ts < recs[j].ts ? -1 : 1;
+    }
+    return i < j ? -1 : i > j;
+}
+
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void print_latency(const char *name, const struct cinq_latency *lat) {
+    if (lat->count == 0) {
+        return;
+    }
+    printf("  %-9s %10lu ops  p50 %8lu ns  p99 %8lu ns  p999 %8lu ns  max %10lu ns\n",
+           name, lat->count, lat->p50, lat->p99, lat->p999, lat->max);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [options] trace\n"
+            "  -t threads        replay threads (1)\n",
+            prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    int c;
+    while ((c = getopt(argc, argv, "t:h")) != -1) {
+        switch (c) {
+        case 't': n_threads = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1 || n_threads <= 0) {
+        usage(argv[0]);
+    }
+
+    int fd = open(argv[optind], O_RDONLY);
+    struct stat sb;
+    if (fd < 0 || fstat(fd, &sb) != 0) {
+        perror(argv[optind]);
+        return 1;
+    }
+    size_t magic_len = strlen(CINQ_TRACE_MAGIC);
+    const char *map = NULL;
+    if ((size_t) sb.st_size >= magic_len) {
+        map = (const char *) mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    if (map == NULL || map == MAP_FAILED || memcmp(map, CINQ_TRACE_MAGIC, magic_len) != 0) {
+        fprintf(stderr, "%s: not a cache trace\n", argv[optind]);
+        return 1;
+    }
+    recs = (const struct cinq_trace_rec *) (map + magic_len);
+    n_recs = (sb.st_size - magic_len) / sizeof(struct cinq_trace_rec);
+    order = (unsigned long *) malloc((n_recs ? n_recs : 1) * sizeof(unsigned long));
+    if (order == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    unsigned long r;
+    for (r = 0; r < n_recs; r++) {
+        order[r] = r;
+    }
+    qsort(order, n_recs, sizeof(unsigned long), by_time);
+
+    rwcache_init();
+    cinq_latency_enable(1);
+
+    struct worker *workers = (struct worker *) calloc(n_threads, sizeof(struct worker));
+    double start = now_sec();
+    int i;
+    for (i = 0; i < n_threads; i++) {
+        workers[i].id = i;
+        pthread_create(&workers[i].tid, NULL, worker_run, &workers[i]);
+    }
+    unsigned long ops = 0, bytes = 0;
+    for (i = 0; i < n_threads; i++) {
+        pthread_join(workers[i].tid, NULL);
+        ops += workers[i].ops;
+        bytes += workers[i].bytes;
+    }
+    double elapsed = now_sec() - start;
+
+    struct cinq_stats st;
+    cinq_cache_stats(&st);
+
+    printf("replayed %lu of %lu records with %d threads\n", ops, n_recs, n_threads);
+    printf("  %.0f ops/s, %.1f MB/s over %.2f s\n",
+           ops / elapsed, bytes / elapsed / (1024 * 1024), elapsed);
+    printf("  hit rate %.2f%% (hits %lu, partial %lu, misses %lu), evictions %lu\n",
+           st.rget ? 100.0 * st.rget_hits / st.rget : 0.0,
+           st.rget_hits, st.rget_partial, st.rget_misses, st.evictions);
+    print_latency("rget", &st.latency[CINQ_OP_RGET]);
+    print_latency("rput", &st.latency[CINQ_OP_RPUT]);
+    print_latency("wread", &st.latency[CINQ_OP_WREAD]);
+    print_latency("wwrite", &st.latency[CINQ_OP_WWRITE]);
+    print_latency("wcollect", &st.latency[CINQ_OP_WCOLLECT]);
+
+    free(workers);
+    free(order);
+    rwcache_fini();
+    munmap((void *) map, sb.st_size);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2012 Yang Zhang <yang.zhang@stanzax.org>
+ * Copyright (C) 2012 Jinglei Ren <jinglei.ren@stanzax.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "sketch.h"
+
+#ifdef __KERNEL__
+#include <linux/vmalloc.h>
+#define ALLOC(nbytes)   vzalloc(nbytes)
+#define FREE(ptr)       vfree(ptr)
+#else
+#include <stdlib.h>
+#include <string.h>
+#define ALLOC(nbytes)   calloc(1, (nbytes))
+#define FREE(ptr)       free(ptr)
+#endif // __KERNEL__
+
+
+// per-row seeds, odd
+static const unsigned long seeds[SKETCH_DEPTH] = {
+    0x9e3779b97f4a7c15UL, 0xc2b2ae3d27d4eb4fUL, 0x165667b19e3779f9UL, 0xd6e8feb86659fd93UL,
+};
+
+
+struct sketch *sketch_create(size_t width) {
+    struct sketch *sk = (struct sketch *) ALLOC(sizeof(struct sketch));
+    unsigned long w = 64;
+    if (sk == NULL) {
+        return NULL;
+    }
+    while (w < width) {
+        w <<= 1;
+    }
+    sk->mask = w - 1;
+    sk->samples = 0;
+    sk->sample_size = 10 * w;
+    sk->counters = (unsigned char *) ALLOC(SKETCH_DEPTH * w / 2);
+    if (sk->counters == NULL) {
+        FREE(sk);
+        return NULL;
+    }
+    return sk;
+}
+
+
+void sketch_destroy(struct sketch *sk) {
+    FREE(sk->counters);
+    FREE(sk);
+}
+
+
+static inline unsigned long sketch_index(struct sketch *sk, unsigned long key, int row) {
+    unsigned long h = (key + row) * seeds[row];
+    return (unsigned long) row * (sk->mask + 1) + ((h ^ (h >> 32)) & sk->mask);
+}
+
+static inline unsigned int counter_get(struct sketch *sk, unsigned long i) {
+    return (__atomic_load_n(&sk->counters[i >> 1], __ATOMIC_RELAXED) >> ((i & 1) << 2)) & 0xf;
+}
+
+// raises counter i by one unless it is past min already
+static void counter_inc(struct sketch *sk, unsigned long i, unsigned int min) {
+    unsigned char *p = &sk->counters[i >> 1];
+    int shift = (i & 1) << 2;
+    unsigned char old = __atomic_load_n(p, __ATOMIC_RELAXED);
+    do {
+        if (((old >> shift) & 0xf) != min) {
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(p, &old, (unsigned char) (old + (1 << shift)), 1,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+
+// halves every counter, both nibbles of a byte at once
+static void sketch_age(struct sketch *sk) {
+    unsigned long i, n = SKETCH_DEPTH * (sk->mask + 1) / 2;
+    for (i = 0; i < n; i++) {
+        unsigned char c = __atomic_load_n(&sk->counters[i], __ATOMIC_RELAXED);
+        __atomic_store_n(&sk->counters[i], (unsigned char) ((c >> 1) & 0x77), __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_sub(&sk->samples, sk->sample_size - sk->sample_size / 2, __ATOMIC_RELAXED);
+}
+
+
+void sketch_add(struct sketch *sk, unsigned long key) {
+    unsigned long idx[SKETCH_DEPTH];
+    unsigned int min = SKETCH_MAX;
+    int row;
+
+    // conservative update: raise only the counters at the minimum
+    for (row = 0; row < SKETCH_DEPTH; row++) {
+        idx[row] = sketch_index(sk, key, row);
+        unsigned int c = counter_get(sk, idx[row]);
+        if (c < min) {
+            min = c;
+        }
+    }
+    if (min == SKETCH_MAX) {
+        return;
+    }
+    for (row = 0; row < SKETCH_DEPTH; row++) {
+        counter_inc(sk, idx[row], min);
+    }
+    // only the add reaching the sample size ages
+    if (__atomic_add_fetch(&sk->samples, 1, __ATOMIC_RELAXED) == sk->sample_size) {
+        sketch_age(sk);
+    }
+}
+
+
+unsigned int sketch_estimate(struct sketch *sk, unsigned long key) {
+    unsigned int min = SKETCH_MAX;
+    int row;
+    for (row = 0; row < SKETCH_DEPTH; row++) {
+        unsigned int c = counter_get(sk, sketch_index(sk, key, row));
+        if (c < min) {
+            min = c;
+        }
+    }
+    return min;
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2012 Yang Zhang <yang.zhang@stanzax.org>
+ * Copyright (C) 2012 Jinglei Ren <jinglei.ren@stanzax.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+//
+//  sketch.h
+//  Cinquain Cache
+//
+//  Count-min sketch of access frequencies for TinyLFU admission
+//  (Einziger et al., "TinyLFU: A Highly Efficient Cache Admission Policy").
+//
+//  SKETCH_DEPTH rows of 4-bit saturating counters, each row indexed by its
+//  own hash of the key. The estimate is the least of the row counters.
+//  After 10 increments per counter of a row, all counters are halved, so
+//  old popularity fades. Adds and estimates may run concurrently, with no
+//  lock: counters change by compare-and-swap, and increments racing with
+//  an aging may be lost, which only blurs the estimates. Creation and
+//  destruction are up to the caller.
+//
+
+#ifndef CINQUAIN_SKETCH_H_
+#define CINQUAIN_SKETCH_H_
+
+#include <stddef.h>
+
+#define SKETCH_DEPTH    4
+#define SKETCH_MAX      15
+
+struct sketch {
+    unsigned long mask;         // counters per row - 1, a power of two - 1
+    unsigned long samples;      // increments since the last aging
+    unsigned long sample_size;  // increments between agings
+    unsigned char *counters;    // two per byte, row after row
+};
+
+// Creates a sketch of at least width counters per row, NULL if out of memory.
+struct sketch *sketch_create(size_t width);
+
+void sketch_destroy(struct sketch *sk);
+
+// Counts an access to key.
+void sketch_add(struct sketch *sk, unsigned long key);
+
+// Estimated recent accesses to key, up to SKETCH_MAX.
+unsigned int sketch_estimate(struct sketch *sk, unsigned long key);
+
+#endif // CINQUAIN_SKETCH_H_
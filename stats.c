@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2012 Yang Zhang <yang.zhang@stanzax.org>
+ * Copyright (C) 2012 Jinglei Ren <jinglei.ren@stanzax.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "stats.h"
+
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#else
+#include <stdio.h>
+#endif // __KERNEL__
+
+
+#ifndef __KERNEL__
+
+__thread int stat_shard_self = -1;
+
+static unsigned int stat_next_shard = 0;
+
+int stat_shard_assign(void) {
+    stat_shard_self = __atomic_fetch_add(&stat_next_shard, 1, __ATOMIC_RELAXED) % STAT_N_SHARD;
+    return stat_shard_self;
+}
+
+#endif // __KERNEL__
+
+
+void stat_sum(struct stat_counters *sc, unsigned long *out) {
+    int i, c;
+    for (c = 0; c < N_STAT_COUNTER; c++) {
+        out[c] = 0;
+    }
+    for (i = 0; i < STAT_N_SHARD; i++) {
+        for (c = 0; c < N_STAT_COUNTER; c++) {
+            out[c] += __atomic_load_n(&sc->shards[i].v[c], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+
+#define STAT_FIELD(name)    { #name, offsetof(struct cinq_stats, name) }
+
+static const struct {
+    const char *name;
+    size_t offset;
+} stat_fields[] = {
+    STAT_FIELD(rget),
+    STAT_FIELD(rget_hits),
+    STAT_FIELD(rget_partial),
+    STAT_FIELD(rget_misses),
+    STAT_FIELD(rget_lockless),
+    STAT_FIELD(rget_l0),
+    STAT_FIELD(rget_bytes),
+    STAT_FIELD(rput),
+    STAT_FIELD(rput_bytes),
+    STAT_FIELD(evictions),
+    STAT_FIELD(evicted_bytes),
+    STAT_FIELD(l2_spills),
+    STAT_FIELD(l2_hits),
+    STAT_FIELD(invalidations),
+    STAT_FIELD(invalidated_bytes),
+    STAT_FIELD(admit_rejects),
+    STAT_FIELD(bg_reclaims),
+    STAT_FIELD(direct_reclaims),
+    STAT_FIELD(rcache_size),
+    STAT_FIELD(rcache_meta),
+    STAT_FIELD(rcache_limit),
+    STAT_FIELD(rcache_entries),
+    STAT_FIELD(rcache_nodes),
+    STAT_FIELD(rcache_depth),
+    STAT_FIELD(mrc_samples),
+    STAT_FIELD(wread),
+    STAT_FIELD(wwrite),
+    STAT_FIELD(wwrite_bytes),
+    STAT_FIELD(wcollect),
+    STAT_FIELD(wcollect_bytes),
+    STAT_FIELD(wsnapshots),
+    STAT_FIELD(wsnapshot_bytes),
+    STAT_FIELD(wcache_dirty),
+    STAT_FIELD(wcache_entries),
+    STAT_FIELD(wcache_nodes),
+    STAT_FIELD(wcache_depth),
+    STAT_FIELD(wlog_segments),
+    STAT_FIELD(wlog_compactions),
+    STAT_FIELD(wlog_moved_bytes),
+    STAT_FIELD(wdeferred),
+};
+
+#define N_STAT_FIELD (sizeof(stat_fields) / sizeof(stat_fields[0]))
+
+// indexed by enum cinq_op
+static const char *op_names[CINQ_N_OP] = {
+    "rget", "rput", "wread", "wwrite", "wcollect",
+};
+
+#define LAT_FIELD(name)     { #name, offsetof(struct cinq_latency, name) }
+
+static const struct {
+    const char *name;
+    size_t offset;
+} lat_fields[] = {
+    LAT_FIELD(count),
+    LAT_FIELD(p50),
+    LAT_FIELD(p99),
+    LAT_FIELD(p999),
+    LAT_FIELD(max),
+};
+
+#define N_LAT_FIELD (sizeof(lat_fields) / sizeof(lat_fields[0]))
+
+
+int cinq_cache_stats_dump(const struct cinq_stats *st, int format, char *buf, size_t size) {
+    const char *head, *line, *mrc_line, *lat_line, *sep, *tail;
+    switch (format) {
+    case CINQ_STATS_TEXT:
+        head = "";
+        line = "%s %lu\n";
+        mrc_line = "mrc_%u_%s %lu\n";
+        lat_line = "lat_%s_%s %lu\n";
+        sep = "";
+        tail = "";
+        break;
+    case CINQ_STATS_JSON:
+        head = "{";
+        line = "\"%s\":%lu";
+        mrc_line = "\"mrc_%u_%s\":%lu";
+        lat_line = "\"lat_%s_%s\":%lu";
+        sep = ",";
+        tail = "}\n";
+        break;
+    default:
+        return -1;
+    }
+
+    // keep counting when buf is full, to report the length needed
+    size_t n = 0;
+    unsigned int i, op;
+#define APPEND(...) do { \
+        int len = snprintf(n < size ? buf + n : NULL, n < size ? size - n : 0, __VA_ARGS__); \
+        if (len < 0) { \
+            return -1; \
+        } \
+        n += len; \
+    } while (0)
+
+    APPEND("%s", head);
+    for (i = 0; i < N_STAT_FIELD; i++) {
+        unsigned long v = *(const unsigned long *) ((const char *) st + stat_fields[i].offset);
+        APPEND(line, stat_fields[i].name, v);
+        APPEND("%s", sep);
+    }
+    for (i = 0; i < CINQ_MRC_POINTS; i++) {
+        APPEND(mrc_line, i, "size", st->mrc_size[i]);
+        APPEND("%s", sep);
+        APPEND(mrc_line, i, "hit_ppm", st->mrc_hit_ppm[i]);
+        APPEND("%s", sep);
+    }
+    for (op = 0; op < CINQ_N_OP; op++) {
+        for (i = 0; i < N_LAT_FIELD; i++) {
+            unsigned long v = *(const unsigned long *) ((const char *) &(st->latency[op]) + lat_fields[i].offset);
+            APPEND(lat_line, op_names[op], lat_fields[i].name, v);
+            if (op + 1 < CINQ_N_OP || i + 1 < N_LAT_FIELD) {
+                APPEND("%s", sep);
+            }
+        }
+    }
+    APPEND("%s", tail);
+#undef APPEND
+
+    return (int) n;
+}
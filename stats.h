@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2012 Yang Zhang <yang.zhang@stanzax.org>
+ * Copyright (C) 2012 Jinglei Ren <jinglei.ren@stanzax.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+//
+//  stats.h
+//  Cinquain Cache
+//
+//  Sharded event counters.
+//
+//  Each thread (CPU in kernel mode) adds to its own cache-line sized shard,
+//  so counting on hot paths writes no line shared with other threads.
+//  Shards are only summed up when statistics are requested.
+//
+
+#ifndef CINQUAIN_STATS_H_
+#define CINQUAIN_STATS_H_
+
+#include "cinq_cache.h"
+
+enum stat_counter {
+    STAT_RGET,
+    STAT_RGET_HIT,
+    STAT_RGET_PARTIAL,
+    STAT_RGET_MISS,
+    STAT_RGET_BYTES,
+    STAT_RPUT,
+    STAT_RPUT_BYTES,
+    STAT_EVICT,
+    STAT_EVICT_BYTES,
+    STAT_L2_SPILL,
+    STAT_L2_HIT,
+    STAT_INVALIDATE,
+    STAT_INVALIDATE_BYTES,
+    STAT_ADMIT_REJECT,
+    STAT_BG_RECLAIM,
+    STAT_DIRECT_RECLAIM,
+    STAT_WREAD,
+    STAT_WWRITE,
+    STAT_WWRITE_BYTES,
+    STAT_WCOLLECT,
+    STAT_WCOLLECT_BYTES,
+    STAT_WSNAPSHOT,
+    STAT_WSNAPSHOT_BYTES,
+    STAT_WLOG_COMPACT,
+    STAT_WLOG_MOVED_BYTES,
+    STAT_WDEFERRED,
+    STAT_RGET_LOCKLESS,
+    STAT_RGET_L0,
+    N_STAT_COUNTER
+};
+
+// number of shards, more threads share shards round-robin
+#define STAT_N_SHARD 64
+
+struct stat_shard {
+    unsigned long v[N_STAT_COUNTER];
+} __attribute__((aligned(64)));
+
+struct stat_counters {
+    struct stat_shard shards[STAT_N_SHARD];
+};
+
+#ifdef __KERNEL__
+
+#include <linux/smp.h>
+#define stat_shard_id()  (raw_smp_processor_id() % STAT_N_SHARD)
+
+#else // user space
+
+extern __thread int stat_shard_self;
+int stat_shard_assign(void);
+
+static inline int stat_shard_id(void) {
+    int id = stat_shard_self;
+    return id >= 0 ? id : stat_shard_assign();
+}
+
+#endif // __KERNEL__
+
+static inline void stat_add(struct stat_counters *sc, int counter, unsigned long n) {
+    // relaxed: only threads beyond STAT_N_SHARD ever contend on a shard
+    __atomic_fetch_add(&sc->shards[stat_shard_id()].v[counter], n, __ATOMIC_RELAXED);
+}
+
+#define stat_inc(sc, counter)   stat_add((sc), (counter), 1)
+
+// Sums up all shards into out[N_STAT_COUNTER].
+void stat_sum(struct stat_counters *sc, unsigned long *out);
+
+#endif // CINQUAIN_STATS_H_
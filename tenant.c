@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2012 Yang Zhang <yang.zhang@stanzax.org>
+ * Copyright (C) 2012 Jinglei Ren <jinglei.ren@stanzax.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "tenant.h"
+
+#ifdef __KERNEL__
+#include <linux/slab.h>
+#define ALLOC(nbytes)   kmalloc((nbytes), GFP_KERNEL)
+#define FREE(ptr)       kfree(ptr)
+#else
+#include <stdlib.h>
+#define ALLOC(nbytes)   malloc(nbytes)
+#define FREE(ptr)       free(ptr)
+#endif // __KERNEL__
+
+
+#define tenant_slot(uid)    ((uid) % TENANT_N_SLOT)
+
+
+// Compares a / b with c / d exactly, b and d not 0: negative, 0 or
+// positive as a / b is less, equal or greater.
+static int ratio_cmp(unsigned long a, unsigned long b, unsigned long c, unsigned long d) {
+    unsigned long x;
+    int sign = 1;
+    for (;;) {
+        if (a / b != c / d) {
+            return a / b < c / d ? -sign : sign;
+        }
+        a %= b;
+        c %= d;
+        if (a == 0 || c == 0) {
+            return a == c ? 0 : (a ? sign : -sign);
+        }
+        // a / b < c / d iff b / a > d / c
+        x = a; a = b; b = x;
+        x = c; c = d; d = x;
+        sign = -sign;
+    }
+}
+
+static void load_insert(struct tenant_table *tt, struct tenant *t) {
+    struct rb_node **new = &(tt->by_load.rb_node), *parent = NULL;
+    while (*new) {
+        struct tenant *this = rb_entry(*new, struct tenant, load_node);
+        parent = *new;
+        if (ratio_cmp(t->usage, t->weight, this->usage, this->weight) < 0) {
+            new = &((*new)->rb_left);
+        } else {
+            new = &((*new)->rb_right);
+        }
+    }
+    rb_link_node(&t->load_node, parent, new);
+    rb_insert_color(&t->load_node, &tt->by_load);
+}
+
+
+void tenant_table_init(struct tenant_table *tt) {
+    int i;
+    for (i = 0; i < TENANT_N_SLOT; i++) {
+        INIT_LIST_HEAD(&tt->slots[i]);
+    }
+    tt->by_load = RB_ROOT;
+    tt->total_weight = 0;
+    tt->n_tenant = 0;
+}
+
+
+void tenant_table_fini(struct tenant_table *tt) {
+    int i;
+    for (i = 0; i < TENANT_N_SLOT; i++) {
+        struct tenant *t, *tmp;
+        list_for_each_entry_safe(t, tmp, &tt->slots[i], entry) {
+            list_del(&t->entry);
+            FREE(t);
+        }
+    }
+    tt->by_load = RB_ROOT;
+    tt->total_weight = 0;
+    tt->n_tenant = 0;
+}
+
+
+struct tenant *tenant_find(struct tenant_table *tt, unsigned long uid) {
+    struct tenant *t;
+    list_for_each_entry(t, &tt->slots[tenant_slot(uid)], entry) {
+        if (t->uid == uid) {
+            return t;
+        }
+    }
+    return NULL;
+}
+
+
+struct tenant *tenant_get(struct tenant_table *tt, unsigned long uid) {
+    struct tenant *t = tenant_find(tt, uid);
+    if (t) {
+        return t;
+    }
+    t = (struct tenant *) ALLOC(sizeof(struct tenant));
+    if (t == NULL) {
+        return NULL;
+    }
+    t->uid = uid;
+    INIT_LIST_HEAD(&t->lru);
+    t->usage = 0;
+    t->quota = 0;
+    t->weight = TENANT_DEFAULT_WEIGHT;
+    t->gets = t->hits = t->partial = t->misses = t->evictions = 0;
+    list_add(&t->entry, &tt->slots[tenant_slot(uid)]);
+    tt->n_tenant++;
+    return t;
+}
+
+
+void tenant_set(struct tenant_table *tt, struct tenant *t, size_t quota, unsigned int weight) {
+    if (t->usage) {
+        tt->total_weight += weight;
+        tt->total_weight -= t->weight;
+        rb_erase(&t->load_node, &tt->by_load);
+    }
+    t->quota = quota;
+    t->weight = weight;
+    if (t->usage) {
+        load_insert(tt, t);
+    }
+}
+
+
+void tenant_charge(struct tenant_table *tt, struct tenant *t, long delta) {
+    if (delta == 0) {
+        return;
+    }
+    if (t->usage == 0) {
+        tt->total_weight += t->weight;
+    } else {
+        rb_erase(&t->load_node, &tt->by_load);
+    }
+    t->usage += delta;
+    if (t->usage) {
+        load_insert(tt, t);
+    } else {
+        tt->total_weight -= t->weight;
+        tenant_release(tt, t);
+    }
+}
+
+
+int tenant_release(struct tenant_table *tt, struct tenant *t) {
+    if (t->usage || t->quota || t->weight != TENANT_DEFAULT_WEIGHT) {
+        return 0;
+    }
+    list_del(&t->entry);
+    tt->n_tenant--;
+    FREE(t);
+    return 1;
+}
+
+
+struct tenant *tenant_most_over(struct tenant_table *tt, size_t limit) {
+    struct rb_node *n = rb_last(&tt->by_load);
+    if (n == NULL || n == rb_first(&tt->by_load)) {
+        // alone in the cache, nobody to be fair to
+        return NULL;
+    }
+    struct tenant *t = rb_entry(n, struct tenant, load_node);
+    // usage / weight > limit / total_weight, without overflow
+    if (ratio_cmp(t->usage, t->weight, limit, tt->total_weight) > 0) {
+        return t;
+    }
+    return NULL;
+}
+
+
+void tenant_stats(struct tenant *t, struct cinq_tenant_stats *st) {
+    st->uid = t->uid;
+    st->usage = t->usage;
+    st->quota = t->quota;
+    st->weight = t->weight;
+    st->gets = t->gets;
+    st->hits = t->hits;
+    st->partial = t->partial;
+    st->misses = t->misses;
+    st->evictions = t->evictions;
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2012 Yang Zhang <yang.zhang@stanzax.org>
+ * Copyright (C) 2012 Jinglei Ren <jinglei.ren@stanzax.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+//
+//  tenant.h
+//  Cinquain Cache
+//
+//  Per-uid accounting of R-cache capacity.
+//
+//  Every R-cache node is charged to the tenant (uid) that put it, and is
+//  on the tenant's own LRU list besides the global one. A tenant may have
+//  a hard byte quota, and a weight that sets its share of the cache when
+//  tenants compete: limit * weight / total weight of tenants holding data.
+//  Tenants holding data are kept ordered by usage per unit of weight, so
+//  the one most over its share is found in O(log n).
+//  A tenant is freed once it holds no data and has the default quota and
+//  weight. The caller serializes all calls.
+//
+
+#ifndef CINQUAIN_TENANT_H_
+#define CINQUAIN_TENANT_H_
+
+#include "cinq_cache.h"
+
+#ifdef __KERNEL__
+#include <linux/rbtree.h>
+#else
+#include "rbtree.h"
+#endif // __KERNEL__
+
+#define TENANT_N_SLOT   64
+
+#define TENANT_DEFAULT_WEIGHT   1
+
+struct tenant {
+    unsigned long uid;
+    struct list_head entry;
+    struct list_head lru;       // nodes of the tenant, newest at head
+    struct rb_node load_node;   // in by_load while usage is not 0
+    size_t usage;               // bytes charged
+    size_t quota;               // hard limit of usage, 0 for none
+    unsigned int weight;
+    unsigned long gets;
+    unsigned long hits;
+    unsigned long partial;
+    unsigned long misses;
+    unsigned long evictions;
+};
+
+struct tenant_table {
+    struct list_head slots[TENANT_N_SLOT];
+    struct rb_root by_load;     // tenants with usage, by usage / weight
+    unsigned long total_weight; // of tenants with usage
+    unsigned long n_tenant;
+};
+
+void tenant_table_init(struct tenant_table *tt);
+
+// Frees all tenants. Their LRU lists must be empty.
+void tenant_table_fini(struct tenant_table *tt);
+
+// Returns the tenant of uid, creating it if absent. NULL if out of memory.
+struct tenant *tenant_get(struct tenant_table *tt, unsigned long uid);
+
+// Returns the tenant of uid, or NULL if absent.
+struct tenant *tenant_find(struct tenant_table *tt, unsigned long uid);
+
+// Sets the quota and weight of t; weight must not be 0.
+void tenant_set(struct tenant_table *tt, struct tenant *t, size_t quota, unsigned int weight);
+
+// Adds delta (possibly negative) bytes to the usage of t. Frees t as
+// tenant_release() if its usage drops to 0.
+void tenant_charge(struct tenant_table *tt, struct tenant *t, long delta);
+
+// Frees t if it holds no data and has the default quota and weight.
+// Returns 1 if t is freed.
+int tenant_release(struct tenant_table *tt, struct tenant *t);
+
+// Returns the tenant with the most usage per unit of weight if it exceeds
+// its weighted share of limit bytes; none other does then. NULL if it does
+// not or a single tenant holds data.
+struct tenant *tenant_most_over(struct tenant_table *tt, size_t limit);
+
+void tenant_stats(struct tenant *t, struct cinq_tenant_stats *st);
+
+#endif // CINQUAIN_TENANT_H_
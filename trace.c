@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2012 Yang Zhang <yang.zhang@stanzax.org>
+ * Copyright (C) 2012 Jinglei Ren <jinglei.ren@stanzax.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "cinq_cache.h"
+#include "trace.h"
+
+#ifdef __KERNEL__
+
+const char *trace_formats[] = {
+#define TRACE_EVENT(name, fmt)  fmt "\n",
+#include "trace_events.h"
+#undef TRACE_EVENT
+};
+
+#else // user mode
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+
+__thread struct trace_ring *trace_self = NULL;
+
+// all rings ever handed out, guarded by rings_lock
+static LIST_HEAD(rings);
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int ring_threads = 0;
+
+// hands rings of exiting threads back; their records stay until reused
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+
+static void ring_release(void *arg) {
+    struct trace_ring *r = (struct trace_ring *) arg;
+    pthread_mutex_lock(&rings_lock);
+    r->unowned = 1;
+    pthread_mutex_unlock(&rings_lock);
+}
+
+static void ring_key_init(void) {
+    pthread_key_create(&ring_key, ring_release);
+    hist_clock_init();
+}
+
+
+struct trace_ring *trace_ring_get(void) {
+    struct trace_ring *r;
+    pthread_once(&ring_key_once, ring_key_init);
+
+    pthread_mutex_lock(&rings_lock);
+    list_for_each_entry(r, &rings, entry) {
+        if (r->unowned) {
+            r->unowned = 0;
+            goto out;
+        }
+    }
+    r = (struct trace_ring *) calloc(1, sizeof(struct trace_ring));
+    if (r == NULL) {
+        pthread_mutex_unlock(&rings_lock);
+        return NULL;
+    }
+    list_add_tail(&r->entry, &rings);
+out:
+    r->thread = ring_threads++;
+    pthread_mutex_unlock(&rings_lock);
+    pthread_setspecific(ring_key, r);
+    trace_self = r;
+    return r;
+}
+
+
+int trace_dump(const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        return -1;
+    }
+    struct trace_rec *copy = (struct trace_rec *) malloc(sizeof(struct trace_rec) * TRACE_RING_SIZE);
+    if (copy == NULL) {
+        fclose(f);
+        return -1;
+    }
+
+    pthread_mutex_lock(&rings_lock);
+    struct trace_file_header fh;
+    struct trace_ring *r;
+    memcpy(fh.magic, TRACE_MAGIC, sizeof(fh.magic));
+    fh.rec_size = sizeof(struct trace_rec);
+    fh.n_rings = 0;
+    list_for_each_entry(r, &rings, entry) {
+        fh.n_rings++;
+    }
+    fh.ns_per_tick = hist_ns_per_tick();
+    fwrite(&fh, sizeof(fh), 1, f);
+
+    list_for_each_entry(r, &rings, entry) {
+        // Owners keep writing while we copy. Records in [h1 - SIZE, h1)
+        // were complete when copying began; those at or below h2 - SIZE
+        // may have been overwritten meanwhile.
+        unsigned long h1 = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        memcpy(copy, r->recs, sizeof(struct trace_rec) * TRACE_RING_SIZE);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        unsigned long h2 = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+
+        unsigned long from = h1 > TRACE_RING_SIZE ? h1 - TRACE_RING_SIZE : 0;
+        if (h2 + 1 > TRACE_RING_SIZE && h2 + 1 - TRACE_RING_SIZE > from) {
+            from = h2 + 1 - TRACE_RING_SIZE;
+        }
+        struct trace_ring_header rh;
+        rh.thread = r->thread;
+        rh.n_recs = h1 > from ? (unsigned int) (h1 - from) : 0;
+        fwrite(&rh, sizeof(rh), 1, f);
+
+        unsigned long i;
+        for (i = from; i < h1; i++) {
+            fwrite(&copy[i & (TRACE_RING_SIZE - 1)], sizeof(struct trace_rec), 1, f);
+        }
+    }
+    pthread_mutex_unlock(&rings_lock);
+
+    free(copy);
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+#endif // __KERNEL__
@@ -1,20 +1,131 @@
+//
+//  trace.h
+//  Cinquain Cache
+//
+//  Binary event tracing into per-thread lock-free rings.
+//
+//  trace_event(level, id, a, b, c) stores a fixed-size record of the event
+//  id from trace_events.h, a timestamp and three integer arguments in a
+//  ring owned by the calling thread, overwriting the oldest records.
+//  Events above TRACE_LEVEL compile to nothing. trace_dump() saves all
+//  rings to a file for the 'tracedump' decoder.
+//
+//  In kernel mode events go to the ftrace buffer through trace_printk().
+//
+//  trace(fmt, ...) prints text to stderr and is kept for debugging only;
+//  it is compiled in at TRACE_DEBUG.
+//
+
 #ifndef TRACE_H_
+#define TRACE_H_
+
+#define TRACE_NONE      0
+#define TRACE_ERROR     1
+#define TRACE_INFO      2
+#define TRACE_DEBUG     3
+
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL     TRACE_INFO
+#endif // TRACE_LEVEL
+
+enum trace_event_id {
+#define TRACE_EVENT(name, fmt)  name,
+#include "trace_events.h"
+#undef TRACE_EVENT
+    N_TRACE_EVENT
+};
 
 #ifdef __KERNEL__
 
-// just ignore tracing in kernel mode
-#define trace
+extern const char *trace_formats[];
+
+#define trace_event(level, id, a, b, c) do { \
+        if ((level) <= TRACE_LEVEL) { \
+            trace_printk(trace_formats[id], (unsigned long) (a), (unsigned long) (b), (unsigned long) (c)); \
+        } \
+    } while (0)
+
+// just ignore text tracing in kernel mode
+#define trace(fmt, ...)
 
 #else // user mode
 
 #include <stdio.h>
+#include "list.h"
+#include "hist.h" // for hist_now()
+
+#define TRACE_MAGIC         "CINQEVT1"
+
+// records per thread, a power of two
+#define TRACE_RING_SIZE     4096
+
+struct trace_rec {
+    unsigned long long ts;      // ticks, see hist_now()
+    unsigned int id;            // enum trace_event_id
+    unsigned int thread;
+    unsigned long long arg[3];
+};
 
+struct trace_ring {
+    struct list_head entry;
+    unsigned long head;         // records ever written, only the owner writes
+    unsigned int thread;
+    int unowned;
+    struct trace_rec recs[TRACE_RING_SIZE];
+};
+
+// A dump file is a trace_file_header, then for each ring a
+// trace_ring_header followed by its records, oldest first.
+struct trace_file_header {
+    char magic[8];
+    unsigned int rec_size;
+    unsigned int n_rings;
+    double ns_per_tick;
+};
+
+struct trace_ring_header {
+    unsigned int thread;
+    unsigned int n_recs;
+};
+
+extern __thread struct trace_ring *trace_self;
+struct trace_ring *trace_ring_get(void);
+
+static inline void trace_emit(unsigned int id, unsigned long a, unsigned long b, unsigned long c) {
+    struct trace_ring *r = trace_self;
+    if (r == NULL && (r = trace_ring_get()) == NULL) {
+        return;
+    }
+    unsigned long h = r->head;
+    struct trace_rec *e = &r->recs[h & (TRACE_RING_SIZE - 1)];
+    e->ts = hist_now();
+    e->id = id;
+    e->thread = r->thread;
+    e->arg[0] = a;
+    e->arg[1] = b;
+    e->arg[2] = c;
+    // publish the record to trace_dump()
+    __atomic_store_n(&r->head, h + 1, __ATOMIC_RELEASE);
+}
+
+#define trace_event(level, id, a, b, c) do { \
+        if ((level) <= TRACE_LEVEL) { \
+            trace_emit((id), (unsigned long) (a), (unsigned long) (b), (unsigned long) (c)); \
+        } \
+    } while (0)
+
+// Saves the content of all rings to path. Returns 0 on success.
+int trace_dump(const char *path);
+
+#if TRACE_LEVEL >= TRACE_DEBUG
 #define trace(fmt, ...) { \
     fprintf(stderr, "%s:%d, in %s(): ", __FILE__, __LINE__, __FUNCTION__); \
     fprintf(stderr, fmt "\n", ##__VA_ARGS__); \
 }
+#else
+#define trace(fmt, ...)
+#endif // TRACE_LEVEL
 
 #endif // __KERNEL__
 
 #endif // TRACE_H_
-
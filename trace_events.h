@@ -0,0 +1,18 @@
+//
+//  trace_events.h
+//  Cinquain Cache
+//
+//  Table of binary trace events, shared by the cache and the decoder.
+//  TRACE_EVENT(name, format) where format takes up to three %lu arguments.
+//  Append new events at the end; ids are positions in this table.
+//
+
+TRACE_EVENT(EV_RGET,        "rcache_get ofst=%lu len=%lu served=%lu")
+TRACE_EVENT(EV_RPUT,        "rcache_put ofst=%lu len=%lu size=%lu")
+TRACE_EVENT(EV_EVICT,       "evict ofst=%lu len=%lu hits=%lu")
+TRACE_EVENT(EV_L2_SPILL,    "l2 spill ofst=%lu len=%lu queued=%lu")
+TRACE_EVENT(EV_L2_TAKE,     "l2 take ofst=%lu len=%lu extents=%lu")
+TRACE_EVENT(EV_WWRITE,      "wcache_write ofst=%lu len=%lu dirty=%lu")
+TRACE_EVENT(EV_WCOLLECT,    "wcache_collect extents=%lu bytes=%lu dirty=%lu")
+TRACE_EVENT(EV_INVALIDATE,   "invalidate ofst=%lu len=%lu extents=%lu")
+TRACE_EVENT(EV_WRELEASE,    "wcache_snapshot_release extents=%lu bytes=%lu dirty=%lu")
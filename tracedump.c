@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2012 Yang Zhang <yang.zhang@stanzax.org>
+ * Copyright (C) 2012 Jinglei Ren <jinglei.ren@stanzax.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+//
+//  tracedump.c
+//  Cinquain Cache
+//
+//  Decodes a file saved by trace_dump() into text, one event per line,
+//  merged across threads in time order:
+//
+//      <nanoseconds> <thread> <event text>
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cinq_cache.h"
+#include "trace.h"
+
+
+static const char *formats[] = {
+#define TRACE_EVENT(name, fmt)  fmt,
+#include "trace_events.h"
+#undef TRACE_EVENT
+};
+
+
+static int by_ts(const void *a, const void *b) {
+    const struct trace_rec *x = (const struct trace_rec *) a;
+    const struct trace_rec *y = (const struct trace_rec *) b;
+    return x->ts < y->ts ? -1 : x->ts > y->ts;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s dump-file\n", argv[0]);
+        return 1;
+    }
+    FILE *f = fopen(argv[1], "rb");
+    if (f == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    struct trace_file_header fh;
+    if (fread(&fh, sizeof(fh), 1, f) != 1 ||
+        memcmp(fh.magic, TRACE_MAGIC, sizeof(fh.magic)) != 0 ||
+        fh.rec_size != sizeof(struct trace_rec)) {
+        fprintf(stderr, "%s: not a trace dump of this build\n", argv[1]);
+        return 1;
+    }
+
+    struct trace_rec *recs = NULL;
+    size_t n = 0;
+    unsigned int i;
+    for (i = 0; i < fh.n_rings; i++) {
+        struct trace_ring_header rh;
+        if (fread(&rh, sizeof(rh), 1, f) != 1) {
+            fprintf(stderr, "%s: truncated\n", argv[1]);
+            return 1;
+        }
+        recs = (struct trace_rec *) realloc(recs, (n + rh.n_recs) * sizeof(struct trace_rec));
+        if (fread(recs + n, sizeof(struct trace_rec), rh.n_recs, f) != rh.n_recs) {
+            fprintf(stderr, "%s: truncated\n", argv[1]);
+            return 1;
+        }
+        n += rh.n_recs;
+    }
+    fclose(f);
+
+    qsort(recs, n, sizeof(struct trace_rec), by_ts);
+
+    size_t k;
+    for (k = 0; k < n; k++) {
+        struct trace_rec *r = &recs[k];
+        unsigned long long ns = (unsigned long long) ((r->ts - recs[0].ts) * fh.ns_per_tick);
+        printf("%12llu %3u ", ns, r->thread);
+        if (r->id < N_TRACE_EVENT) {
+            printf(formats[r->id], (unsigned long) r->arg[0], (unsigned long) r->arg[1], (unsigned long) r->arg[2]);
+        } else {
+            printf("unknown event %u: %llu %llu %llu", r->id, r->arg[0], r->arg[1], r->arg[2]);
+        }
+        printf("\n");
+    }
+
+    free(recs);
+    return 0;
+}
@@ -34,7 +34,19 @@
 #include <malloc.h>
 #endif // __APPLE__
 
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+
 #include "cinq_cache.h"
+#include "l2cache.h"
+#include "arena.h"
+#include "record.h"
+#include "sketch.h"
+#include "mrc.h"
+#include "epoch.h"
+#include "tenant.h"
+#include "l0.h"
 #include "trace.h"
 
 void rc_write(struct fingerprint* fpnt, offset_t ofst, offset_t len, char fill) {
@@ -82,9 +94,1751 @@ void test1() {
     printf("*** done test1\n");
 }
 
+static void release(void *arg, char *data, offset_t len) {
+    free(data);
+}
+
+static char *filled(offset_t len, char fill) {
+    char *data = (char *) malloc(len);
+    memset(data, fill, len);
+    return data;
+}
+
+// L2 on a plain file: take-back, exclusiveness and segment reuse
+void test2() {
+    printf("*** donig test2\n");
+    struct fingerprint fpnt = { .value = "t-02\0\0\0\0\0\0\0\0\0\0\0\0" };
+    struct l2_config cfg = {
+        .path = "/tmp/cinq_utest_l2",
+        .capacity = 3 * 4096,
+        .segment_size = 4096,
+        .admit = L2_ADMIT_ALL,
+    };
+    struct l2cache *l2 = l2_create(&cfg, release, NULL);
+    assert(l2);
+    
+    assert(!l2_admit(l2, 8192, 1));
+    assert(l2_put(l2, &fpnt, 0, 4000, filled(4000, 'a')) == 0);
+    assert(l2_put(l2, &fpnt, 4000, 4000, filled(4000, 'b')) == 0);
+    assert(l2_put(l2, &fpnt, 8000, 4000, filled(4000, 'c')) == 0);
+    usleep(10000); // let some reach the disk
+    
+    struct data_set *ds = l2_take(l2, &fpnt, 3000, 2000);
+    assert(ds);
+    struct data_entry *de = list_first_entry(&ds->entries, struct data_entry, entry);
+    assert(de->offset == 0 && de->len == 4000 && de->data[3999] == 'a');
+    de = list_entry(de->entry.next, struct data_entry, entry);
+    assert(de->offset == 4000 && de->data[0] == 'b');
+    printf("took 2 extents from L2\n");
+    free_data_set(ds, 1);
+    assert(l2_take(l2, &fpnt, 0, 8000) == NULL);
+    
+    // wraps around to the first segment
+    assert(l2_put(l2, &fpnt, 20000, 4000, filled(4000, 'd')) == 0);
+    assert(l2_put(l2, &fpnt, 24000, 4000, filled(4000, 'e')) == 0);
+    assert(l2_put(l2, &fpnt, 28000, 4000, filled(4000, 'f')) == 0);
+    ds = l2_take(l2, &fpnt, 0, 40000);
+    assert(ds);
+    offset_t n = 0;
+    list_for_each_entry(de, &ds->entries, entry) {
+        assert(de->data[0] != 'c'); // reused segment dropped it
+        n++;
+    }
+    assert(n == 3);
+    printf("took %ld extents after wrap-around\n", n);
+    free_data_set(ds, 1);
+    
+    l2_destroy(l2);
+    unlink(cfg.path);
+    printf("*** done test2\n");
+}
+
+// size classes of the arena, and R-cache data carved from it
+void test3() {
+    printf("*** donig test3\n");
+    struct arena *a = arena_create(4 * 1024 * 1024);
+    assert(a);
+    printf("arena backing: %d\n", arena_backing(a));
+    
+    char *p = (char *) arena_alloc(a, 100);
+    char *q = (char *) arena_alloc(a, 112);
+    assert(p && q && arena_contains(a, p) && q - p == 112);
+    arena_free(a, p, 100);
+    assert(arena_alloc(a, 97) == p); // same class, recycled
+    assert(arena_alloc(a, ARENA_MAX_BLOCK + 1) == NULL);
+    assert(!arena_contains(a, &p));
+    arena_destroy(a);
+    
+    // restart with an empty R-cache
+    rwcache_fini();
+    rwcache_init();
+    assert(rcache_arena_enable(4 * 1024 * 1024) == 0);
+    struct fingerprint fpnt = { .value = "t-03\0\0\0\0\0\0\0\0\0\0\0\0" };
+    rc_write(&fpnt, 0, 5, 'a');
+    rc_write(&fpnt, 2, 6, 'b');
+    rc_print(&fpnt, 0, 10);
+    printf("*** done test3\n");
+}
+
+// counters and both dump formats
+void test4() {
+    printf("*** donig test4\n");
+    struct cinq_stats before, after;
+    struct fingerprint fpnt = { .value = "t-04\0\0\0\0\0\0\0\0\0\0\0\0" };
+    
+    cinq_latency_enable(1);
+    cinq_cache_stats(&before);
+    cinq_cache_index_stats(&before);
+    rc_write(&fpnt, 0, 4, 'a');
+    rc_write(&fpnt, 8, 4, 'b');
+    rc_print(&fpnt, 0, 4);  // hit
+    rc_print(&fpnt, 0, 12); // partial
+    rc_print(&fpnt, 20, 4); // miss
+    cinq_cache_stats(&after);
+    assert(after.rcache_nodes == 0 && after.wcache_depth == 0); // not walked
+    cinq_cache_index_stats(&after);
+    
+    assert(after.rput - before.rput == 2);
+    assert(after.rget_hits - before.rget_hits == 1);
+    assert(after.rget_partial - before.rget_partial == 1);
+    assert(after.rget_misses - before.rget_misses == 1);
+    assert(after.rget_bytes - before.rget_bytes == 12);
+    assert(after.rcache_nodes - before.rcache_nodes == 2);
+#ifndef CINQ_NO_LATENCY
+    assert(after.latency[CINQ_OP_RGET].count == 3);
+    assert(after.latency[CINQ_OP_RPUT].count == 2);
+    assert(after.latency[CINQ_OP_RGET].p50 <= after.latency[CINQ_OP_RGET].p999);
+    assert(after.latency[CINQ_OP_RGET].p999 <= after.latency[CINQ_OP_RGET].max);
+#endif // CINQ_NO_LATENCY
+    cinq_latency_enable(0);
+    
+    char buf[4096];
+    int n = cinq_cache_stats_dump(&after, CINQ_STATS_JSON, buf, sizeof(buf));
+    assert(n > 0 && n < (int) sizeof(buf) && buf[0] == '{');
+    assert(cinq_cache_stats_dump(&after, CINQ_STATS_TEXT, NULL, 0) > 0);
+    printf("%s", buf);
+    printf("*** done test4\n");
+}
+
+// a recorded trace holds one record per call, in order
+void test5() {
+    printf("*** donig test5\n");
+    const char *path = "/tmp/cinq_utest_trace";
+    struct fingerprint fpnt = { .uid = 7, .value = "t-05\0\0\0\0\0\0\0\0\0\0\0\0" };
+    
+    assert(cinq_record_start(path) == 0);
+    assert(cinq_record_start(path) == -1);
+    rc_write(&fpnt, 100, 10, 'r');
+    rc_print(&fpnt, 100, 10);
+    free_data_set(wcache_collect(&fpnt), 1);
+    cinq_record_stop();
+    rc_print(&fpnt, 100, 10); // not recorded
+    
+    FILE *f = fopen(path, "rb");
+    assert(f);
+    char magic[8];
+    assert(fread(magic, 1, 8, f) == 8 && memcmp(magic, CINQ_TRACE_MAGIC, 8) == 0);
+    struct cinq_trace_rec r[4];
+    assert(fread(r, sizeof(struct cinq_trace_rec), 4, f) == 3);
+    fclose(f);
+    assert(r[0].op == CINQ_OP_RPUT && r[0].offset == 100 && r[0].len == 10 && r[0].uid == 7);
+    assert(r[1].op == CINQ_OP_RGET && r[1].ts >= r[0].ts);
+    assert(r[2].op == CINQ_OP_WCOLLECT && memcmp(r[2].fp, fpnt.value, FINGERPRINT_BYTES) == 0);
+    printf("recorded 3 calls\n");
+    unlink(path);
+    printf("*** done test5\n");
+}
+
+// binary events land in the ring of the thread, oldest overwritten
+void test6() {
+    printf("*** donig test6\n");
+    const char *path = "/tmp/cinq_utest_events";
+    unsigned long i;
+    for (i = 0; i < TRACE_RING_SIZE + 10; i++) {
+        trace_event(TRACE_ERROR, EV_RGET, i, 1, 2);
+    }
+    assert(trace_dump(path) == 0);
+    
+    FILE *f = fopen(path, "rb");
+    assert(f);
+    struct trace_file_header fh;
+    struct trace_ring_header rh;
+    assert(fread(&fh, sizeof(fh), 1, f) == 1 && memcmp(fh.magic, TRACE_MAGIC, 8) == 0);
+    assert(fh.n_rings == 1);
+    // the oldest slot may be under rewrite while dumping, so it is skipped
+    assert(fread(&rh, sizeof(rh), 1, f) == 1 && rh.n_recs == TRACE_RING_SIZE - 1);
+    struct trace_rec first;
+    assert(fread(&first, sizeof(first), 1, f) == 1);
+    assert(first.id == EV_RGET && first.arg[0] >= 10);
+    fclose(f);
+    printf("dumped %u events\n", rh.n_recs);
+    unlink(path);
+    printf("*** done test6\n");
+}
+
+// extents are charged to their uid, which a quota caps
+void test7() {
+    printf("*** donig test7\n");
+    struct fingerprint fpnt = { .uid = 100, .value = "t-07\0\0\0\0\0\0\0\0\0\0\0\0" };
+    struct cinq_tenant_stats ts;
+    
+    assert(rcache_tenant_stats(100, &ts) == -1);
+    assert(rcache_set_quota(100, 8, 0) == -1);
+    assert(rcache_set_quota(100, 8, 2) == 0);
+    rc_write(&fpnt, 0, 4, 'a');
+    rc_write(&fpnt, 4, 4, 'b');
+    rc_print(&fpnt, 0, 4);  // hit, so 'b' is older than 'a'
+    rc_write(&fpnt, 8, 4, 'c');
+    rc_print(&fpnt, 4, 4);  // 'b' evicted
+    
+    assert(rcache_tenant_stats(100, &ts) == 0);
+    assert(ts.usage == 8 && ts.quota == 8 && ts.weight == 2);
+    assert(ts.evictions == 1);
+    assert(ts.gets == 2 && ts.hits == 1 && ts.misses == 1);
+    
+    // lowering the quota evicts at once
+    assert(rcache_set_quota(100, 4, 1) == 0);
+    assert(rcache_tenant_stats(100, &ts) == 0 && ts.usage == 4 && ts.evictions == 2);
+    
+    // readers alone make no tenant, and one left with nothing is freed
+    struct fingerprint other = { .uid = 101, .value = "t-07b\0\0\0\0\0\0\0\0\0\0\0" };
+    rc_print(&other, 0, 4);
+    assert(rcache_tenant_stats(101, &ts) == -1);
+    rc_write(&other, 0, 4, 'd');
+    assert(rcache_tenant_stats(101, &ts) == 0 && ts.usage == 4);
+    rcache_invalidate(&other, 0, 4);
+    assert(rcache_tenant_stats(101, &ts) == -1);
+    assert(rcache_set_quota(100, 0, 1) == 0);
+    assert(rcache_tenant_stats(100, &ts) == 0 && ts.usage == 4);
+    printf("*** done test7\n");
+}
+
+static offset_t rc_served(struct fingerprint *fpnt, offset_t ofst, offset_t len) {
+    struct data_set *ds = rcache_get(fpnt, ofst, len);
+    struct data_entry *de;
+    offset_t n = 0;
+    if (ds) {
+        list_for_each_entry(de, &(ds->entries), entry) {
+            n += de->len;
+        }
+    }
+    free_data_set(ds, 1);
+    return n;
+}
+
+// stale ranges and files stop being served
+void test8() {
+    printf("*** donig test8\n");
+    struct fingerprint fpnt = { .value = "t-08\0\0\0\0\0\0\0\0\0\0\0\0" };
+    struct fingerprint other = { .value = "t-08b\0\0\0\0\0\0\0\0\0\0\0" };
+    struct cinq_stats before, after;
+    
+    cinq_cache_stats(&before);
+    rc_write(&fpnt, 0, 4, 'a');
+    rc_write(&fpnt, 4, 4, 'b');
+    rc_write(&fpnt, 8, 4, 'c');
+    rcache_invalidate(&fpnt, 5, 1);
+    assert(rc_served(&fpnt, 0, 12) == 8);
+    rc_write(&fpnt, 4, 4, 'B');
+    assert(rc_served(&fpnt, 0, 12) == 12);
+    
+    rcache_invalidate_file(&fpnt);
+    assert(rc_served(&fpnt, 0, 12) == 0);
+    rc_write(&other, 0, 4, 'x'); // reaps the doomed nodes
+    rc_write(&fpnt, 0, 4, 'A');
+    assert(rc_served(&fpnt, 0, 12) == 4);
+    cinq_cache_stats(&after);
+    assert(after.invalidations - before.invalidations == 2);
+    assert(after.invalidated_bytes - before.invalidated_bytes == 16);
+    printf("*** done test8\n");
+}
+
+// emptied hash entries go away along with their metadata bytes
+void test9() {
+    printf("*** donig test9\n");
+    struct fingerprint fpnt = { .value = "t-09\0\0\0\0\0\0\0\0\0\0\0\0" };
+    struct cinq_stats before, st;
+    
+    cinq_cache_stats(&before);
+    cinq_cache_index_stats(&before);
+    rc_write(&fpnt, 0, 4, 'a');
+    rc_write(&fpnt, 8, 4, 'b');
+    cinq_cache_stats(&st);
+    cinq_cache_index_stats(&st);
+    assert(st.rcache_entries == before.rcache_entries + 1);
+    assert(st.rcache_meta > before.rcache_meta);
+    rcache_invalidate(&fpnt, 0, 12);
+    cinq_cache_stats(&st);
+    cinq_cache_index_stats(&st);
+    assert(st.rcache_entries == before.rcache_entries);
+    assert(st.rcache_meta == before.rcache_meta);
+    
+    struct data_entry de = { .data = "w", .offset = 0, .len = 1 };
+    wcache_write(&fpnt, &de);
+    free_data_set(wcache_collect(&fpnt), 1);
+    cinq_cache_stats(&st);
+    cinq_cache_index_stats(&st);
+    assert(st.wcache_entries == before.wcache_entries);
+    printf("*** done test9\n");
+}
+
+// lookups from the finger agree with a scan, whatever the access order
+void test10() {
+    printf("*** donig test10\n");
+    struct fingerprint fpnt = { .value = "t-10\0\0\0\0\0\0\0\0\0\0\0\0" };
+    offset_t i, seed = 1;
+    
+    // extents [8k, 8k + 4) with gaps between them
+    for (i = 0; i < 64; i++) {
+        rc_write(&fpnt, i * 8, 4, 'f');
+    }
+    for (i = 0; i < 3000; i++) {
+        offset_t ofst, len;
+        if (i < 1000) {
+            ofst = i % 520;         // forward
+            len = 1 + i % 13;
+        } else if (i < 2000) {
+            ofst = 2000 - i;        // backward
+            len = 1 + i % 7;
+        } else {
+            seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+            ofst = (seed >> 33) % 530;
+            len = 1 + (seed >> 20) % 40;
+        }
+        offset_t want = 0, k;
+        for (k = 0; k < 64; k++) {
+            if (k * 8 < ofst + len && ofst < k * 8 + 4) {
+                want += 4;
+            }
+        }
+        assert(rc_served(&fpnt, ofst, len) == want);
+    }
+    rcache_invalidate_file(&fpnt);
+    printf("*** done test10\n");
+}
+
+// handles pin the entries of a file and survive its invalidation
+void test11() {
+    printf("*** donig test11\n");
+    struct fingerprint fpnt = { .value = "t-11\0\0\0\0\0\0\0\0\0\0\0\0" };
+    struct cinq_stats before, st;
+    char buf[8];
+    struct data_entry de = { .data = buf, .offset = 0, .len = 8 };
+    struct data_set *ds;
+    
+    memset(buf, 'h', sizeof(buf));
+    cinq_cache_stats(&before);
+    cinq_cache_index_stats(&before);
+    struct cinq_handle *h = cinq_open(&fpnt);
+    struct cinq_handle *h2 = cinq_open(&fpnt);
+    assert(h && h2);
+    rcache_put_h(h, &de);
+    assert(rc_served(&fpnt, 0, 8) == 8);
+    rcache_invalidate(&fpnt, 0, 8);
+    ds = rcache_get_h(h2, 0, 8);
+    assert(ds && list_empty(&(ds->entries))); // emptied but still pinned
+    free_data_set(ds, 1);
+    
+    rcache_put_h(h, &de);
+    rcache_invalidate_file(&fpnt);
+    ds = rcache_get_h(h, 0, 8);
+    assert(ds && list_empty(&(ds->entries)));
+    free_data_set(ds, 1);
+    rcache_put_h(h, &de);
+    assert(rc_served(&fpnt, 0, 8) == 8);
+    
+    assert(wcache_write_h(h2, &de) == 0);
+    ds = wcache_read_h(h, 4, 1);
+    assert(ds && list_entry(ds->entries.next, struct data_entry, entry)->len == 8);
+    free_data_set(ds, 0);
+    free_data_set(wcache_collect_h(h), 1);
+    assert(wcache_collect_h(h) == NULL);
+    
+    cinq_close(h);
+    cinq_close(h2);
+    rcache_invalidate(&fpnt, 0, 8);
+    cinq_cache_stats(&st);
+    cinq_cache_index_stats(&st);
+    assert(st.rcache_entries == before.rcache_entries);
+    assert(st.wcache_entries == before.wcache_entries);
+    printf("*** done test11\n");
+}
+
+// the sketch counts up to its cap and forgets by halves
+void test12() {
+    printf("*** donig test12\n");
+    struct sketch *sk = sketch_create(1000);
+    unsigned long i;
+    
+    assert(sk && sk->mask + 1 == 1024);
+    for (i = 0; i < 5; i++) {
+        sketch_add(sk, 42);
+    }
+    for (i = 0; i < 20; i++) {
+        sketch_add(sk, 7);
+    }
+    assert(sketch_estimate(sk, 42) >= 5);
+    assert(sketch_estimate(sk, 7) == SKETCH_MAX);
+    assert(sketch_estimate(sk, 12345) <= 1);
+    
+    // one-hit keys until aging kicks in
+    unsigned long last = 0;
+    for (i = 1000; sk->samples >= last; i++) {
+        last = sk->samples;
+        sketch_add(sk, i);
+    }
+    assert(sketch_estimate(sk, 7) < SKETCH_MAX);
+    sketch_destroy(sk);
+    
+    assert(rcache_tinylfu_enable(4096) == 0);
+    assert(rcache_tinylfu_enable(0) == 0);
+    printf("*** done test12\n");
+}
+
+// GDSF is set on an empty R-cache and keeps serving data
+void test13() {
+    printf("*** donig test13\n");
+    struct fingerprint fpnt = { .value = "t-13\0\0\0\0\0\0\0\0\0\0\0\0" };
+    
+    assert(rcache_set_policy(CINQ_EVICT_GDSF) == -1); // holds data
+    rwcache_fini();
+    rwcache_init();
+    assert(rcache_set_policy(42) == -1);
+    assert(rcache_set_policy(CINQ_EVICT_GDSF) == 0);
+    rc_write(&fpnt, 0, 4, 'a');
+    rc_write(&fpnt, 4, 4000, 'b');
+    assert(rc_served(&fpnt, 0, 4) == 4);
+    assert(rc_served(&fpnt, 0, 8) == 4004);
+    rcache_invalidate(&fpnt, 0, 4);
+    assert(rc_served(&fpnt, 0, 8) == 4000);
+    
+    rwcache_fini();
+    rwcache_init();
+    printf("*** done test13\n");
+}
+
+void test14() {
+    printf("*** donig test14\n");
+    struct fingerprint fpnt = { .value = "t-14\0\0\0\0\0\0\0\0\0\0\0\0" };
+    struct cinq_ring *r = cinq_ring_create(5, 2); // rounded up to 8
+    struct cinq_sqe *sqe;
+    struct cinq_cqe cqes[8];
+    char buf[8][16];
+    unsigned int i, n = 0;
+    
+    assert(r);
+    for (i = 0; i < 8; i++) {
+        sqe = cinq_get_sqe(r);
+        assert(sqe);
+        memset(buf[i], 'a' + i, 16);
+        sqe->op = CINQ_OP_RPUT;
+        sqe->fp = fpnt;
+        sqe->de.data = buf[i];
+        sqe->de.offset = i * 16;
+        sqe->de.len = 16;
+        sqe->user_data = i;
+    }
+    assert(cinq_get_sqe(r) == NULL); // full until reaped
+    assert(cinq_submit(r) == 8);
+    while (n < 8) {
+        n += cinq_reap(r, cqes + n, 8 - n, 1);
+    }
+    unsigned int seen = 0;
+    for (i = 0; i < 8; i++) {
+        assert(cqes[i].res == 0 && cqes[i].ds == NULL);
+        seen |= 1 << cqes[i].user_data;
+    }
+    assert(seen == 0xff);
+    assert(rc_served(&fpnt, 0, 128) == 128);
+    
+    struct cinq_handle *h = cinq_open(&fpnt);
+    for (i = 0; i < 4; i++) {
+        sqe = cinq_get_sqe(r);
+        sqe->op = CINQ_OP_RGET;
+        sqe->handle = h;
+        sqe->de.offset = i * 32;
+        sqe->de.len = 32;
+        sqe->user_data = 100 + i;
+    }
+    sqe = cinq_get_sqe(r);
+    sqe->op = -1;
+    sqe->user_data = 200;
+    assert(cinq_submit(r) == 5);
+    assert(cinq_reap(r, cqes, 8, 8) == 5); // min is capped by what is in flight
+    for (i = 0; i < 5; i++) {
+        if (cqes[i].user_data == 200) {
+            assert(cqes[i].res == -1);
+            continue;
+        }
+        struct data_entry *de;
+        offset_t got = 0;
+        assert(cqes[i].ds);
+        list_for_each_entry(de, &(cqes[i].ds->entries), entry) {
+            assert(de->data[0] == (char) ('a' + de->offset / 16));
+            got += de->len;
+        }
+        assert(got == 32);
+        free_data_set(cqes[i].ds, 1);
+    }
+    
+    if (cinq_ring_fd(r) >= 0) {
+        unsigned long long cnt = 0;
+        assert(read(cinq_ring_fd(r), &cnt, sizeof(cnt)) == sizeof(cnt) && cnt >= 2);
+    }
+    sqe = cinq_get_sqe(r);
+    sqe->op = CINQ_OP_RGET;
+    sqe->fp = fpnt;
+    sqe->de.offset = 0;
+    sqe->de.len = 16;
+    cinq_submit(r);
+    cinq_ring_destroy(r); // runs the get and drops its completion
+    cinq_close(h);
+    rcache_invalidate_file(&fpnt);
+    printf("*** done test14\n");
+}
+
+void test15() {
+    printf("*** donig test15\n");
+    struct fingerprint fpnt = { .value = "t-15\0\0\0\0\0\0\0\0\0\0\0\0" };
+    struct cinq_stats st;
+    struct data_entry de;
+    int i;
+    
+    assert(rcache_reclaimer_start(0, 50) == -1);
+    assert(rcache_reclaimer_start(50, 50) == -1);
+    assert(rcache_reclaimer_start(50, 100) == -1);
+    assert(rcache_reclaimer_start(1, 2) == 0);
+    assert(rcache_reclaimer_start(1, 2) == -1);
+    cinq_cache_stats(&st);
+    unsigned long high = st.rcache_limit / 100 * 2, direct = st.direct_reclaims;
+    
+    de.len = 1024 * 1024;
+    de.data = (char *) calloc(1, de.len);
+    for (i = 0; i < 16; i++) { // past 2% of the limit, short of the limit
+        de.offset = i * de.len;
+        rcache_put(&fpnt, &de);
+    }
+    for (i = 0; i < 1000; i++) {
+        cinq_cache_stats(&st);
+        if (st.bg_reclaims && st.rcache_size + st.rcache_meta < high) {
+            break;
+        }
+        usleep(1000);
+    }
+    assert(st.bg_reclaims && st.rcache_size + st.rcache_meta < high);
+    assert(st.direct_reclaims == direct);
+    
+    rcache_reclaimer_stop();
+    assert(rcache_reclaimer_start(1, 2) == 0);
+    rcache_reclaimer_stop();
+    free(de.data);
+    rcache_invalidate_file(&fpnt);
+    printf("*** done test15\n");
+}
+
+void test16() {
+    printf("*** donig test16\n");
+    struct fingerprint fpnt = { .value = "t-16\0\0\0\0\0\0\0\0\0\0\0\0" };
+    struct cinq_stats st;
+    struct data_entry de;
+    int i;
+    
+    de.len = 1024 * 1024;
+    de.data = (char *) calloc(1, de.len);
+    for (i = 0; i < 24; i++) {
+        de.offset = i * de.len;
+        rcache_put(&fpnt, &de);
+    }
+    assert(rcache_set_limit(0) == -1);
+    assert(rcache_set_limit(16 * de.len) == 0);
+    cinq_cache_stats(&st);
+    assert(st.rcache_limit == 16 * de.len);
+    assert(st.rcache_size + st.rcache_meta < st.rcache_limit);
+    assert(st.rcache_size > 8 * de.len); // cut in steps, not emptied
+    
+    unsigned long size = st.rcache_size;
+    assert(rcache_shrink(2 * de.len) >= 2 * de.len);
+    cinq_cache_stats(&st);
+    assert(st.rcache_size <= size - 2 * de.len);
+    assert(st.rcache_limit == 16 * de.len);
+    
+    assert(rcache_set_limit(1024 * 1024 * 512) == 0);
+    for (i = 0; i < 24; i++) {
+        de.offset = i * de.len;
+        rcache_put(&fpnt, &de);
+    }
+    assert(rc_served(&fpnt, 0, 24 * de.len) == 24 * de.len);
+    
+    assert(cinq_psi_start("/nonexistent/memory.pressure", 100000, 1000000, de.len) == -1);
+    if (cinq_psi_start(NULL, 100000, 2000000, de.len) == 0) {
+        assert(cinq_psi_start(NULL, 100000, 2000000, de.len) == -1);
+        cinq_psi_stop();
+    }
+    cinq_psi_stop(); // no monitor
+    free(de.data);
+    rcache_invalidate_file(&fpnt);
+    printf("*** done test16\n");
+}
+
+void test17() {
+    printf("*** donig test17\n");
+    struct fingerprint fpnt = { .value = "t-17\0\0\0\0\0\0\0\0\0\0\0\0" };
+    struct cinq_stats st;
+    unsigned long i;
+    
+    // a loop over 1000 keys, every key sampled: reuse distance 999
+    struct mrc *m = mrc_create(1, 4096);
+    assert(m);
+    for (i = 0; i < 10 * 1000; i++) {
+        mrc_access(m, (i % 1000 + 1) * 0x9e3779b97f4a7c15UL);
+    }
+    assert(m->cold == 1000 && m->samples == 10000);
+    assert(mrc_hit_ppm(m, 2048) == 900000);
+    assert(mrc_hit_ppm(m, 512) == 0);
+    mrc_destroy(m);
+    
+    // a loop over 4096 keys with room for 64 samples: the rate drops
+    m = mrc_create(1, 64);
+    for (i = 0; i < 20 * 4096; i++) {
+        mrc_access(m, (i % 4096 + 1) * 0x9e3779b97f4a7c15UL);
+    }
+    assert(m->n_keys <= 64 && m->threshold < (1UL << MRC_P_BITS) / 32);
+    assert(mrc_hit_ppm(m, 8192) > 800000);
+    assert(mrc_hit_ppm(m, 1024) < 100000);
+    mrc_destroy(m);
+    
+    assert(rcache_mrc_hit_ppm(4096) == 0);
+    assert(rcache_mrc_enable(1) == 0);
+    for (i = 0; i < 4; i++) {
+        free_data_set(rcache_get(&fpnt, 0, 4 * 4096), 1);
+    }
+    cinq_cache_stats(&st);
+    assert(st.mrc_samples == 16);
+    assert(st.mrc_size[3] == st.rcache_limit && st.mrc_size[0] == st.rcache_limit / 8);
+    assert(st.mrc_hit_ppm[0] == 750000); // all but the first pass
+    assert(rcache_mrc_hit_ppm(4096) == 0);
+    assert(rcache_mrc_enable(0) == 0);
+    cinq_cache_stats(&st);
+    assert(st.mrc_samples == 0 && st.mrc_hit_ppm[3] == 0);
+    printf("*** done test17\n");
+}
+
+void test18() {
+    printf("*** donig test18\n");
+    struct fingerprint fpnt = { .value = "t-18\0\0\0\0\0\0\0\0\0\0\0\0" };
+    struct cinq_config cfg = { .limit = 64 * 1024, .slots = 16, .policy = CINQ_EVICT_LRU };
+    struct cinq_stats st, st_a, st_b;
+    char buf[4096];
+    unsigned long i;
+    
+    cfg.policy = -1;
+    assert(cinq_cache_create(&cfg) == NULL);
+    cfg.policy = CINQ_EVICT_LRU;
+    struct cinq_cache *a = cinq_cache_create(&cfg);
+    cfg.policy = CINQ_EVICT_GDSF;
+    struct cinq_cache *b = cinq_cache_create(&cfg);
+    assert(a && b);
+    cinq_cache_stats(&st);
+    
+    // the same file in two caches holds different data
+    struct data_entry de = { .data = buf, .offset = 0, .len = sizeof(buf) };
+    memset(buf, 'a', sizeof(buf));
+    cinq_rcache_put(a, &fpnt, &de);
+    memset(buf, 'b', sizeof(buf));
+    cinq_rcache_put(b, &fpnt, &de);
+    struct data_set *ds = cinq_rcache_get(a, &fpnt, 0, sizeof(buf));
+    assert(list_first_entry(&ds->entries, struct data_entry, entry)->data[0] == 'a');
+    free_data_set(ds, 1);
+    struct cinq_handle *h = cinq_cache_open(b, &fpnt);
+    ds = rcache_get_h(h, 0, sizeof(buf));
+    assert(list_first_entry(&ds->entries, struct data_entry, entry)->data[0] == 'b');
+    free_data_set(ds, 1);
+    cinq_close(h);
+    assert(rcache_get(&fpnt, 0, sizeof(buf)) == NULL);
+    
+    // each cache evicts against its own limit
+    for (i = 1; i < 64; i++) {
+        de.offset = i * sizeof(buf);
+        cinq_rcache_put(a, &fpnt, &de);
+    }
+    cinq_cache_get_stats(a, &st_a);
+    cinq_cache_get_stats(b, &st_b);
+    assert(st_a.rcache_limit == 64 * 1024 && st_a.rcache_size + st_a.rcache_meta <= 64 * 1024);
+    assert(st_a.evictions > 0 && st_a.rput == 64 && st_a.rget_hits == 1);
+    assert(st_b.evictions == 0 && st_b.rput == 1 && st_b.rget_hits == 1);
+    
+    assert(cinq_wcache_write(b, &fpnt, &de) == 0);
+    assert(cinq_wcache_read(a, &fpnt, de.offset, de.len) == NULL);
+    cinq_cache_destroy(a);
+    cinq_cache_destroy(b);
+    
+    // the default cache saw none of it
+    struct cinq_stats st2;
+    cinq_cache_stats(&st2);
+    assert(st2.rput == st.rput && st2.wwrite == st.wwrite && st2.evictions == st.evictions);
+    assert(st2.rget == st.rget + 1);
+    printf("*** done test18\n");
+}
+
+void test19() {
+    printf("*** donig test19\n");
+    struct fingerprint fpnt = { .value = "t-19\0\0\0\0\0\0\0\0\0\0\0\0" };
+    struct fingerprint other = { .value = "t-19-other\0\0\0\0\0\0" };
+    struct cinq_config cfg = { .limit = 1024 * 1024, .slots = 64 };
+    struct cinq_node_stats ns;
+    struct cinq_stats st;
+    char buf[4096];
+    int i;
+    
+    struct cinq_numa *n = cinq_numa_create(&cfg, 2 * 1024 * 1024);
+    assert(n && cinq_numa_shards(n) >= 1);
+    assert(cinq_numa_shard(n, cinq_numa_shards(n)) == NULL);
+    assert(cinq_numa_node_stats(n, -1, &ns) == -1);
+    cinq_numa_latency_enable(n, 1);
+    
+    struct data_entry de = { .data = buf, .offset = 0, .len = sizeof(buf) };
+    memset(buf, 'n', sizeof(buf));
+    cinq_numa_rcache_put(n, &fpnt, &de);
+    struct data_set *ds = cinq_numa_rcache_get(n, &fpnt, 0, sizeof(buf));
+    assert(ds && list_first_entry(&ds->entries, struct data_entry, entry)->data[0] == 'n');
+    free_data_set(ds, 1);
+    assert(cinq_numa_rcache_get(n, &other, 0, sizeof(buf)) == NULL);
+    
+    // the traffic lands on the node of this thread, wherever it ran
+    unsigned long rget = 0, hits = 0, misses = 0, bytes = 0, rput = 0;
+    for (i = 0; i < cinq_numa_shards(n); i++) {
+        assert(cinq_numa_node_stats(n, i, &ns) == 0);
+        rget += ns.rget;
+        hits += ns.local_hits + ns.remote_hits;
+        misses += ns.misses;
+        bytes += ns.local_bytes + ns.remote_bytes;
+        rput += ns.rput;
+    }
+    assert(rget == 2 && hits == 1 && misses == 1 && bytes == sizeof(buf) && rput == 1);
+#ifndef CINQ_NO_LATENCY
+    // timed in whichever shards served them, summed up across all
+    struct cinq_latency lat[CINQ_N_OP];
+    cinq_numa_latency(n, lat);
+    assert(lat[CINQ_OP_RPUT].count == 1 && lat[CINQ_OP_RGET].count >= 2);
+#endif // CINQ_NO_LATENCY
+    
+    // invalidation reaches every shard
+    cinq_numa_rcache_invalidate_file(n, &fpnt);
+    assert(cinq_numa_rcache_get(n, &fpnt, 0, sizeof(buf)) == NULL);
+    for (i = 0; i < cinq_numa_shards(n); i++) {
+        assert(cinq_rcache_get(cinq_numa_shard(n, i), &fpnt, 0, sizeof(buf)) == NULL);
+        cinq_cache_get_stats(cinq_numa_shard(n, i), &st);
+        assert(st.invalidations <= 2); // one by the put from another node
+    }
+    
+    assert(cinq_numa_wcache_write(n, &fpnt, &de) == 0);
+    ds = cinq_numa_wcache_read(n, &fpnt, 0, sizeof(buf));
+    assert(ds && list_first_entry(&ds->entries, struct data_entry, entry)->data[0] == 'n');
+    free_data_set(ds, 0);
+    ds = cinq_numa_wcache_collect(n, &fpnt);
+    assert(ds && !list_empty(&ds->entries));
+    free_data_set(ds, 1);
+    cinq_numa_destroy(n);
+    printf("*** done test19\n");
+}
+
+void test20() {
+    printf("*** donig test20\n");
+    struct fingerprint fpnt = { .value = "t-20\0\0\0\0\0\0\0\0\0\0\0\0" };
+    struct cinq_stats st;
+    struct data_entry *e;
+    char buf[8192];
+    
+    cinq_cache_stats(&st);
+    unsigned long dirty = st.wcache_dirty;
+    assert(wcache_snapshot(&fpnt) == NULL);
+    
+    struct data_entry de = { .data = buf, .offset = 0, .len = 8192 };
+    memset(buf, 'a', sizeof(buf));
+    wcache_write(&fpnt, &de);
+    struct cinq_snapshot *s = wcache_snapshot(&fpnt);
+    assert(s && wcache_snapshot(&fpnt) == NULL);
+    
+    // writes go on beside the snapshot
+    de.offset = 4096;
+    de.len = 2048;
+    memset(buf, 'b', sizeof(buf));
+    wcache_write(&fpnt, &de);
+    
+    // reads see the new extent over the frozen one
+    struct data_set *ds = wcache_read(&fpnt, 0, 8192);
+    offset_t covered = 0;
+    int n = 0;
+    list_for_each_entry(e, &ds->entries, entry) {
+        char expect = e->offset == 4096 ? 'b' : 'a';
+        assert(e->data[0] == expect && e->data[e->len - 1] == expect);
+        covered += e->len;
+        n++;
+    }
+    assert(n == 3 && covered == 8192);
+    free_data_set(ds, 0);
+    
+    // the snapshot holds what was written before it
+    ds = wcache_snapshot_data(s);
+    e = list_first_entry(&ds->entries, struct data_entry, entry);
+    assert(e->offset == 0 && e->len == 8192 && e->data[4096] == 'a');
+    free_data_set(ds, 0);
+    
+    // collects take only what came after
+    ds = wcache_collect(&fpnt);
+    e = list_first_entry(&ds->entries, struct data_entry, entry);
+    assert(e->offset == 4096 && e->len == 2048 && e->entry.next == &ds->entries);
+    free_data_set(ds, 1);
+    ds = wcache_read(&fpnt, 0, 8192);
+    assert(list_first_entry(&ds->entries, struct data_entry, entry)->len == 8192);
+    free_data_set(ds, 0);
+    
+    wcache_snapshot_release(s);
+    assert(wcache_read(&fpnt, 0, 8192) == NULL);
+    cinq_cache_stats(&st);
+    assert(st.wcache_dirty == dirty && st.wsnapshots == 1 && st.wsnapshot_bytes == 8192);
+    printf("*** done test20\n");
+}
+
+// sums the bytes of a data set, checking each byte against expect(offset)
+static offset_t check_set(struct data_set *ds, char (*expect)(offset_t)) {
+    struct data_entry *e;
+    offset_t bytes = 0, i;
+    list_for_each_entry(e, &ds->entries, entry) {
+        for (i = 0; i < e->len; i++) {
+            assert(e->data[i] == expect(e->offset + i));
+        }
+        bytes += e->len;
+    }
+    return bytes;
+}
+
+// test21 writes 8K blocks, overwriting three of every four
+static char log_expect(offset_t offset) {
+    return (offset / 8192) % 4 == 0 ? 'o' : 'x';
+}
+
+static char log_expect_big(offset_t offset) {
+    return (char) ('a' + offset / 65536);
+}
+
+void test21() {
+    printf("*** donig test21\n");
+    struct fingerprint fpnt = { .value = "t-21\0\0\0\0\0\0\0\0\0\0\0\0" };
+    struct cinq_config cfg = { .slots = 16 };
+    struct cinq_stats st;
+    struct data_entry de;
+    char buf[4 * 65536];
+    int i;
+    
+    struct cinq_cache *c = cinq_cache_create(&cfg);
+    assert(cinq_wcache_log_enable(c, 0) == -1);
+    assert(cinq_wcache_log_enable(c, 65536) == 0);
+    assert(cinq_wcache_log_enable(c, 65536) == -1);
+    
+    // 32 blocks over four segments, then most of them again
+    de.data = buf;
+    de.len = 8192;
+    memset(buf, 'o', de.len);
+    for (i = 0; i < 32; i++) {
+        de.offset = i * 8192;
+        cinq_wcache_write(c, &fpnt, &de);
+    }
+    memset(buf, 'x', de.len);
+    for (i = 0; i < 32; i++) {
+        if (i % 4) {
+            de.offset = i * 8192;
+            cinq_wcache_write(c, &fpnt, &de);
+        }
+    }
+    
+    // a write inside an extent cuts it in three
+    de.offset = 4096;
+    de.len = 2048;
+    memset(buf, 'o', de.len);
+    cinq_wcache_write(c, &fpnt, &de);
+    struct data_set *ds = cinq_wcache_read(c, &fpnt, 0, 8192);
+    assert(check_set(ds, log_expect) == 8192);
+    free_data_set(ds, 0);
+    
+    // the first segments are three quarters dead
+    for (i = 0; i < 1000; i++) {
+        cinq_cache_get_stats(c, &st);
+        if (st.wlog_compactions) {
+            break;
+        }
+        usleep(1000);
+    }
+    assert(st.wlog_compactions > 0 && st.wlog_moved_bytes > 0);
+    assert(st.wcache_dirty == 32 * 8192);
+    
+    ds = cinq_wcache_collect(c, &fpnt);
+    assert(check_set(ds, log_expect) == 32 * 8192);
+    free_data_set(ds, 1);
+    
+    // a write larger than a segment is split
+    for (i = 0; i < 4; i++) {
+        memset(buf + i * 65536, 'a' + i, 65536);
+    }
+    de.offset = 0;
+    de.len = sizeof(buf);
+    assert(cinq_wcache_write(c, &fpnt, &de) == 0);
+    ds = cinq_wcache_read(c, &fpnt, 0, sizeof(buf));
+    assert(check_set(ds, log_expect_big) == sizeof(buf));
+    free_data_set(ds, 0);
+    ds = cinq_wcache_collect(c, &fpnt);
+    assert(check_set(ds, log_expect_big) == sizeof(buf));
+    free_data_set(ds, 1);
+    
+    cinq_cache_get_stats(c, &st);
+    assert(st.wcache_dirty == 0 && st.wlog_segments <= 8);
+    cinq_cache_destroy(c);
+    
+    // a segment with data of a snapshot is passed over, not the others
+    struct fingerprint frz = { .value = "t-21-frozen\0\0\0\0\0" };
+    struct fingerprint keep = { .value = "t-21-keep\0\0\0\0\0\0\0" };
+    c = cinq_cache_create(&cfg);
+    assert(cinq_wcache_log_enable(c, 65536) == 0);
+    de.len = 8192;
+    de.offset = 0;
+    cinq_wcache_write(c, &frz, &de);
+    struct cinq_snapshot *snap = cinq_wcache_snapshot(c, &frz);
+    assert(snap);
+    int round;
+    for (round = 0; round < 3; round++) {
+        // the first segment ends with the frozen block alone, the second
+        // with the kept one alone
+        if (round == 1) {
+            cinq_wcache_write(c, &keep, &de);
+        }
+        for (i = 0; i < 7; i++) {
+            de.offset = i * 8192;
+            cinq_wcache_write(c, &fpnt, &de);
+        }
+    }
+    de.offset = 7 * 8192;
+    cinq_wcache_write(c, &fpnt, &de);
+    de.offset = 0;
+    cinq_wcache_write(c, &fpnt, &de); // seals the third segment
+    for (i = 0; i < 1000; i++) {
+        cinq_cache_get_stats(c, &st);
+        if (st.wlog_compactions) {
+            break;
+        }
+        usleep(1000);
+    }
+    assert(st.wlog_compactions > 0);
+    wcache_snapshot_release(snap);
+    cinq_cache_destroy(c);
+    printf("*** done test21\n");
+}
+
+void test22() {
+    printf("*** donig test22\n");
+    struct fingerprint fpnt = { .value = "t-22\0\0\0\0\0\0\0\0\0\0\0\0" };
+    struct cinq_config cfg = { .slots = 16 };
+    struct cinq_stats st;
+    struct data_entry de;
+    struct data_set *ds;
+    char buf[4096];
+    char *old;
+    int i;
+    
+    // in place: outside an epoch, nothing is held back
+    struct cinq_cache *c = cinq_cache_create(&cfg);
+    de.data = buf;
+    de.offset = 0;
+    de.len = sizeof(buf);
+    memset(buf, 'a', sizeof(buf));
+    cinq_wcache_write(c, &fpnt, &de);
+    memset(buf, 'b', sizeof(buf));
+    cinq_wcache_write(c, &fpnt, &de);
+    free_data_set(cinq_wcache_collect(c, &fpnt), 1);
+    cinq_cache_get_stats(c, &st);
+    assert(st.wdeferred == 0);
+    
+    // inside, read data survive an overwrite and a collect
+    memset(buf, 'a', sizeof(buf));
+    cinq_wcache_write(c, &fpnt, &de);
+    assert(cinq_epoch_enter() == 0);
+    assert(cinq_epoch_enter() == 0);
+    ds = cinq_wcache_read(c, &fpnt, 0, sizeof(buf));
+    old = list_first_entry(&ds->entries, struct data_entry, entry)->data;
+    free_data_set(ds, 0);
+    memset(buf, 'b', sizeof(buf));
+    cinq_wcache_write(c, &fpnt, &de);
+    cinq_epoch_exit();
+    ds = cinq_wcache_collect(c, &fpnt);
+    assert(list_first_entry(&ds->entries, struct data_entry, entry)->data[0] == 'b');
+    free_data_set(ds, 1);
+    for (i = 0; i < (int) sizeof(buf); i++) {
+        assert(old[i] == 'a');
+    }
+    cinq_epoch_exit();
+    cinq_cache_get_stats(c, &st);
+    assert(st.wdeferred == 2);
+    cinq_cache_destroy(c);
+    
+    // in the log, read data survive their segment being recycled
+    c = cinq_cache_create(&cfg);
+    assert(cinq_wcache_log_enable(c, 4 * sizeof(buf)) == 0);
+    memset(buf, 'a', sizeof(buf));
+    cinq_wcache_write(c, &fpnt, &de);
+    assert(cinq_epoch_enter() == 0);
+    ds = cinq_wcache_read(c, &fpnt, 0, sizeof(buf));
+    old = list_first_entry(&ds->entries, struct data_entry, entry)->data;
+    free_data_set(ds, 0);
+    for (i = 0; i < 64; i++) {
+        memset(buf, 'b' + i % 16, sizeof(buf));
+        cinq_wcache_write(c, &fpnt, &de);
+    }
+    free_data_set(cinq_wcache_collect(c, &fpnt), 1);
+    for (i = 0; i < (int) sizeof(buf); i++) {
+        assert(old[i] == 'a');
+    }
+    cinq_epoch_exit();
+    cinq_cache_get_stats(c, &st);
+    assert(st.wdeferred > 0);
+    cinq_cache_destroy(c);
+    
+    // ... and the head they were read from being sealed after a collect
+    char fill[4 * 4096];
+    c = cinq_cache_create(&cfg);
+    assert(cinq_wcache_log_enable(c, sizeof(fill)) == 0);
+    de.data = buf;
+    de.len = sizeof(buf);
+    memset(buf, 'a', sizeof(buf));
+    cinq_wcache_write(c, &fpnt, &de);
+    assert(cinq_epoch_enter() == 0);
+    ds = cinq_wcache_read(c, &fpnt, 0, sizeof(buf));
+    old = list_first_entry(&ds->entries, struct data_entry, entry)->data;
+    free_data_set(ds, 0);
+    free_data_set(cinq_wcache_collect(c, &fpnt), 1);
+    memset(fill, 'b', sizeof(fill));
+    de.data = fill;
+    de.len = sizeof(fill);
+    cinq_wcache_write(c, &fpnt, &de); // seals the emptied head
+    memset(fill, 'c', sizeof(fill));
+    cinq_wcache_write(c, &fpnt, &de); // and fills another segment
+    for (i = 0; i < (int) sizeof(buf); i++) {
+        assert(old[i] == 'a');
+    }
+    cinq_epoch_exit();
+    cinq_cache_destroy(c);
+    printf("*** done test22\n");
+}
+
+struct lockless_run {
+    struct cinq_cache *cache;
+    struct fingerprint fpnt;
+    int stop;
+    unsigned long torn;
+};
+
+// gets every block over and over, counting blocks not of one fill
+static void *lockless_reader(void *arg) {
+    struct lockless_run *r = (struct lockless_run *) arg;
+    struct data_entry *de;
+    offset_t i, j;
+    while (!__atomic_load_n(&r->stop, __ATOMIC_ACQUIRE)) {
+        for (i = 0; i < 64; i++) {
+            struct data_set *ds = cinq_rcache_get(r->cache, &r->fpnt, i * 4096, 4096);
+            if (ds == NULL) {
+                continue;
+            }
+            list_for_each_entry(de, &ds->entries, entry) {
+                for (j = 1; j < de->len; j++) {
+                    if (de->data[j] != de->data[0]) {
+                        r->torn++;
+                        break;
+                    }
+                }
+            }
+            free_data_set(ds, 1);
+        }
+    }
+    return NULL;
+}
+
+void test23() {
+    printf("*** donig test23\n");
+    struct fingerprint fpnt = { .value = "t-23\0\0\0\0\0\0\0\0\0\0\0\0" };
+    struct cinq_config cfg = { .limit = 3 * 4096, .slots = 16 };
+    struct cinq_stats st;
+    struct data_entry de;
+    struct data_set *ds;
+    char buf[4096];
+    int i;
+    
+    // hits without the lock still steer eviction
+    struct cinq_cache *c = cinq_cache_create(&cfg);
+    de.data = buf;
+    de.len = sizeof(buf);
+    for (i = 0; i < 2; i++) {
+        memset(buf, 'a' + i, sizeof(buf));
+        de.offset = i * 4096;
+        cinq_rcache_put(c, &fpnt, &de);
+    }
+    ds = cinq_rcache_get(c, &fpnt, 0, 4096);
+    assert(ds && list_first_entry(&ds->entries, struct data_entry, entry)->data[4095] == 'a');
+    free_data_set(ds, 1);
+    cinq_cache_get_stats(c, &st);
+    assert(st.rget_lockless == 1 && st.rget_hits == 1);
+    de.offset = 2 * 4096;
+    cinq_rcache_put(c, &fpnt, &de);
+    ds = cinq_rcache_get(c, &fpnt, 4096, 4096);
+    assert(ds == NULL || list_empty(&ds->entries));
+    free_data_set(ds, 1);
+    ds = cinq_rcache_get(c, &fpnt, 0, 4096);
+    assert(ds && !list_empty(&ds->entries));
+    free_data_set(ds, 1);
+    cinq_cache_get_stats(c, &st);
+    assert(st.rget_lockless == 2 && st.rget_misses == 1);
+    
+    // TinyLFU and the curve count hits without taking the lock
+    assert(cinq_rcache_tinylfu_enable(c, 4096) == 0);
+    assert(cinq_rcache_mrc_enable(c, 1) == 0);
+    for (i = 0; i < 3; i++) {
+        free_data_set(cinq_rcache_get(c, &fpnt, 0, 4096), 1);
+    }
+    cinq_cache_get_stats(c, &st);
+    assert(st.rget_lockless == 5 && st.mrc_samples == 3);
+    assert(st.mrc_hit_ppm[3] == 666666);
+    cinq_cache_destroy(c);
+    
+    // readers never see a block half overwritten, evicted or invalidated
+    struct lockless_run run = { .fpnt = fpnt };
+    pthread_t readers[4];
+    cfg.limit = 48 * 4096;
+    run.cache = c = cinq_cache_create(&cfg);
+    for (i = 0; i < 4; i++) {
+        pthread_create(&readers[i], NULL, lockless_reader, &run);
+    }
+    for (i = 0; i < 20000; i++) {
+        memset(buf, 'a' + i % 26, sizeof(buf));
+        de.offset = (i * 7 % 64) * 4096;
+        cinq_rcache_put(c, &fpnt, &de);
+        if (i % 1000 == 999) {
+            cinq_rcache_invalidate_file(c, &fpnt);
+        } else if (i % 100 == 99) {
+            cinq_rcache_invalidate(c, &fpnt, de.offset, 4096);
+        }
+    }
+    __atomic_store_n(&run.stop, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < 4; i++) {
+        pthread_join(readers[i], NULL);
+    }
+    assert(run.torn == 0);
+    cinq_cache_get_stats(c, &st);
+    assert(st.rget_lockless > 0 && st.evictions > 0);
+    cinq_cache_destroy(c);
+    printf("*** done test23\n");
+}
+
+struct l0_run {
+    struct cinq_cache *c[2];
+    struct fingerprint fpnt;
+    pthread_barrier_t used, destroyed;
+    unsigned int before, after;
+};
+
+static void *l0_user(void *arg) {
+    struct l0_run *run = (struct l0_run *) arg;
+    int i;
+    for (i = 0; i < 2; i++) {
+        free_data_set(cinq_rcache_get(run->c[i], &run->fpnt, 0, 4096), 1);
+    }
+    run->before = l0_my_tables();
+    pthread_barrier_wait(&run->used);
+    pthread_barrier_wait(&run->destroyed);
+    free_data_set(cinq_rcache_get(run->c[1], &run->fpnt, 0, 4096), 1);
+    run->after = l0_my_tables();
+    return NULL;
+}
+
+void test24() {
+    printf("*** donig test24\n");
+    struct fingerprint fpnt = { .value = "t-24\0\0\0\0\0\0\0\0\0\0\0\0" };
+    struct cinq_config cfg = { .limit = 3 * 4096, .slots = 16 };
+    struct cinq_cache *c = cinq_cache_create(&cfg);
+    struct cinq_stats st;
+    struct data_entry de;
+    struct data_set *ds;
+    char buf[4096];
+    int i;
+    
+    assert(cinq_rcache_l0_enable(c, 10, 0) == -1);
+    assert(cinq_rcache_l0_enable(c, 10, 4096) == 0);
+    de.data = buf;
+    de.len = sizeof(buf);
+    de.offset = 0;
+    memset(buf, 'a', sizeof(buf));
+    cinq_rcache_put(c, &fpnt, &de);
+    
+    // the second get of a range is served from the copy, whole extent
+    for (i = 0; i < 2; i++) {
+        ds = cinq_rcache_get(c, &fpnt, 100, 200);
+        assert(ds && list_is_singular(&ds->entries));
+        de = *list_first_entry(&ds->entries, struct data_entry, entry);
+        assert(de.offset == 0 && de.len == 4096 && de.data[4095] == 'a');
+        free_data_set(ds, 1);
+    }
+    cinq_cache_get_stats(c, &st);
+    assert(st.rget_l0 == 1 && st.rget_hits == 2);
+    
+    // an overwrite outdates the copy
+    de.data = buf;
+    de.offset = 0;
+    memset(buf, 'b', sizeof(buf));
+    cinq_rcache_put(c, &fpnt, &de);
+    for (i = 0; i < 2; i++) {
+        ds = cinq_rcache_get(c, &fpnt, 100, 200);
+        assert(ds && list_first_entry(&ds->entries, struct data_entry, entry)->data[0] == 'b');
+        free_data_set(ds, 1);
+    }
+    cinq_cache_get_stats(c, &st);
+    assert(st.rget_l0 == 2);
+    
+    // every 32nd hit of a copy goes to R-cache
+    for (i = 0; i < 40; i++) {
+        free_data_set(cinq_rcache_get(c, &fpnt, 100, 200), 1);
+    }
+    cinq_cache_get_stats(c, &st);
+    assert(st.rget_l0 == 2 + 39 && st.rget_hits == 44);
+    
+    // so do gets after an eviction or an invalidation
+    for (i = 1; i < 3; i++) {
+        de.offset = i * 4096;
+        cinq_rcache_put(c, &fpnt, &de);
+    }
+    ds = cinq_rcache_get(c, &fpnt, 100, 200);
+    assert(ds == NULL || list_empty(&ds->entries));
+    free_data_set(ds, 1);
+    for (i = 0; i < 2; i++) {
+        free_data_set(cinq_rcache_get(c, &fpnt, 4096, 4096), 1);
+    }
+    cinq_rcache_invalidate_file(c, &fpnt);
+    ds = cinq_rcache_get(c, &fpnt, 4096, 4096);
+    assert(ds == NULL || list_empty(&ds->entries));
+    free_data_set(ds, 1);
+    cinq_cache_get_stats(c, &st);
+    assert(st.rget_l0 == 42 && st.rget_misses == 2);
+    
+    // off, gets go to R-cache again
+    de.offset = 0;
+    cinq_rcache_put(c, &fpnt, &de);
+    assert(cinq_rcache_l0_enable(c, 0, 0) == 0);
+    for (i = 0; i < 2; i++) {
+        free_data_set(cinq_rcache_get(c, &fpnt, 0, 4096), 1);
+    }
+    cinq_cache_get_stats(c, &st);
+    assert(st.rget_l0 == 42 && st.rget_hits == 48);
+    unsigned int tables = l0_my_tables();
+    cinq_cache_destroy(c);
+    assert(l0_my_tables() == tables - 1);
+    
+    // other threads drop the copies of a destroyed cache at their next get
+    struct l0_run run = { .fpnt = fpnt };
+    pthread_t user;
+    pthread_barrier_init(&run.destroyed, NULL, 2);
+    pthread_barrier_init(&run.used, NULL, 2);
+    for (i = 0; i < 2; i++) {
+        run.c[i] = cinq_cache_create(&cfg);
+        assert(cinq_rcache_l0_enable(run.c[i], 16, 4096) == 0);
+    }
+    pthread_create(&user, NULL, l0_user, &run);
+    pthread_barrier_wait(&run.used);
+    cinq_cache_destroy(run.c[0]);
+    pthread_barrier_wait(&run.destroyed);
+    pthread_join(user, NULL);
+    assert(run.before == 2 && run.after == 1);
+    cinq_cache_destroy(run.c[1]);
+    pthread_barrier_destroy(&run.destroyed);
+    pthread_barrier_destroy(&run.used);
+    printf("*** done test24\n");
+}
+
+// Puts three blocks of tag into c, which holds two, and gets the first
+// back from L2 on c.
+static void l2_round_trip(struct cinq_cache *c, struct fingerprint *fpnt, char tag) {
+    struct cinq_stats before, st;
+    struct data_entry de;
+    struct data_set *ds;
+    char buf[4096];
+    int i;
+    
+    cinq_cache_get_stats(c, &before);
+    de.data = buf;
+    de.len = sizeof(buf);
+    for (i = 0; i < 3; i++) {
+        memset(buf, tag + i, sizeof(buf));
+        de.offset = i * 4096;
+        cinq_rcache_put(c, fpnt, &de);
+    }
+    cinq_cache_get_stats(c, &st);
+    assert(st.evictions == before.evictions + 1 && st.l2_spills == before.l2_spills + 1);
+    
+    // the miss takes the extent back from L2 and puts it in R-cache again
+    ds = cinq_rcache_get(c, fpnt, 100, 200);
+    assert(ds && list_is_singular(&ds->entries));
+    de = *list_first_entry(&ds->entries, struct data_entry, entry);
+    assert(de.offset == 0 && de.len == 4096 && de.data[0] == tag && de.data[4095] == tag);
+    free_data_set(ds, 1);
+    cinq_cache_get_stats(c, &st);
+    assert(st.l2_hits == before.l2_hits + 1 && st.rget_hits == before.rget_hits + 1);
+    ds = cinq_rcache_get(c, fpnt, 0, 4096);
+    assert(ds && list_first_entry(&ds->entries, struct data_entry, entry)->data[0] == tag);
+    free_data_set(ds, 1);
+    cinq_cache_get_stats(c, &st);
+    assert(st.l2_hits == before.l2_hits + 1);
+}
+
+// R-cache spills evicted extents to L2 and takes them back on a miss
+void test25() {
+    printf("*** donig test25\n");
+    struct fingerprint fpnt = { .value = "t-25\0\0\0\0\0\0\0\0\0\0\0\0" };
+    struct cinq_config cfg = { .limit = 3 * 4096, .slots = 16 };
+    struct l2_config l2cfg = {
+        .path = "/tmp/cinq_utest_l2_25",
+        .capacity = 16 * 4096,
+        .segment_size = 4096,
+        .admit = L2_ADMIT_ALL,
+    };
+    struct cinq_cache *c = cinq_cache_create(&cfg);
+    assert(cinq_rcache_l2_enable(c, &l2cfg) == 0);
+    l2_round_trip(c, &fpnt, 'a');
+    cinq_cache_destroy(c);
+    unlink(l2cfg.path);
+    printf("*** done test25\n");
+}
+
+// caches enabling L2 keep their own
+void test26() {
+    printf("*** donig test26\n");
+    struct fingerprint fpnt = { .value = "t-26\0\0\0\0\0\0\0\0\0\0\0\0" };
+    struct cinq_config cfg = { .limit = 3 * 4096, .slots = 16 };
+    struct l2_config l2cfg[2] = {
+        { .path = "/tmp/cinq_utest_l2_26a", .capacity = 16 * 4096, .segment_size = 4096 },
+        { .path = "/tmp/cinq_utest_l2_26b", .capacity = 16 * 4096, .segment_size = 4096 },
+    };
+    struct l2_config defcfg = { .path = "/tmp/cinq_utest_l2_26", .capacity = 16 * 4096, .segment_size = 4096 };
+    struct cinq_stats st;
+    struct cinq_cache *c[2];
+    struct data_entry de;
+    struct data_set *ds;
+    char buf[4096];
+    int i;
+    
+    assert(rcache_l2_enable(&defcfg) == 0);
+    for (i = 0; i < 2; i++) {
+        c[i] = cinq_cache_create(&cfg);
+        assert(cinq_rcache_l2_enable(c[i], &l2cfg[i]) == 0);
+    }
+    // enabling again replaces the L2 of that cache only
+    assert(cinq_rcache_l2_enable(c[0], &l2cfg[0]) == 0);
+    l2_round_trip(c[0], &fpnt, 'a');
+    l2_round_trip(c[1], &fpnt, 'k');
+    for (i = 0; i < 2; i++) {
+        cinq_cache_destroy(c[i]);
+        unlink(l2cfg[i].path);
+    }
+    
+    // the default cache still has its L2
+    memset(buf, 'z', sizeof(buf));
+    de.data = buf;
+    de.offset = 0;
+    de.len = sizeof(buf);
+    rcache_put(&fpnt, &de);
+    rcache_shrink((size_t) -1);
+    cinq_cache_stats(&st);
+    unsigned long l2_hits = st.l2_hits, rput = st.rput;
+    ds = rcache_get(&fpnt, 0, 4096);
+    assert(ds && list_first_entry(&ds->entries, struct data_entry, entry)->data[0] == 'z');
+    free_data_set(ds, 1);
+    cinq_cache_stats(&st);
+    assert(st.l2_hits == l2_hits + 1 && st.rput == rput); // a take-back is no put
+    rcache_l2_disable();
+    unlink(defcfg.path);
+    printf("*** done test26\n");
+}
+
+// a put on one node outdates the copies on the others; run with a fixed
+// layout of two shards by make runtest
+void test27() {
+    printf("*** donig test27\n");
+    struct fingerprint fpnt = { .value = "t-27\0\0\0\0\0\0\0\0\0\0\0\0" };
+    struct cinq_config cfg = { .limit = 1024 * 1024, .slots = 64 };
+    struct data_set *ds;
+    char buf[4096];
+    int i;
+    
+    struct cinq_numa *n = cinq_numa_create(&cfg, 0);
+#ifdef CINQ_NUMA_FAKE_NODES
+    assert(n && cinq_numa_shards(n) == CINQ_NUMA_FAKE_NODES);
+#endif
+    // every node holds an old copy, as if put there earlier
+    struct data_entry de = { .data = buf, .offset = 0, .len = sizeof(buf) };
+    memset(buf, 'o', sizeof(buf));
+    for (i = 0; i < cinq_numa_shards(n); i++) {
+        cinq_rcache_put(cinq_numa_shard(n, i), &fpnt, &de);
+    }
+    de.offset = 1024;
+    de.len = 1024;
+    memset(buf, 'n', sizeof(buf));
+    cinq_numa_rcache_put(n, &fpnt, &de);
+    
+    // whichever shard a get lands on, it sees the new bytes or nothing
+    for (i = 0; i < cinq_numa_shards(n); i++) {
+        ds = cinq_rcache_get(cinq_numa_shard(n, i), &fpnt, 1024, 1024);
+        if (ds && !list_empty(&ds->entries)) {
+            de = *list_first_entry(&ds->entries, struct data_entry, entry);
+            assert(de.data[1024 - de.offset] == 'n');
+        }
+        free_data_set(ds, 1);
+    }
+    ds = cinq_numa_rcache_get(n, &fpnt, 1024, 1024);
+    assert(ds);
+    de = *list_first_entry(&ds->entries, struct data_entry, entry);
+    assert(de.data[1024 - de.offset] == 'n');
+    free_data_set(ds, 1);
+    
+    // shards holding a block each serve the range together, in order
+    struct fingerprint other = { .value = "t-27-other\0\0\0\0\0\0" };
+    struct cinq_node_stats ns;
+    struct data_entry *e;
+    unsigned long hits = 0, partial = 0;
+    int k = 0;
+    de.data = buf;
+    de.len = sizeof(buf);
+    for (i = 0; i < cinq_numa_shards(n); i++) {
+        memset(buf, 'a' + i, sizeof(buf));
+        de.offset = i * sizeof(buf);
+        cinq_rcache_put(cinq_numa_shard(n, i), &other, &de);
+    }
+    ds = cinq_numa_rcache_get(n, &other, 0, i * sizeof(buf));
+    assert(ds);
+    list_for_each_entry(e, &ds->entries, entry) {
+        assert(e->offset == k * sizeof(buf) && e->len == sizeof(buf) && e->data[0] == 'a' + k);
+        k++;
+    }
+    assert(k == i);
+    free_data_set(ds, 1);
+    ds = cinq_numa_rcache_get(n, &other, 0, (i + 1) * sizeof(buf));
+    assert(ds);
+    free_data_set(ds, 1);
+    for (i = 0; i < cinq_numa_shards(n); i++) {
+        assert(cinq_numa_node_stats(n, i, &ns) == 0);
+        hits += ns.local_hits + ns.remote_hits;
+        partial += ns.partial;
+    }
+    assert(hits == 2 && partial == 1);
+    cinq_numa_destroy(n);
+    printf("*** done test27\n");
+}
+
+// puts kept out by TinyLFU leave no older copy behind
+void test28() {
+    printf("*** donig test28\n");
+    struct fingerprint fpnt = { .value = "t-28\0\0\0\0\0\0\0\0\0\0\0\0" };
+    struct cinq_config cfg = { .limit = 3 * 4096, .slots = 16 };
+    struct l2_config l2cfg = { .path = "/tmp/cinq_utest_l2_28", .capacity = 16 * 4096, .segment_size = 4096 };
+    struct cinq_cache *c = cinq_cache_create(&cfg);
+    struct cinq_stats st;
+    struct data_entry de;
+    struct data_set *ds;
+    char buf[4096];
+    int i;
+    
+    assert(cinq_rcache_l2_enable(c, &l2cfg) == 0);
+    assert(cinq_rcache_tinylfu_enable(c, 4096) == 0);
+    de.data = buf;
+    de.len = sizeof(buf);
+    for (i = 0; i < 2; i++) {
+        memset(buf, 'a' + i, sizeof(buf));
+        de.offset = i * 4096;
+        cinq_rcache_put(c, &fpnt, &de);
+    }
+    // the third block, asked for often, pushes the first to L2
+    for (i = 0; i < 3; i++) {
+        free_data_set(cinq_rcache_get(c, &fpnt, 2 * 4096, 4096), 1);
+    }
+    memset(buf, 'c', sizeof(buf));
+    de.offset = 2 * 4096;
+    cinq_rcache_put(c, &fpnt, &de);
+    cinq_cache_get_stats(c, &st);
+    assert(st.l2_spills == 1 && st.admit_rejects == 0);
+    
+    // a new first block, never asked for, is kept out
+    memset(buf, 'A', sizeof(buf));
+    de.offset = 0;
+    cinq_rcache_put(c, &fpnt, &de);
+    cinq_cache_get_stats(c, &st);
+    assert(st.admit_rejects == 1 && st.rput == 3 && st.rput_bytes == 3 * 4096);
+    ds = cinq_rcache_get(c, &fpnt, 0, 4096);
+    assert(ds == NULL || list_empty(&ds->entries));
+    free_data_set(ds, 1);
+    
+    // a new second block updates the cached one
+    memset(buf, 'B', sizeof(buf));
+    de.offset = 4096;
+    cinq_rcache_put(c, &fpnt, &de);
+    ds = cinq_rcache_get(c, &fpnt, 4096, 4096);
+    assert(ds && list_first_entry(&ds->entries, struct data_entry, entry)->data[0] == 'B');
+    free_data_set(ds, 1);
+    cinq_cache_get_stats(c, &st);
+    assert(st.admit_rejects == 1 && st.rput == 4);
+    cinq_cache_destroy(c);
+    unlink(l2cfg.path);
+    printf("*** done test28\n");
+}
+
+// extents racing take-backs, long enough that copying one out of L2
+// spans a scheduler tick now and then
+#define TAKEBACK_LEN    (4096 * 1024)
+
+struct takeback_arg {
+    struct cinq_cache *c;
+    struct fingerprint *fpnt;
+    unsigned long floor; // the last put or invalidation done
+    int stop;
+};
+
+// Gets the file, which must be at least of the version the last change
+// before the get left.
+static void takeback_check(struct takeback_arg *a) {
+    unsigned long floor = __atomic_load_n(&a->floor, __ATOMIC_ACQUIRE), got;
+    struct data_set *ds = cinq_rcache_get(a->c, a->fpnt, 0, TAKEBACK_LEN);
+    if (ds && !list_empty(&ds->entries)) {
+        memcpy(&got, list_first_entry(&ds->entries, struct data_entry, entry)->data, sizeof(got));
+        assert(got >= floor);
+    }
+    free_data_set(ds, 1);
+}
+
+// pushes the file out to L2 and misses on it, over and over
+static void *takeback_reader(void *arg) {
+    struct takeback_arg *a = (struct takeback_arg *) arg;
+    while (!__atomic_load_n(&a->stop, __ATOMIC_ACQUIRE)) {
+        cinq_rcache_shrink(a->c, (size_t) -1);
+        takeback_check(a);
+    }
+    return NULL;
+}
+
+// extents taken back from L2 never override a put or an invalidation
+// made while they were read
+void test29() {
+    printf("*** donig test29\n");
+    struct fingerprint fpnt = { .value = "t-29\0\0\0\0\0\0\0\0\0\0\0\0" };
+    struct cinq_config cfg = { .limit = 3 * TAKEBACK_LEN, .slots = 16 };
+    struct l2_config l2cfg = {
+        .path = "/tmp/cinq_utest_l2_29",
+        .capacity = 8 * TAKEBACK_LEN,
+        .segment_size = TAKEBACK_LEN,
+        .admit = L2_ADMIT_ALL,
+    };
+    struct takeback_arg a = { .c = cinq_cache_create(&cfg), .fpnt = &fpnt };
+    struct data_entry de;
+    pthread_t tid[2];
+    char *buf = (char *) calloc(1, TAKEBACK_LEN);
+    unsigned long v;
+    int i;
+    
+    assert(cinq_rcache_l2_enable(a.c, &l2cfg) == 0);
+    for (i = 0; i < 2; i++) {
+        pthread_create(&tid[i], NULL, takeback_reader, &a);
+    }
+    de.data = buf;
+    de.offset = 0;
+    de.len = TAKEBACK_LEN;
+    for (v = 1; v <= 256; v++) {
+        // data of version v are put, or all older ones invalidated
+        if (v % 4 == 0) {
+            cinq_rcache_invalidate(a.c, &fpnt, 0, TAKEBACK_LEN);
+        } else {
+            memcpy(buf, &v, sizeof(v));
+            cinq_rcache_put(a.c, &fpnt, &de);
+        }
+        __atomic_store_n(&a.floor, v, __ATOMIC_RELEASE);
+        takeback_check(&a);
+    }
+    __atomic_store_n(&a.stop, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < 2; i++) {
+        pthread_join(tid[i], NULL);
+    }
+    cinq_cache_destroy(a.c);
+    unlink(l2cfg.path);
+    free(buf);
+    printf("*** done test29\n");
+}
+
+static void count_free(void *arg, void *p, size_t len) {
+    (*(int *) arg)++;
+}
+
+void test30() {
+    printf("*** donig test30\n");
+    struct epoch_limbo pinned, readers;
+    int freed = 0, x;
+    
+    // pins and readers in an epoch never wait for each other
+    epoch_limbo_init(&pinned, 1);
+    epoch_limbo_init(&readers, 0);
+    assert(cinq_epoch_enter() == 0);
+    assert(epoch_defer(&pinned, &x, 0, count_free, &freed) == 0);
+    assert(freed == 0);
+    epoch_reap(&pinned, 0);
+    assert(freed == 1);
+    
+    assert(epoch_pin() == 0);
+    assert(epoch_defer(&pinned, &x, 0, count_free, &freed) == 0);
+    assert(epoch_retire(&readers, &x, 0, count_free, &freed) == 1);
+    cinq_epoch_exit();
+    epoch_reap(&pinned, 0);
+    epoch_reap(&readers, 0);
+    assert(freed == 2);
+    epoch_unpin();
+    epoch_reap(&pinned, 0);
+    assert(freed == 3);
+    printf("*** done test30\n");
+}
+
+void test31() {
+    printf("*** donig test31\n");
+    struct tenant_table tt;
+    struct tenant *a, *b, *c;
+    
+    // the tenant with most usage per weight is the one to check
+    tenant_table_init(&tt);
+    a = tenant_get(&tt, 1);
+    b = tenant_get(&tt, 2);
+    c = tenant_get(&tt, 3);
+    tenant_set(&tt, b, 0, 3);
+    tenant_charge(&tt, a, 100);
+    assert(tenant_most_over(&tt, 50) == NULL); // alone
+    tenant_charge(&tt, b, 300);
+    assert(tenant_most_over(&tt, 400) == NULL);
+    assert(tenant_most_over(&tt, 399) != NULL);
+    tenant_charge(&tt, b, 1);
+    assert(tenant_most_over(&tt, 400) == b);
+    
+    // idle tenants go, set ones stay
+    tenant_charge(&tt, a, -100);
+    assert(tt.n_tenant == 2 && tenant_find(&tt, 1) == NULL);
+    
+    // shares near the top of size_t are exact
+    tenant_charge(&tt, b, -301);
+    assert(tt.n_tenant == 2 && tenant_find(&tt, 2) == b);
+    tenant_charge(&tt, b, 3UL << 61);
+    tenant_charge(&tt, c, (1UL << 61) + 1);
+    assert(tenant_most_over(&tt, (size_t) -1) == NULL);
+    assert(tenant_most_over(&tt, 1UL << 63) == c);
+    tenant_table_fini(&tt);
+    printf("*** done test31\n");
+}
+
+#ifdef CINQ_NUMA_FAKE_NODES
+#define NUMA_PUT_LEN    (256 * 1024)
+
+struct numa_put_arg {
+    struct cinq_numa *n;
+    struct fingerprint *fpnt;
+    pthread_barrier_t *start, *end;
+    int shard, rounds;
+};
+
+static void *numa_putter(void *arg) {
+    struct numa_put_arg *a = (struct numa_put_arg *) arg;
+    char *buf = (char *) malloc(NUMA_PUT_LEN);
+    struct data_entry de = { .data = buf, .offset = 0, .len = NUMA_PUT_LEN };
+    int r;
+    cinq_numa_fake_shard(a->shard);
+    memset(buf, 'a' + a->shard, NUMA_PUT_LEN);
+    for (r = 0; r < a->rounds; r++) {
+        pthread_barrier_wait(a->start);
+        cinq_numa_rcache_put(a->n, a->fpnt, &de);
+        pthread_barrier_wait(a->end);
+    }
+    free(buf);
+    return NULL;
+}
+#endif // CINQ_NUMA_FAKE_NODES
+
+// puts of one file from two nodes at once leave a single copy
+void test32() {
+    printf("*** donig test32\n");
+#ifdef CINQ_NUMA_FAKE_NODES
+    struct fingerprint fpnt = { .value = "t-32\0\0\0\0\0\0\0\0\0\0\0\0" };
+    struct cinq_config cfg = { .limit = 16 * NUMA_PUT_LEN, .slots = 64 };
+    struct numa_put_arg args[2];
+    pthread_barrier_t start, end;
+    pthread_t putters[2];
+    int i, r;
+    
+    struct cinq_numa *n = cinq_numa_create(&cfg, 0);
+    assert(n && cinq_numa_shards(n) == 2);
+    pthread_barrier_init(&start, NULL, 3);
+    pthread_barrier_init(&end, NULL, 3);
+    for (i = 0; i < 2; i++) {
+        args[i] = (struct numa_put_arg) { .n = n, .fpnt = &fpnt, .start = &start, .end = &end,
+                                          .shard = i, .rounds = 200 };
+        pthread_create(&putters[i], NULL, numa_putter, &args[i]);
+    }
+    for (r = 0; r < 200; r++) {
+        pthread_barrier_wait(&start);
+        pthread_barrier_wait(&end);
+        int holders = 0;
+        for (i = 0; i < 2; i++) {
+            struct data_set *ds = cinq_rcache_get(cinq_numa_shard(n, i), &fpnt, 0, NUMA_PUT_LEN);
+            holders += ds && !list_empty(&ds->entries);
+            free_data_set(ds, 1);
+        }
+        assert(holders == 1);
+    }
+    for (i = 0; i < 2; i++) {
+        pthread_join(putters[i], NULL);
+    }
+    pthread_barrier_destroy(&start);
+    pthread_barrier_destroy(&end);
+    cinq_numa_destroy(n);
+#endif // CINQ_NUMA_FAKE_NODES
+    printf("*** done test32\n");
+}
+
 int main(int argc, const char *argv[]) {
     rwcache_init();
     test1();
+    test2();
+    test3();
+    test4();
+    test5();
+    test6();
+    test7();
+    test8();
+    test9();
+    test10();
+    test11();
+    test12();
+    test13();
+    test14();
+    test15();
+    test16();
+    test17();
+    test18();
+    test19();
+    test20();
+    test21();
+    test22();
+    test23();
+    test24();
+    test25();
+    test26();
+    test27();
+    test28();
+    test29();
+    test30();
+    test31();
+    test32();
     rwcache_fini();
     return 0;
 }
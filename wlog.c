@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2012 Yang Zhang <yang.zhang@stanzax.org>
+ * Copyright (C) 2012 Jinglei Ren <jinglei.ren@stanzax.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "wlog.h"
+#include "epoch.h"
+
+#ifdef __KERNEL__
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/string.h>
+#define ALLOC(nbytes)       kmalloc((nbytes), GFP_KERNEL)
+#define FREE(ptr)           kfree(ptr)
+#define ALLOC_SEG(nbytes)   vmalloc(nbytes)
+#define FREE_SEG(ptr)       vfree(ptr)
+#else
+#include <stdlib.h>
+#include <string.h>
+#define ALLOC(nbytes)       malloc(nbytes)
+#define FREE(ptr)           free(ptr)
+#define ALLOC_SEG(nbytes)   malloc(nbytes)
+#define FREE_SEG(ptr)       free(ptr)
+#endif // __KERNEL__
+
+
+static struct wlog_seg *seg_new(struct wlog *l) {
+    struct wlog_seg *seg;
+    if (!list_empty(&l->spare)) {
+        seg = list_entry(l->spare.next, struct wlog_seg, entry);
+        list_del(&seg->entry);
+        l->n_spare--;
+    } else {
+        seg = (struct wlog_seg *) ALLOC(sizeof(struct wlog_seg));
+        if (seg == NULL) {
+            return NULL;
+        }
+        seg->base = (char *) ALLOC_SEG(l->seg_size);
+        if (seg->base == NULL) {
+            FREE(seg);
+            return NULL;
+        }
+        l->n_seg++;
+    }
+    INIT_LIST_HEAD(&seg->extents);
+    seg->used = seg->live = 0;
+    return seg;
+}
+
+static void seg_free(struct wlog *l, struct wlog_seg *seg) {
+    FREE_SEG(seg->base);
+    FREE(seg);
+    l->n_seg--;
+}
+
+
+struct wlog *wlog_create(size_t seg_size) {
+    struct wlog *l = (struct wlog *) ALLOC(sizeof(struct wlog));
+    if (l == NULL) {
+        return NULL;
+    }
+    l->seg_size = seg_size;
+    INIT_LIST_HEAD(&l->sealed);
+    INIT_LIST_HEAD(&l->spare);
+    l->n_seg = l->n_spare = 0;
+    l->head = seg_new(l);
+    if (l->head == NULL) {
+        FREE(l);
+        return NULL;
+    }
+    return l;
+}
+
+
+void wlog_destroy(struct wlog *l) {
+    struct wlog_seg *seg, *tmp;
+    list_for_each_entry_safe(seg, tmp, &l->sealed, entry) {
+        seg_free(l, seg);
+    }
+    list_for_each_entry_safe(seg, tmp, &l->spare, entry) {
+        seg_free(l, seg);
+    }
+    seg_free(l, l->head);
+    FREE(l);
+}
+
+
+char *wlog_append(struct wlog *l, const char *data, size_t len, struct wlog_seg **seg,
+                  struct wlog_seg **emptied) {
+    *emptied = NULL;
+    if (len > l->seg_size) {
+        return NULL;
+    }
+    if (l->head->used + len > l->seg_size) {
+        struct wlog_seg *head = seg_new(l);
+        if (head == NULL) {
+            return NULL;
+        }
+        if (l->head->live) {
+            list_add_tail(&l->head->entry, &l->sealed);
+        } else {
+            *emptied = l->head; // readers may still see its data
+        }
+        l->head = head;
+    }
+    char *p = l->head->base + l->head->used;
+    memcpy(p, data, len);
+    l->head->used += len;
+    l->head->live += len;
+    *seg = l->head;
+    return p;
+}
+
+
+int wlog_kill(struct wlog *l, struct wlog_seg *seg, size_t len) {
+    seg->live -= len;
+    if (seg == l->head) {
+        if (seg->live == 0 && !epoch_readers()) {
+            seg->used = 0; // start over, no reader can see the old data
+        }
+        return 0;
+    }
+    if (seg->live) {
+        return 0;
+    }
+    list_del(&seg->entry);
+    return 1;
+}
+
+
+void wlog_recycle(struct wlog *l, struct wlog_seg *seg) {
+    if (l->n_spare < WLOG_SPARES) {
+        list_add(&seg->entry, &l->spare);
+        l->n_spare++;
+    } else {
+        seg_free(l, seg);
+    }
+}
+
+
+struct wlog_seg *wlog_victim(struct wlog *l, unsigned int pct,
+                             int (*skip)(void *arg, struct wlog_seg *seg), void *arg) {
+    struct wlog_seg *seg, *victim = NULL;
+    size_t bound = l->seg_size / 100 * pct;
+    list_for_each_entry(seg, &l->sealed, entry) {
+        if (seg->live < bound && (victim == NULL || seg->live < victim->live) &&
+            (skip == NULL || !skip(arg, seg))) {
+            victim = seg;
+        }
+    }
+    return victim;
+}
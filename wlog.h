@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2012 Yang Zhang <yang.zhang@stanzax.org>
+ * Copyright (C) 2012 Jinglei Ren <jinglei.ren@stanzax.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+//
+//  wlog.h
+//  Cinquain Cache
+//
+//  Log segments for the log-structured W-cache.
+//
+//  Written data are appended to the head segment; a full head is sealed
+//  and a new one opened. Each segment counts the bytes still indexed, and
+//  lists the index nodes pointing into it so that its live data can be
+//  moved elsewhere. A segment whose bytes are all dead becomes a spare for
+//  the next head once no reader can see it. The caller serializes all calls.
+//
+
+#ifndef CINQUAIN_WLOG_H_
+#define CINQUAIN_WLOG_H_
+
+#include "cinq_cache.h"
+
+// spare segments kept for reuse, more go back to the system
+#define WLOG_SPARES     2
+
+struct wlog_seg {
+    struct list_head entry;     // on the sealed or the spare list
+    struct list_head extents;   // index nodes with data in the segment
+    char *base;
+    size_t used;                // bytes appended
+    size_t live;                // ... and still indexed
+};
+
+struct wlog {
+    size_t seg_size;
+    struct wlog_seg *head;      // being appended to
+    struct list_head sealed;
+    struct list_head spare;
+    unsigned long n_seg;        // segments allocated, spares included
+    unsigned long n_spare;
+};
+
+// Creates a log with one head segment of seg_size. Returns NULL on failure.
+struct wlog *wlog_create(size_t seg_size);
+
+// Frees all segments; the data in them become invalid.
+void wlog_destroy(struct wlog *l);
+
+// Copies len bytes, at most seg_size, to the head and returns where they
+// went, with the segment in *seg. Returns NULL if out of memory. A head
+// sealed with no live bytes is put in *emptied, else NULL; like a segment
+// emptied by wlog_kill(), it waits for wlog_recycle().
+char *wlog_append(struct wlog *l, const char *data, size_t len, struct wlog_seg **seg,
+                  struct wlog_seg **emptied);
+
+// Marks len bytes of seg dead. Returns 1 if seg is sealed and now empty;
+// it is off the sealed list and waits for wlog_recycle().
+int wlog_kill(struct wlog *l, struct wlog_seg *seg, size_t len);
+
+// Keeps an emptied segment as a spare or frees it.
+void wlog_recycle(struct wlog *l, struct wlog_seg *seg);
+
+// Returns the sealed segment with the fewest live bytes if they are under
+// pct percent of a segment, or NULL. Segments for which skip(arg, seg)
+// is non-zero are passed over; skip may be NULL.
+struct wlog_seg *wlog_victim(struct wlog *l, unsigned int pct,
+                             int (*skip)(void *arg, struct wlog_seg *seg), void *arg);
+
+#endif // CINQUAIN_WLOG_H_